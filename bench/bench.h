@@ -0,0 +1,150 @@
+// tiny timing harness for the bench/ programs, include after build.h.
+//
+//   bench_init(argc, argv);                  // --json, --reps N, --filter name
+//   bench_run("fmt", 100000, run_fmt, NULL); // items per call, for the rate
+//   return bench_finish();
+//
+// every benchmark gets `warmup` untimed calls and `reps` timed ones, and
+// reports min, median, p95 and mean wall time plus TSC ticks on x86. with
+// --json each result is one JSON object per line on stdout, so runs can be
+// appended to a file and compared across releases.
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#if BH_X86_SIMD
+#include <x86intrin.h>
+#endif
+
+#define BENCH_MAX_REPS 1000
+
+// assert that still runs under -DNDEBUG, where benchmarks are built: the
+// checked call is usually the work being measured
+#define bench_check(expr) do {                                              \
+  if (!(expr)) {                                                            \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+    abort();                                                                \
+  }                                                                         \
+} while (0)
+
+typedef struct {
+  bool json;
+  int reps;
+  int warmup;
+  const char *filter;
+  int ran;
+} bench_options_t;
+
+static bench_options_t bench_options = { .reps = 10, .warmup = 2 };
+
+static int64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t bench_ticks(void)
+{
+#if BH_X86_SIMD
+  return (int64_t)__rdtsc();
+#else
+  return -1;
+#endif
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// nearest rank on sorted samples
+static int64_t bench_percentile(const int64_t *sorted, int count, int percent)
+{
+  int rank = (percent * count + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void bench_init(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--json")) bench_options.json = true;
+    else if (!strcmp(argv[i], "--reps") && i + 1 < argc) bench_options.reps = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) bench_options.warmup = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--filter") && i + 1 < argc) bench_options.filter = argv[++i];
+  }
+
+  if (bench_options.reps < 1) bench_options.reps = 1;
+  if (bench_options.reps > BENCH_MAX_REPS) bench_options.reps = BENCH_MAX_REPS;
+
+  if (!bench_options.json)
+    printf("%-24s %12s %12s %12s %14s\n", "benchmark", "min", "median", "p95", "items/s");
+}
+
+static bool bench_selected(const char *name)
+{
+  return !bench_options.filter || strstr(name, bench_options.filter);
+}
+
+// `setup` runs untimed before each call, pass NULL when there is nothing to reset
+static void bench_run_setup(const char *name, size_t items, void (*setup)(void *ctx), void (*fn)(void *ctx), void *ctx)
+{
+  if (!bench_selected(name)) return;
+
+  for (int i = 0; i < bench_options.warmup; ++i) {
+    if (setup) setup(ctx);
+    fn(ctx);
+  }
+
+  int reps = bench_options.reps;
+  int64_t ns[BENCH_MAX_REPS], ticks[BENCH_MAX_REPS];
+
+  for (int i = 0; i < reps; ++i) {
+    if (setup) setup(ctx);
+
+    int64_t t0 = bench_ticks(), start = bench_now_ns();
+    fn(ctx);
+    ns[i] = bench_now_ns() - start;
+    ticks[i] = bench_ticks() - t0;
+  }
+
+  double mean = 0;
+  for (int i = 0; i < reps; ++i) mean += ns[i];
+  mean /= reps;
+
+  qsort(ns, reps, sizeof(int64_t), bench_compare);
+  qsort(ticks, reps, sizeof(int64_t), bench_compare);
+
+  int64_t median = bench_percentile(ns, reps, 50);
+  double rate = median > 0 ? items * 1e9 / median : 0;
+  int64_t median_ticks = ticks[0] < 0 ? -1 : bench_percentile(ticks, reps, 50);
+
+  if (bench_options.json) {
+    printf("{\"name\":\"%s\",\"items\":%zu,\"reps\":%d,\"min_ns\":%lld,\"median_ns\":%lld,"
+           "\"p95_ns\":%lld,\"mean_ns\":%.0f,\"median_ticks\":%lld,\"items_per_s\":%.1f}\n",
+      name, items, reps, (long long)ns[0], (long long)median,
+      (long long)bench_percentile(ns, reps, 95), mean, (long long)median_ticks, rate);
+  } else {
+    printf("%-24s %9.3f ms %9.3f ms %9.3f ms %14.0f\n",
+      name, ns[0] / 1e6, median / 1e6, bench_percentile(ns, reps, 95) / 1e6, rate);
+  }
+
+  fflush(stdout);
+  bench_options.ran++;
+}
+
+static void bench_run(const char *name, size_t items, void (*fn)(void *ctx), void *ctx)
+{
+  bench_run_setup(name, items, NULL, fn, ctx);
+}
+
+static int bench_finish(void)
+{
+  if (!bench_options.ran) {
+    fprintf(stderr, "no benchmark matched `%s`\n", bench_options.filter ? bench_options.filter : "");
+    return 1;
+  }
+  return 0;
+}
+
+#endif // BENCH_H_
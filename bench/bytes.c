@@ -0,0 +1,127 @@
+#define BUILD_IMPLEMENTATION
+#include "../build.h"
+#include "bench.h"
+
+static bh_arena_t arena = { 0 };
+
+#define BUFFER_SIZE (32 * 1024 * 1024)
+
+typedef struct {
+  char *source;
+  char *work;
+  char *tmp;
+  volatile size_t sink;
+} bytes_t;
+
+// depfile shaped text: paths separated by spaces and ` \` continuations
+static void fill_depfile(char *buffer, size_t size)
+{
+  size_t pos = 0, n = 0;
+  while (pos < size) {
+    char item[64];
+    int len = snprintf(item, sizeof(item), "include/module_%zu/header_%zu.h %s", n % 97, n, (n % 4 == 3) ? "\\\r\n " : "");
+    for (int i = 0; i < len && pos < size; i++)
+      buffer[pos++] = item[i];
+    n++;
+  }
+}
+
+// the old bh_string_replace_char loop, kept as a baseline
+static size_t baseline_delete(char *dst, const char *src, size_t size, char from)
+{
+  size_t index = 0;
+  memset(dst, 0, size + 1);
+  for (size_t i = 0; i < size; ++i) {
+    if (src[i] != from) dst[index++] = src[i];
+  }
+  return index;
+}
+
+// how the depfile reader used to strip `\r`, `\n` and `\\`
+static void run_baseline_delete(void *ctx)
+{
+  bytes_t *b = (bytes_t *)ctx;
+  size_t size = baseline_delete(b->tmp, b->source, BUFFER_SIZE, '\r');
+  size = baseline_delete(b->work, b->tmp, size, '\n');
+  b->sink += baseline_delete(b->tmp, b->work, size, '\\');
+}
+
+static void copy_source(void *ctx)
+{
+  bytes_t *b = (bytes_t *)ctx;
+  memcpy(b->work, b->source, BUFFER_SIZE);
+}
+
+// single bytes go to memchr at every level, so find and split run once
+static void run_find(void *ctx)
+{
+  bytes_t *b = (bytes_t *)ctx;
+  b->sink += bh_bytes_find(b->source, BUFFER_SIZE, '#');
+}
+
+static void run_find_any(void *ctx)
+{
+  bytes_t *b = (bytes_t *)ctx;
+  b->sink += bh_bytes_find_any(b->source, BUFFER_SIZE, "#@!");
+}
+
+static void run_delete(void *ctx)
+{
+  bytes_t *b = (bytes_t *)ctx;
+  b->sink += bh_bytes_delete(b->work, BUFFER_SIZE, "\r\n\\");
+}
+
+static void run_replace(void *ctx)
+{
+  bytes_t *b = (bytes_t *)ctx;
+  b->sink += bh_bytes_replace(b->work, BUFFER_SIZE, "\r\n\\", ' ');
+}
+
+static void run_split(void *ctx)
+{
+  bytes_t *b = (bytes_t *)ctx;
+  bh_svs_t items = { 0 };
+  bh_sv_split(bh_sv_from_parts(b->source, BUFFER_SIZE), ' ', &items);
+  b->sink += items.count;
+  bh_darray_free(&items);
+}
+
+int main(int argc, char *argv[])
+{
+  bh_init(argc, argv);
+
+  bh_init_arena(&arena, 1024 * 1024);
+  build_arena = &arena;
+
+  bench_init(argc, argv);
+
+  bytes_t b = {
+    .source = (char *)malloc(BUFFER_SIZE + 1),
+    .work = (char *)malloc(BUFFER_SIZE + 1),
+    .tmp = (char *)malloc(BUFFER_SIZE + 1),
+  };
+  fill_depfile(b.source, BUFFER_SIZE);
+  b.source[BUFFER_SIZE] = '\0';
+
+  bench_run("delete_baseline", BUFFER_SIZE, run_baseline_delete, &b);
+  bench_run("find_memchr", BUFFER_SIZE, run_find, &b);
+  bench_run("split", BUFFER_SIZE, run_split, &b);
+
+  // byte classes are where the levels differ
+  const char *names[] = { "", "scalar", "sse2", "avx2" };
+  bh_simd_t best = bh_simd_detect();
+
+  for (bh_simd_t level = BH_SIMD_SCALAR; level <= best; level++) {
+    bh_simd_use(level);
+    bench_run(bh_fmt("find_any_%s", names[level]), BUFFER_SIZE, run_find_any, &b);
+    bench_run_setup(bh_fmt("delete_%s", names[level]), BUFFER_SIZE, copy_source, run_delete, &b);
+    bench_run_setup(bh_fmt("replace_%s", names[level]), BUFFER_SIZE, copy_source, run_replace, &b);
+  }
+
+  free(b.source);
+  free(b.work);
+  free(b.tmp);
+  bh_arena_free(&arena);
+
+  return bench_finish();
+}
@@ -0,0 +1,335 @@
+#define BUILD_IMPLEMENTATION
+#include "../build.h"
+#include "bench.h"
+
+static bh_arena_t arena = { 0 };
+
+// fixtures are generated once under this directory and reused between runs
+#define FIXTURE_DIR "bench_fixture"
+#define FIXTURE_DIRS 100
+
+static size_t tree_files = 100000;
+static size_t depfile_headers = 10000;
+static size_t spawn_jobs = 2000;
+static size_t batch_depfiles = 2000;
+static size_t scan_sources = 10000;
+#define SCAN_HEADERS 1000
+
+static void gen_tree(void)
+{
+  char *marker = bh_fmt(FIXTURE_DIR "/tree_%zu.done", tree_files);
+  if (bh_path_exist(marker) == is_file) return;
+
+  fprintf(stderr, "generating %zu files under " FIXTURE_DIR "/tree...\n", tree_files);
+  bench_check(bh_execute("rm -rf " FIXTURE_DIR "/tree " FIXTURE_DIR "/tree_*.done"));
+
+  // 100 directories with 10 subdirectories each, files spread evenly
+  for (size_t i = 0; i < tree_files; ++i) {
+    char path[256];
+    size_t dir = i % FIXTURE_DIRS, sub = (i / FIXTURE_DIRS) % 10;
+    if (i < FIXTURE_DIRS * 10) {
+      snprintf(path, sizeof(path), FIXTURE_DIR "/tree/dir_%03zu/sub_%zu", dir, sub);
+      bench_check(bh_mkdir(path));
+    }
+
+    snprintf(path, sizeof(path), FIXTURE_DIR "/tree/dir_%03zu/sub_%zu/file_%zu.c", dir, sub, i);
+    FILE *fp = fopen(path, "wb");
+    bench_check(fp);
+    fclose(fp);
+  }
+
+  bench_check(bh_file_write(marker, "", 0));
+  bh_arena_reset(build_arena);
+}
+
+static void gen_depfile(void)
+{
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bh_sb_append(&sb, "out/main.o: src/main.c");
+
+  for (size_t i = 0; i < depfile_headers; ++i)
+    bh_sb_appendf(&sb, " \\\n include/module_%zu/header_%zu.h", i % 97, i);
+  bh_sb_append_char(&sb, '\n');
+
+  bench_check(bh_mkdir(FIXTURE_DIR));
+  bench_check(bh_file_write(FIXTURE_DIR "/headers.d", sb.data, sb.len));
+  bh_arena_reset(build_arena);
+}
+
+static void gen_depfiles(void)
+{
+  char *marker = bh_fmt(FIXTURE_DIR "/deps_%zu.done", batch_depfiles);
+  if (bh_path_exist(marker) == is_file) return;
+
+  bench_check(bh_mkdir(FIXTURE_DIR "/deps"));
+  for (size_t i = 0; i < batch_depfiles; ++i) {
+    bh_sb_t sb;
+    bh_sb_init(&sb, build_arena);
+    bh_sb_appendf(&sb, "out/file_%zu.o: src/file_%zu.c", i, i);
+    for (size_t h = 0; h < 50; ++h)
+      bh_sb_appendf(&sb, " \\\n include/module_%zu/header_%zu.h", (i + h) % 97, h);
+    bh_sb_append_char(&sb, '\n');
+    bench_check(bh_file_write(bh_fmt(FIXTURE_DIR "/deps/file_%zu.d", i), sb.data, sb.len));
+  }
+
+  bench_check(bh_file_write(marker, "", 0));
+  bh_arena_reset(build_arena);
+}
+
+// headers include two with smaller numbers (about 30 headers deep in
+// total), sources include 20 headers each
+static void gen_scan(void)
+{
+  char *marker = bh_fmt(FIXTURE_DIR "/scan_%zu.done", scan_sources);
+  if (bh_path_exist(marker) == is_file) return;
+
+  bench_check(bh_execute("rm -rf " FIXTURE_DIR "/scan " FIXTURE_DIR "/scan_*.done"));
+  bench_check(bh_mkdir(FIXTURE_DIR "/scan/include/lib"));
+  bench_check(bh_mkdir(FIXTURE_DIR "/scan/src"));
+
+  for (size_t i = 0; i < SCAN_HEADERS; ++i) {
+    char *text = bh_fmt("#pragma once\n#include \"lib/h_%zu.h\"\n#include <lib/h_%zu.h>\n#include <stdint.h>\n"
+      "int h_%zu(void);\n", i / 2, i / 3, i);
+    bench_check(bh_file_write(bh_fmt(FIXTURE_DIR "/scan/include/lib/h_%zu.h", i), text, strlen(text)));
+  }
+
+  for (size_t i = 0; i < scan_sources; ++i) {
+    bh_sb_t sb;
+    bh_sb_init(&sb, build_arena);
+    bh_sb_append(&sb, "#include <stdio.h>\n");
+    for (size_t h = 0; h < 20; ++h)
+      bh_sb_appendf(&sb, "#include \"lib/h_%zu.h\"\n", (i * 31 + h * 17) % SCAN_HEADERS);
+    bh_sb_appendf(&sb, "int f_%zu(void) { return 0; }\n", i);
+    bench_check(bh_file_write(bh_fmt(FIXTURE_DIR "/scan/src/file_%zu.c", i), sb.data, sb.len));
+    bh_arena_reset(build_arena);
+  }
+
+  bench_check(bh_file_write(bh_fmt(FIXTURE_DIR "/scan_%zu.done", scan_sources), "", 0));
+  bh_arena_reset(build_arena);
+}
+
+static void reset_arena(void *ctx)
+{
+  (void)ctx;
+  bh_arena_reset(build_arena);
+}
+
+bh_define_darray(int) bench_ints_t;
+
+static void run_darray_push(void *ctx)
+{
+  (void)ctx;
+  bench_ints_t ints = { 0 };
+  for (int i = 0; i < 1000000; ++i)
+    bh_darray_push(&ints, i);
+  bench_check(bh_darray_len(&ints) == 1000000);
+  bh_darray_free(&ints);
+}
+
+static void run_fmt(void *ctx)
+{
+  (void)ctx;
+  for (int i = 0; i < 100000; ++i)
+    bh_fmt("cc -c src/module_%d/file_%d.c -o build/file_%d.o %s", i % 97, i, i, "-O2 -Wall");
+}
+
+static void run_recursive_files_get(void *ctx)
+{
+  (void)ctx;
+  bh_files_t files = { 0 };
+  bench_check(bh_recursive_files_get(FIXTURE_DIR "/tree", &files));
+  bench_check(bh_darray_len(&files) >= tree_files);
+  bh_darray_free(&files);
+}
+
+static void run_depfile_read(void *ctx)
+{
+  (void)ctx;
+  bh_files_t deps = { 0 };
+  bench_check(bh_depfile_read(FIXTURE_DIR "/headers.d", &deps));
+  bench_check(bh_darray_len(&deps) == depfile_headers + 1);
+  bh_darray_free(&deps);
+}
+
+static void run_intern(void *ctx)
+{
+  bh_files_t *deps = (bh_files_t *)ctx;
+  bh_intern_t table = { 0 };
+  for (int round = 0; round < 10; ++round) {
+    for (size_t i = 0; i < bh_darray_len(deps); ++i)
+      bh_intern(&table, deps->items[i]);
+  }
+  bh_intern_free(&table);
+}
+
+static void run_spawn(void *ctx)
+{
+  (void)ctx;
+  bh_async_t jobs = { 0 };
+
+  for (size_t i = 0; i < spawn_jobs; ++i) {
+    bench_check(bh_push_async(&jobs, "true"));
+    // bh_await logs named commands, which would drown the report
+    jobs.items[bh_darray_len(&jobs) - 1].command = NULL;
+
+    if (bh_darray_len(&jobs) == 32 || i + 1 == spawn_jobs) {
+      bh_await(&jobs);
+      bh_darray_reset(&jobs);
+    }
+  }
+
+  bh_darray_free(&jobs);
+}
+
+typedef struct {
+  const char **paths;
+  size_t count;
+  bool uring;
+} batch_t;
+
+static void run_stat_many(void *ctx)
+{
+  batch_t *batch = (batch_t *)ctx;
+  int64_t *mtimes = (int64_t *)malloc(batch->count * sizeof(int64_t));
+  bh_io_uring_use(batch->uring);
+  bh_stat_many(batch->paths, batch->count, mtimes);
+  bench_check(batch->count && mtimes[0] >= 0);
+  free(mtimes);
+}
+
+static void run_read_many(void *ctx)
+{
+  batch_t *batch = (batch_t *)ctx;
+  char **data = (char **)malloc(batch->count * sizeof(char *));
+  size_t *lens = (size_t *)malloc(batch->count * sizeof(size_t));
+  bh_io_uring_use(batch->uring);
+  bh_read_many(batch->paths, batch->count, data, lens);
+  for (size_t i = 0; i < batch->count; ++i) {
+    bench_check(data[i]);
+    free(data[i]);
+  }
+  free(data);
+  free(lens);
+}
+
+static void reset_scanner(void *ctx)
+{
+  (void)ctx;
+  bh_c_scan_reset();
+  bh_arena_reset(build_arena);
+}
+
+// a cold run: every header is lexed once, then reused by the other sources
+static void run_include_scan(void *ctx)
+{
+  (void)ctx;
+  bh_files_t deps = { 0 };
+  for (size_t i = 0; i < scan_sources; ++i) {
+    bh_darray_reset(&deps);
+    bench_check(bh_c_scan_includes(&deps, bh_fmt(FIXTURE_DIR "/scan/src/file_%zu.c", i), "-I" FIXTURE_DIR "/scan/include -O2"));
+    bh_arena_reset(build_arena);
+  }
+  bh_darray_free(&deps);
+}
+
+// planning work: an object path per source, named after the source's hash
+static char *object_of(char *path)
+{
+  return bh_fmt("build/%016llx.o", (unsigned long long)bh_hash(path, strlen(path)));
+}
+
+static void object_of_par(void *ctx, const void *in, void *out)
+{
+  (void)ctx;
+  *(char **)out = object_of(*(char *const *)in);
+}
+
+static void reset_arenas(void *ctx)
+{
+  (void)ctx;
+  bh_arena_reset(build_arena);
+  bh_parallel_reset();
+}
+
+static void run_map(void *ctx)
+{
+  bh_files_t objects = { 0 };
+  bh_map((bh_files_t *)ctx, &objects, object_of);
+  bh_darray_free(&objects);
+}
+
+static void run_par_map(void *ctx)
+{
+  bh_files_t objects = { 0 };
+  bh_par_map((bh_files_t *)ctx, &objects, object_of_par, NULL);
+  bh_darray_free(&objects);
+}
+
+static void run_execute(void *ctx)
+{
+  (void)ctx;
+  for (int i = 0; i < 100; ++i)
+    bench_check(bh_execute("true"));
+}
+
+int main(int argc, char *argv[])
+{
+  bh_init(argc, argv);
+
+  bh_init_arena(&arena, 64 * 1024 * 1024);
+  build_arena = &arena;
+
+  // --small shrinks the fixtures for a quick smoke run
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--small")) {
+      tree_files = 5000;
+      depfile_headers = 1000;
+      spawn_jobs = 200;
+      batch_depfiles = 200;
+      scan_sources = 1000;
+    }
+  }
+
+  bench_init(argc, argv);
+
+  gen_tree();
+  gen_depfile();
+  gen_depfiles();
+  gen_scan();
+
+  bench_run_setup("darray_push", 1000000, NULL, run_darray_push, NULL);
+  bench_run_setup("fmt", 100000, reset_arena, run_fmt, NULL);
+  bench_run_setup("recursive_files_get", tree_files, reset_arena, run_recursive_files_get, NULL);
+  bench_run_setup("depfile_read", depfile_headers, reset_arena, run_depfile_read, NULL);
+
+  bh_files_t deps = { 0 };
+  bench_check(bh_depfile_read(FIXTURE_DIR "/headers.d", &deps));
+  bench_run("intern", 10 * bh_darray_len(&deps), run_intern, &deps);
+  bh_darray_free(&deps);
+
+  // the staleness pass and depfile loading, one call at a time vs io_uring
+  bh_files_t tree = { 0 }, depfiles = { 0 };
+  bench_check(bh_recursive_files_get(FIXTURE_DIR "/tree", &tree));
+  bench_check(bh_files_get(FIXTURE_DIR "/deps", &depfiles));
+  batch_t stats = { (const char **)tree.items, bh_darray_len(&tree), false };
+  batch_t reads = { (const char **)depfiles.items, bh_darray_len(&depfiles), false };
+  bench_run("stat_many_sync", stats.count, run_stat_many, &stats);
+  bench_run("read_many_sync", reads.count, run_read_many, &reads);
+  stats.uring = reads.uring = true;
+  if (bh_io_uring_use(true)) {
+    bench_run("stat_many_uring", stats.count, run_stat_many, &stats);
+    bench_run("read_many_uring", reads.count, run_read_many, &reads);
+  }
+  bench_run_setup("map_sequential", tree.count, reset_arenas, run_map, &tree);
+  bench_run_setup("map_parallel", tree.count, reset_arenas, run_par_map, &tree);
+  bh_darray_free(&tree);
+  bh_darray_free(&depfiles);
+
+  bench_run_setup("include_scan", scan_sources, reset_scanner, run_include_scan, NULL);
+  bench_run("spawn_async", spawn_jobs, run_spawn, NULL);
+  bench_run("execute", 100, run_execute, NULL);
+
+  bh_arena_free(&arena);
+  return bench_finish();
+}
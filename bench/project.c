@@ -0,0 +1,339 @@
+#define BUILD_IMPLEMENTATION
+#include "../build.h"
+#include "bench.h"
+
+// generates a synthetic C project shaped like a monorepo, with a build.c
+// driver, a Makefile and a build.ninja for the same graph. with --bench it
+// times cold, no-op and one-file-touched builds of each.
+//
+//   ./project --out gen --sources 5000 --headers 800 --fanin 12 --depth 4
+//   ./project --out gen --bench --json
+
+static bh_arena_t arena = { 0 };
+
+typedef struct {
+  const char *out;
+  const char *build_h;  // absolute path the generated build.c includes
+  size_t sources;
+  size_t headers;
+  size_t fanin;         // includes per source
+  int skew;             // >1 makes low numbered headers popular
+  size_t depth;         // directory levels under src/
+  uint64_t seed;
+  int jobs;             // -j for make and ninja, 1 matches the serial graph
+  bool bench;
+} project_t;
+
+static uint64_t rng_next(uint64_t *state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+// header index with a power law skew, so a few headers are everywhere
+static size_t pick_header(project_t *p, uint64_t *state)
+{
+  double u = (rng_next(state) >> 11) * (1.0 / 9007199254740992.0), x = 1;
+  for (int i = 0; i < p->skew; ++i) x *= u;
+  size_t index = (size_t)(x * p->headers);
+  return index < p->headers ? index : p->headers - 1;
+}
+
+// src/m3/m1/file_42.c, 8 directories per level
+static char *source_dir(project_t *p, size_t i)
+{
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bh_sb_appendf(&sb, "%s/src", p->out);
+
+  size_t n = i;
+  for (size_t level = 0; level < p->depth; ++level, n /= 8)
+    bh_sb_appendf(&sb, "/m%zu", n % 8);
+
+  return bh_sb_finish(&sb);
+}
+
+static bool write_file(const char *path, bh_sb_t *sb)
+{
+  if (!bh_file_write(path, sb->data, sb->len)) return false;
+  bh_arena_reset(build_arena);
+  return true;
+}
+
+static bool gen_headers(project_t *p)
+{
+  if (!bh_mkdir(bh_fmt("%s/include", p->out))) return false;
+  bh_arena_reset(build_arena);
+
+  // header i includes its parent (i - 1) / 2, giving include chains of log2(M)
+  for (size_t i = 0; i < p->headers; ++i) {
+    bh_sb_t sb;
+    bh_sb_init(&sb, build_arena);
+    char *path = bh_fmt("%s/include/h_%zu.h", p->out, i);
+
+    bh_sb_appendf(&sb, "#ifndef H_%zu_H\n#define H_%zu_H\n", i, i);
+    if (i) bh_sb_appendf(&sb, "#include \"h_%zu.h\"\n", (i - 1) / 2);
+    bh_sb_appendf(&sb, "static inline int h_%zu(int x) { return x * %zu + 1; }\n#endif\n", i, i + 3);
+
+    if (!write_file(path, &sb)) return false;
+  }
+
+  return true;
+}
+
+static bool gen_sources(project_t *p)
+{
+  uint64_t state = p->seed ? p->seed : 1;
+
+  for (size_t i = 0; i < p->sources; ++i) {
+    char *dir = source_dir(p, i);
+    if (!bh_mkdir(dir)) return false;
+
+    bh_sb_t sb;
+    bh_sb_init(&sb, build_arena);
+    char *path = bh_fmt("%s/file_%zu.c", dir, i);
+
+    size_t first = p->headers;
+    for (size_t k = 0; k < p->fanin && p->headers; ++k) {
+      size_t h = pick_header(p, &state);
+      if (h < first) first = h;
+      bh_sb_appendf(&sb, "#include \"h_%zu.h\"\n", h);
+    }
+
+    bh_sb_appendf(&sb, "\nint s_%zu(int x)\n{\n  int y = x;\n", i);
+    for (int k = 0; k < 8; ++k)
+      bh_sb_appendf(&sb, "  y = y * %d + (x >> %d);\n", k + 3, k);
+    if (first < p->headers) bh_sb_appendf(&sb, "  y += h_%zu(y);\n", first);
+    bh_sb_append(&sb, "  return y;\n}\n");
+
+    if (!write_file(path, &sb)) return false;
+  }
+
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bh_sb_append(&sb, "int main(void) { return 0; }\n");
+  return write_file(bh_fmt("%s/src/main.c", p->out), &sb);
+}
+
+// the same object name scheme the generated build.c uses. writes into a
+// static buffer, the callers are appending to a builder at the arena tail
+static const char *object_of(const char *source)
+{
+  static char object[PATH_MAX];
+  snprintf(object, sizeof(object), "out/%.*s.o", (int)(strlen(source) - strlen("src/.c")), source + strlen("src/"));
+  for (char *c = object + strlen("out/"); *c; ++c)
+    if (*c == '/') *c = '_';
+  return object;
+}
+
+static bool gen_driver(project_t *p)
+{
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+
+  bh_sb_appendf(&sb, "#define BUILD_IMPLEMENTATION\n#include \"%s\"\n\n", p->build_h);
+  bh_sb_append(&sb,
+    "static bh_arena_t arena = { 0 };\n"
+    "\n"
+    "static void plan(bh_graph_t *graph)\n"
+    "{\n"
+    "  bh_graph_reset(graph);\n"
+    "  bh_arena_reset(build_arena);\n"
+    "\n"
+    "  bh_files_t sources = { 0 }, inputs = { 0 }, objects = { 0 };\n"
+    "  bh_recursive_files_get(\"src\", &sources);\n"
+    "\n"
+    "  for (size_t i = 0; i < bh_darray_len(&sources); ++i) {\n"
+    "    char *source = sources.items[i];\n"
+    "    if (!bh_sv_ends_with(bh_sv_from_cstr(source), bh_sv_from_cstr(\".c\"))) continue;\n"
+    "\n"
+    "    char *object = bh_fmt(\"out/%.*s.o\", (int)(strlen(source) - strlen(\"src/.c\")), source + strlen(\"src/\"));\n"
+    "    for (char *c = object + strlen(\"out/\"); *c; ++c)\n"
+    "      if (*c == '/') *c = '_';\n"
+    "\n"
+    "    bh_darray_reset(&inputs);\n"
+    "    bh_darray_push(&inputs, source);\n"
+    "    size_t target = bh_graph_add(graph, object, &inputs,\n"
+    "      bh_fmt(\"cc -Iinclude -c %s -o %s -MMD -MF %s.d\", source, object, object));\n"
+    "    bh_graph_set_depfile(graph, target, bh_fmt(\"%s.d\", object));\n"
+    "    bh_darray_push(&objects, object);\n"
+    "  }\n"
+    "\n"
+    "  bh_graph_add(graph, \"out/app\", &objects,\n"
+    "    bh_fmt(\"cc -o out/app %s\", bh_files_to_string(&objects, ' ')));\n"
+    "\n"
+    "  bh_darray_free(&sources);\n"
+    "  bh_darray_free(&inputs);\n"
+    "  bh_darray_free(&objects);\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char *argv[])\n"
+    "{\n"
+    "  bh_init(argc, argv);\n"
+    "\n"
+    "  bh_init_arena(&arena, 256 * 1024 * 1024);\n"
+    "  build_arena = &arena;\n"
+    "  bh_mkdir(\"out\");\n"
+    "\n"
+    "  bh_files_t dirs = { 0 };\n"
+    "  bh_darray_push(&dirs, \"src\");\n"
+    "  bh_darray_push(&dirs, \"include\");\n"
+    "  return bh_graph_main(argc, argv, &dirs, plan);\n"
+    "}\n");
+
+  return write_file(bh_fmt("%s/build.c", p->out), &sb);
+}
+
+// Makefile and build.ninja with one explicit rule per object, like the graph
+static bool gen_make_ninja(project_t *p)
+{
+  bh_files_t sources = { 0 };
+  char *src = bh_fmt("%s/src", p->out);
+  if (!bh_recursive_files_get(src, &sources)) return false;
+
+  bh_sb_t make, ninja;
+  bh_sb_init(&make, build_arena);
+  bh_sb_append(&make, "out/app:");
+
+  // sources are `<out>/src/...`, the files refer to them relative to <out>
+  size_t skip = strlen(p->out) + 1;
+  for (size_t i = 0; i < bh_darray_len(&sources); ++i)
+    bh_sb_appendf(&make, " %s", object_of(sources.items[i] + skip));
+  bh_sb_append(&make, "\n\tcc -o $@ $^\n\n");
+
+  for (size_t i = 0; i < bh_darray_len(&sources); ++i) {
+    const char *source = sources.items[i] + skip;
+    bh_sb_appendf(&make, "%s: %s\n\t@mkdir -p out\n\tcc -Iinclude -c $< -o $@ -MMD -MF $@.d\n\n", object_of(source), source);
+  }
+  bh_sb_append(&make, "-include $(wildcard out/*.d)\n");
+
+  char *makefile = make.data;
+  size_t makefile_len = make.len;
+
+  bh_sb_init(&ninja, build_arena);
+  bh_sb_append(&ninja,
+    "rule cc\n  command = cc -Iinclude -c $in -o $out -MMD -MF $out.d\n  depfile = $out.d\n  deps = gcc\n\n"
+    "rule link\n  command = cc -o $out $in\n\n");
+
+  for (size_t i = 0; i < bh_darray_len(&sources); ++i) {
+    const char *source = sources.items[i] + skip;
+    bh_sb_appendf(&ninja, "build %s: cc %s\n", object_of(source), source);
+  }
+
+  bh_sb_append(&ninja, "\nbuild out/app: link");
+  for (size_t i = 0; i < bh_darray_len(&sources); ++i)
+    bh_sb_appendf(&ninja, " %s", object_of(sources.items[i] + skip));
+  bh_sb_append_char(&ninja, '\n');
+
+  bool ok = bh_file_write(bh_fmt("%s/Makefile", p->out), makefile, makefile_len) &&
+            bh_file_write(bh_fmt("%s/build.ninja", p->out), ninja.data, ninja.len);
+
+  bh_darray_free(&sources);
+  bh_arena_reset(build_arena);
+  return ok;
+}
+
+// the commands are formatted once per tool, so the callbacks don't reset the arena
+static project_t *bench_project;
+static const char *bench_command;
+
+static void run_build(void *ctx)
+{
+  (void)ctx;
+  bench_check(bh_execute(bh_fmt("cd %s && %s >/dev/null", bench_project->out, bench_command)));
+}
+
+static void clean_outputs(void *ctx)
+{
+  (void)ctx;
+  bench_check(bh_execute(bh_fmt("cd %s && rm -rf out .build_cache .ninja_log .ninja_deps", bench_project->out)));
+}
+
+static void touch_source(void *ctx)
+{
+  (void)ctx;
+  // mtimes must move past the outputs on coarse filesystems
+  usleep(10 * 1000);
+  bench_check(bh_execute(bh_fmt("touch %s/file_%zu.c", source_dir(bench_project, 0), (size_t)0)));
+}
+
+static void bench_tool(project_t *p, const char *tool, const char *command)
+{
+  bench_project = p;
+  bench_command = command;
+
+  // every cold build leaves the tree built for the no-op and touched runs
+  bench_run_setup(bh_fmt("%s_cold", tool), p->sources, clean_outputs, run_build, NULL);
+  bench_run(bh_fmt("%s_noop", tool), p->sources, run_build, NULL);
+  bench_run_setup(bh_fmt("%s_touch_one", tool), 1, touch_source, run_build, NULL);
+}
+
+static void bench_project_builds(project_t *p)
+{
+  bench_check(bh_execute(bh_fmt("cd %s && cc -O2 build.c -o build", p->out)));
+
+  bench_tool(p, "build_h", "./build --no-daemon");
+  bench_tool(p, "make", bh_fmt("make -s -j%d", p->jobs));
+  if (bh_execute("command -v ninja >/dev/null"))
+    bench_tool(p, "ninja", bh_fmt("ninja -j%d", p->jobs));
+}
+
+int main(int argc, char *argv[])
+{
+  bh_init(argc, argv);
+
+  bh_init_arena(&arena, 64 * 1024 * 1024);
+  build_arena = &arena;
+
+  project_t p = {
+    .out = "bench_project",
+    .sources = 1000,
+    .headers = 200,
+    .fanin = 10,
+    .skew = 2,
+    .depth = 3,
+    .seed = 42,
+    .jobs = 1,
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--out") && has_value) p.out = argv[++i];
+    else if (!strcmp(argv[i], "--sources") && has_value) p.sources = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--headers") && has_value) p.headers = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--fanin") && has_value) p.fanin = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--skew") && has_value) p.skew = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--depth") && has_value) p.depth = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--seed") && has_value) p.seed = strtoull(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--jobs") && has_value) p.jobs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--bench")) p.bench = true;
+  }
+
+  char build_h[PATH_MAX];
+  if (!realpath("../build.h", build_h) && !realpath("build.h", build_h)) {
+    bh_log(3, "run from bench/ or the repository root, build.h not found.\n");
+    return 1;
+  }
+  p.build_h = build_h;
+
+  if (!bh_execute(bh_fmt("rm -rf %s/src %s/include", p.out, p.out))) return 1;
+  bh_arena_reset(build_arena);
+
+  if (!gen_headers(&p) || !gen_sources(&p) || !gen_driver(&p) || !gen_make_ninja(&p))
+    return 1;
+
+  fprintf(stderr, "generated %zu sources and %zu headers in `%s`.\n", p.sources, p.headers, p.out);
+  if (!p.bench) return 0;
+
+  // cold builds are slow, keep the default repetitions low
+  bench_options.reps = 3;
+  bench_options.warmup = 0;
+  bench_init(argc, argv);
+  bench_project_builds(&p);
+
+  bh_arena_free(&arena);
+  return bench_finish();
+}
@@ -2,7 +2,6 @@
 #define BUILD_EXECUTE_LOG
 #include "build.h"
 
-extern bh_arena_t *build_arena;
 static bh_arena_t arena = { 0 };
 
 int main(int argc, char *argv[])
@@ -6,7 +6,6 @@
 #define BUILD_EXECUTE_LOG
 #include "build.h"
 
-extern bh_arena_t *build_arena;
 static bh_arena_t arena = { 0 };
 
 int main(int argc, char *argv[])
@@ -49,6 +48,200 @@ int main(int argc, char *argv[])
 * SOFTWARE.
 **********************************************************************************************/
 
+#ifdef BUILD_TRACE_SHIM_BUILD
+// the LD_PRELOAD side of bh_execute_traced, built from this file with
+// `cc -shared -fPIC -DBUILD_TRACE_SHIM_BUILD -x c build.h`. every path a process
+// opens, stats or executes is appended to $BH_TRACE_FILE as "r <path>" or
+// "w <path>", absolute, one write per line so parallel children don't mix.
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int bh_shim_fd = -1;
+
+static void bh_shim_record(int dirfd, const char *path, int flags)
+{
+  if (!path || !path[0]) return;
+
+  if (bh_shim_fd < 0) {
+    const char *log = getenv("BH_TRACE_FILE");
+    if (!log) return;
+    bh_shim_fd = (int)syscall(SYS_openat, AT_FDCWD, log, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (bh_shim_fd < 0) return;
+  }
+
+  char line[2 * PATH_MAX + 4];
+  size_t len = 2;
+  line[0] = flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC) ? 'w' : 'r';
+  line[1] = ' ';
+
+  if (path[0] != '/') {
+    char dir[PATH_MAX];
+    ssize_t n;
+    if (dirfd == AT_FDCWD) {
+      n = getcwd(dir, sizeof(dir)) ? (ssize_t)strlen(dir) : -1;
+    } else {
+      char link[64];
+      snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+      n = readlink(link, dir, sizeof(dir) - 1);
+    }
+    if (n <= 0) return;
+    memcpy(line + len, dir, n);
+    len += n;
+    line[len++] = '/';
+  }
+
+  size_t path_len = strlen(path);
+  if (len + path_len + 1 > sizeof(line)) return;
+  memcpy(line + len, path, path_len);
+  len += path_len;
+  line[len++] = '\n';
+  syscall(SYS_write, bh_shim_fd, line, len);
+}
+
+#define BH_SHIM_REAL(ret, name, ...) \
+  static ret (*real)(__VA_ARGS__); \
+  if (!real) real = (ret (*)(__VA_ARGS__))dlsym(RTLD_NEXT, name)
+
+#define BH_SHIM_MODE(flags) \
+  mode_t mode = 0; \
+  if ((flags) & (O_CREAT | O_TMPFILE)) { \
+    va_list ap; \
+    va_start(ap, flags); \
+    mode = va_arg(ap, mode_t); \
+    va_end(ap); \
+  }
+
+int open(const char *path, int flags, ...)
+{
+  BH_SHIM_MODE(flags);
+  BH_SHIM_REAL(int, "open", const char *, int, mode_t);
+  bh_shim_record(AT_FDCWD, path, flags);
+  return real(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+  BH_SHIM_MODE(flags);
+  BH_SHIM_REAL(int, "open64", const char *, int, mode_t);
+  bh_shim_record(AT_FDCWD, path, flags);
+  return real(path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+  BH_SHIM_MODE(flags);
+  BH_SHIM_REAL(int, "openat", int, const char *, int, mode_t);
+  bh_shim_record(dirfd, path, flags);
+  return real(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+{
+  BH_SHIM_MODE(flags);
+  BH_SHIM_REAL(int, "openat64", int, const char *, int, mode_t);
+  bh_shim_record(dirfd, path, flags);
+  return real(dirfd, path, flags, mode);
+}
+
+int creat(const char *path, mode_t mode)
+{
+  BH_SHIM_REAL(int, "creat", const char *, mode_t);
+  bh_shim_record(AT_FDCWD, path, O_CREAT);
+  return real(path, mode);
+}
+
+FILE *fopen(const char *path, const char *mode)
+{
+  BH_SHIM_REAL(FILE *, "fopen", const char *, const char *);
+  bh_shim_record(AT_FDCWD, path, strpbrk(mode, "wa+") ? O_WRONLY : 0);
+  return real(path, mode);
+}
+
+FILE *fopen64(const char *path, const char *mode)
+{
+  BH_SHIM_REAL(FILE *, "fopen64", const char *, const char *);
+  bh_shim_record(AT_FDCWD, path, strpbrk(mode, "wa+") ? O_WRONLY : 0);
+  return real(path, mode);
+}
+
+int stat(const char *path, struct stat *st)
+{
+  BH_SHIM_REAL(int, "stat", const char *, struct stat *);
+  bh_shim_record(AT_FDCWD, path, 0);
+  return real(path, st);
+}
+
+int lstat(const char *path, struct stat *st)
+{
+  BH_SHIM_REAL(int, "lstat", const char *, struct stat *);
+  bh_shim_record(AT_FDCWD, path, 0);
+  return real(path, st);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st, int flags)
+{
+  BH_SHIM_REAL(int, "fstatat", int, const char *, struct stat *, int);
+  bh_shim_record(dirfd, path, 0);
+  return real(dirfd, path, st, flags);
+}
+
+int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *st)
+{
+  BH_SHIM_REAL(int, "statx", int, const char *, int, unsigned int, struct statx *);
+  bh_shim_record(dirfd, path, 0);
+  return real(dirfd, path, flags, mask, st);
+}
+
+// glibc before 2.33 only exports these
+int __xstat(int version, const char *path, struct stat *st)
+{
+  BH_SHIM_REAL(int, "__xstat", int, const char *, struct stat *);
+  bh_shim_record(AT_FDCWD, path, 0);
+  return real(version, path, st);
+}
+
+int __lxstat(int version, const char *path, struct stat *st)
+{
+  BH_SHIM_REAL(int, "__lxstat", int, const char *, struct stat *);
+  bh_shim_record(AT_FDCWD, path, 0);
+  return real(version, path, st);
+}
+
+int access(const char *path, int mode)
+{
+  BH_SHIM_REAL(int, "access", const char *, int);
+  bh_shim_record(AT_FDCWD, path, 0);
+  return real(path, mode);
+}
+
+int faccessat(int dirfd, const char *path, int mode, int flags)
+{
+  BH_SHIM_REAL(int, "faccessat", int, const char *, int, int);
+  bh_shim_record(dirfd, path, 0);
+  return real(dirfd, path, mode, flags);
+}
+
+int execve(const char *path, char *const argv[], char *const envp[])
+{
+  BH_SHIM_REAL(int, "execve", const char *, char *const *, char *const *);
+  bh_shim_record(AT_FDCWD, path, 0);
+  return real(path, argv, envp);
+}
+
+// the library itself isn't part of the shim
+#define __build_h__
+#endif // BUILD_TRACE_SHIM_BUILD
+
 #ifndef __build_h__
 #define __build_h__
 
@@ -65,6 +258,7 @@ int main(int argc, char *argv[])
 #include <dirent.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <synchapi.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -76,10 +270,51 @@ int main(int argc, char *argv[])
 
 #if __UNIX__
 #include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #elif __WIN32__
 #include <windows.h>
 #endif
 
+#if __linux__
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/uio.h>
+
+#ifndef BUILD_IO_URING
+// 0 leaves the io_uring backend out, the batch calls then stat and read one by one
+#define BUILD_IO_URING 1
+#endif
+
+#if BUILD_IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BH_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define BH_X86_SIMD 0
+#endif
+
 // typedef dynamic array with generic type
 #define bh_define_darray(type)  \
   typedef struct {    \
@@ -131,6 +366,14 @@ int main(int argc, char *argv[])
 // reset dynamic array
 #define bh_darray_reset(ptr) (ptr)->count = 0
 
+// make room for at least n items without pushing them
+#define bh_darray_reserve(ptr, n) do {                                          \
+  if ((ptr)->size < (n)) {                                                      \
+    (ptr)->size = (n);                                                          \
+    (ptr)->items = realloc((ptr)->items, (ptr)->size * sizeof(*(ptr)->items));  \
+  }                                                                             \
+} while(0)
+
 // free allocated memory in dynamic array
 #define bh_darray_free(ptr) do {  \
   if ((ptr)->items) {            \
@@ -141,9 +384,11 @@ int main(int argc, char *argv[])
 #if __UNIX__
 #define bh_async(async_ptr, expr) ({                \
   bool result = true;                               \
+  bh_log_flush();                                   \
   pid_t pid = fork();                               \
   if (pid < 0) result = false;                      \
-  else if (pid == 0) { exit(expr); }                \
+  else if (pid == 0) { setpgid(0, 0); exit(expr); } \
+  if (pid > 0) setpgid(pid, pid);                   \
   bh_darray_push(async_ptr, ((bh_command_t) {       \
     .pid = pid,                                     \
     .command = NULL                                 \
@@ -190,6 +435,29 @@ int main(int argc, char *argv[])
   }                                                     \
 } while(0)
 
+// the same on the thread pool (bh_parallel_for). the callbacks get pointers,
+// so any item type works, plus `ctx`:
+//   foreach: void fn(void *ctx, void *item)
+//   map:     void fn(void *ctx, const void *in, void *out)
+//   filter:  bool fn(void *ctx, const void *item), keeps the items it's true for
+// results keep the input order. `out_dptr` must not be `in_dptr`.
+#define bh_par_foreach(ptr, fn, ctx) \
+  bh_parallel_foreach((ptr)->items, (ptr)->count, sizeof(*(ptr)->items), (fn), (ctx))
+
+#define bh_par_map(in_dptr, out_dptr, fn, ctx) do {                           \
+  bh_darray_reserve(out_dptr, (out_dptr)->count + (in_dptr)->count);          \
+  bh_parallel_map((in_dptr)->items, (in_dptr)->count, sizeof(*(in_dptr)->items), \
+    (out_dptr)->items + (out_dptr)->count, sizeof(*(out_dptr)->items), (fn), (ctx)); \
+  (out_dptr)->count += (in_dptr)->count;                                      \
+} while(0)
+
+#define bh_par_filter(in_dptr, out_dptr, fn, ctx) do {                        \
+  _Static_assert(sizeof(*(in_dptr)->items) == sizeof(*(out_dptr)->items), "bh_par_filter keeps the item type"); \
+  bh_darray_reserve(out_dptr, (out_dptr)->count + (in_dptr)->count);          \
+  (out_dptr)->count += bh_parallel_filter((in_dptr)->items, (in_dptr)->count, \
+    sizeof(*(in_dptr)->items), (out_dptr)->items + (out_dptr)->count, (fn), (ctx)); \
+} while(0)
+
 #define bh_throw(k) { bh_current_err_state = k; break; }
 #define bh_uthrow(ptr, k) if (!ptr) bh_throw(k)
 #define bh_try do { bh_current_err_state = bh_NoError;
@@ -202,6 +470,15 @@ typedef enum {
 
 static int bh_current_err_state = bh_NoError;
 
+typedef enum {
+  BH_JOB_RUNNING = 0,
+  BH_JOB_STOPPING,        // sent SIGTERM, SIGKILL follows after a grace period
+  BH_JOB_KILLED,
+  BH_JOB_DONE,
+} bh_job_state_t;
+
+// one async job. on unix it leads its own process group, so stopping it
+// also stops whatever the command spawned.
 typedef struct {
 #if __UNIX__
   pid_t pid;
@@ -209,6 +486,10 @@ typedef struct {
   HANDLE pid;
 #endif
   char *command;
+  int64_t started;        // ms, 0 counts from bh_await
+  int64_t stopping;       // ms when it was asked to stop
+  uint8_t state;          // bh_job_state_t
+  bool failed;
 } bh_command_t;
 
 bh_define_darray(bh_command_t) bh_async_t;
@@ -243,19 +524,264 @@ typedef struct {
   char *buffer;
 } bh_arena_t;
 
+// string builder appending in place at the end of an arena
+typedef struct {
+  bh_arena_t *arena;
+  char *data;
+  size_t len;
+  size_t cap;
+} bh_sb_t;
+
+typedef enum {
+  BH_SIMD_NONE = 0,   // pick the best one at runtime
+  BH_SIMD_SCALAR,
+  BH_SIMD_SSE2,
+  BH_SIMD_AVX2
+} bh_simd_t;
+
 typedef enum {
   is_file = 0,
   is_dir,
   is_none
 } bh_path_kind_t;
 
-static bh_arena_t *build_arena;
+// non-owning view into a string, not necessarily NUL terminated
+typedef struct {
+  const char *data;
+  size_t len;
+} bh_sv_t;
+
+bh_define_darray(bh_sv_t) bh_svs_t;
+
+#define BH_SV_FMT "%.*s"
+#define BH_SV_ARG(sv) (int)(sv).len, (sv).data
+
+// interned string handle, ids are dense (0..count-1) so side tables can be
+// plain arrays indexed by id.
+typedef uint32_t bh_str_id;
+#define BH_STR_ID_NONE ((bh_str_id)-1)
+
+bh_define_darray(bh_str_id) bh_str_ids_t;
+
+// open-addressing string table, probed in groups of 16 control bytes.
+// strings are copied into blocks owned by the table, so they outlive arena resets.
+typedef struct {
+  size_t capacity;    // slots, power of two and multiple of 16
+  size_t count;
+  uint8_t *ctrl;      // 0 = empty, otherwise 0x80 | 7 bits of hash
+  bh_str_id *slots;
+
+  size_t size;        // entries allocated
+  char **strings;
+  size_t *lengths;
+  uint64_t *hashes;
+
+  char *block;
+  size_t block_used;
+  size_t block_size;
+  bh_files_t blocks;
+} bh_intern_t;
+
+typedef enum {
+  BH_FRESH = 0,
+  BH_STALE_MISSING_OUTPUT,
+  BH_STALE_NEWER_INPUT,
+  BH_STALE_MISSING_INPUT,
+  BH_STALE_DEPENDENCY,      // an input is an output that will be rebuilt
+  BH_STALE_COMMAND_CHANGED, // or was never built by this build.h
+} bh_stale_t;
+
+// early cutoff: when a rebuilt output has the same content as before, its
+// dependents aren't rebuilt. BH_RESTAT_MTIME also puts the old mtime back
+// so tools outside build.h don't see a change either.
+typedef enum {
+  BH_RESTAT_NONE = 0,
+  BH_RESTAT_DIGEST,
+  BH_RESTAT_MTIME,
+} bh_restat_t;
+
+typedef struct {
+  bh_str_id output;
+  bh_str_id command;      // from `commands`
+  bh_str_id depfile;      // BH_STR_ID_NONE when the command writes none
+  bh_str_ids_t inputs;
+  bh_str_ids_t implicit;  // read from the depfile
+  int64_t depfile_mtime;
+  uint8_t mark;
+  uint8_t stale;          // bh_stale_t of the last evaluation
+  uint8_t restat;         // bh_restat_t
+  bool traced;            // inputs come from tracing the command
+} bh_target_t;
+
+bh_define_darray(bh_target_t) bh_targets_t;
+
+// targets plus a stat cache, both keyed by ids from `paths`. the cache is
+// only refreshed for outputs that were rebuilt and paths that were
+// invalidated, which is what keeps watch mode cheap. commands have a table
+// of their own, so nothing sized by `paths` ever covers them.
+typedef struct {
+  bh_targets_t targets;
+  bh_intern_t paths;
+  bh_intern_t commands;
+  int64_t *mtimes;       // nanoseconds, -1 missing, -2 not stated yet
+  size_t mtimes_size;
+  size_t *producers;     // target index + 1 per output/depfile id, 0 for sources
+  size_t producers_size;
+} bh_graph_t;
+
+#define bh_graph_target(graph, index) (&(graph)->targets.items[index])
+
+typedef struct {
+  bool explain;       // -n/--explain: report why targets are stale, run nothing
+  int verbosity;      // -v shows debug messages, -q only warnings and errors
+  bool log_json;      // --log-json: one JSON object per message
+  bool watch;
+  bool daemon;
+  bool daemon_stop;
+  bool no_daemon;
+  bool no_progress;   // --no-progress: no status line while bh_await waits
+  bool keep_going;    // -k/--keep-going: let the other jobs finish after a failure
+  int job_timeout;    // --job-timeout N: seconds before a job is killed, 0 for BUILD_JOB_TIMEOUT
+  int shard_index;    // --shard K/N: bh_test_run only runs the K-th of N shards
+  int shard_count;
+} bh_options_t;
+
+// filled from the command line by bh_init
+static bh_options_t build_options;
+
+#ifndef BUILD_WATCH_DEBOUNCE_MS
+#define BUILD_WATCH_DEBOUNCE_MS 50
+#endif
+
+#ifndef BUILD_DAEMON_SOCKET
+#define BUILD_DAEMON_SOCKET ".build_cache/daemon.sock"
+#endif
+
+#ifndef BUILD_REMOTE_CONNECT_MS
+// how long a remote worker gets to accept, then the job compiles locally
+#define BUILD_REMOTE_CONNECT_MS 2000
+#endif
+
+#ifndef BUILD_REMOTE_TIMEOUT
+// seconds a remote compile may stall sending or receiving
+#define BUILD_REMOTE_TIMEOUT 300
+#endif
+
+#ifndef BUILD_COMMAND_LOG
+#define BUILD_COMMAND_LOG ".build_cache/commands.log"
+#endif
+
+#ifndef BUILD_DIR_CACHE
+#define BUILD_DIR_CACHE ".build_cache/dirs.cache"
+#endif
+
+#ifndef BUILD_IO_URING_DEPTH
+#define BUILD_IO_URING_DEPTH 256
+#endif
+
+#ifndef BUILD_INCLUDE_SCANNER
+// 0 makes bh_c_source_get_include_paths always run `gcc -MM`
+#define BUILD_INCLUDE_SCANNER 1
+#endif
+
+#ifndef BUILD_TRACE_SHIM_PATH
+#define BUILD_TRACE_SHIM_PATH ".build_cache/bhtrace.so"
+#endif
+
+#ifndef BUILD_TRACE_CC
+#define BUILD_TRACE_CC "cc"
+#endif
+
+#ifndef BUILD_COMPDB
+#define BUILD_COMPDB "compile_commands.json"
+#endif
+
+#ifndef BUILD_RSP_THRESHOLD
+// `sh -c` gets the whole command as one argument, linux caps that at 128k
+#define BUILD_RSP_THRESHOLD (64 * 1024)
+#endif
+
+#ifndef BUILD_JOB_TIMEOUT
+// seconds a job may run before it is killed, 0 waits forever
+#define BUILD_JOB_TIMEOUT 0
+#endif
+
+#ifndef BUILD_PROGRESS_MS
+// how often bh_await redraws its progress line on a terminal
+#define BUILD_PROGRESS_MS 100
+#endif
+
+#ifndef BUILD_JOB_KILL_GRACE_MS
+#define BUILD_JOB_KILL_GRACE_MS 2000
+#endif
+
+#ifndef BUILD_TEST_DIR
+#define BUILD_TEST_DIR ".build_cache/tests"
+#endif
+
+#ifndef BUILD_TEST_RERUNS
+// a failing test is run this many more times, passing on a rerun makes it flaky
+#define BUILD_TEST_RERUNS 2
+#endif
+
+#ifndef BUILD_TEST_SLOWEST
+#define BUILD_TEST_SLOWEST 5
+#endif
+
+#ifndef BUILD_LOG_MIN_LEVEL
+// messages below this level compile away
+#define BUILD_LOG_MIN_LEVEL BH_LOG_DEBUG
+#endif
+
+#ifndef BUILD_LOG_BUFFER
+#define BUILD_LOG_BUFFER 8192
+#endif
+
+#ifndef BUILD_ARENA_POOL
+#define BUILD_ARENA_POOL 64
+#endif
+
+#ifndef BUILD_POOL_THREADS
+// workers behind bh_parallel_for, 0 starts one per CPU besides the caller
+#define BUILD_POOL_THREADS 0
+#endif
+
+#ifndef BUILD_POOL_ARENA
+// what callbacks can bh_fmt on each worker until bh_parallel_reset
+#define BUILD_POOL_ARENA (16 * 1024 * 1024)
+#endif
+
+// every thread allocates from its own arena, worker threads get one with
+// bh_arena_thread_begin. the graph, command log and compilation database
+// stay on the main thread.
+static _Thread_local bh_arena_t *build_arena;
+
+// when set, file listings and dependency lists return interned paths.
+static _Thread_local bh_intern_t *build_intern;
 
 // string formating
 #define bh_fmt(...) ({ bh_fmt_fn(__VA_ARGS__, NULL); })
 
 char *bh_fmt_fn(char *s, ...);
+
+typedef enum {
+  BH_LOG_DEBUG = 0,
+  BH_LOG_INFO,
+  BH_LOG_WARN,
+  BH_LOG_ERROR,
+} bh_log_level_t;
+
+// the arguments are only formatted when the message isn't filtered out
+#define bh_logf(level, ...) do {                                                \
+  if ((level) >= BUILD_LOG_MIN_LEVEL &&                                         \
+      (int)(level) >= BH_LOG_INFO - build_options.verbosity)                    \
+    bh_logf_fn((level), __VA_ARGS__);                                           \
+} while (0)
+
 void bh_log(int level, const char *message);
+void bh_logf_fn(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void bh_log_flush(void);
+int64_t bh_clock_ns(void);
 
 void bh_init_arena(bh_arena_t *arena, size_t size);
 void *bh_arena_alloc(bh_arena_t *arena, size_t size);
@@ -267,6 +793,36 @@ void *bh_arena_alloc(bh_arena_t *arena, size_t size);
   }                               \
 } while(0)
 
+bh_arena_t *bh_arena_acquire(size_t size);
+void bh_arena_release(bh_arena_t *arena);
+void bh_arena_thread_begin(size_t size);
+void bh_arena_thread_end(void);
+void *bh_arena_adopt(bh_arena_t *arena, const void *data, size_t size);
+void bh_files_adopt(bh_arena_t *arena, bh_files_t *files);
+
+// runs fn over disjoint [begin, end) chunks of [0, count) on a shared pool of
+// threads with their own arenas, the calling thread helps. idle threads
+// steal half of a busy one's range. calls made from inside a callback, or
+// while another thread uses the pool, just run on the calling thread.
+void bh_parallel_for(size_t count, void (*fn)(void *ctx, size_t begin, size_t end), void *ctx);
+void bh_parallel_foreach(void *items, size_t count, size_t size, void (*fn)(void *ctx, void *item), void *ctx);
+void bh_parallel_map(const void *in, size_t count, size_t in_size, void *out, size_t out_size,
+  void (*fn)(void *ctx, const void *in, void *out), void *ctx);
+size_t bh_parallel_filter(const void *in, size_t count, size_t size, void *out,
+  bool (*fn)(void *ctx, const void *item), void *ctx);
+// restarts the pool with `threads` workers (0 for BUILD_POOL_THREADS), returns how many run
+size_t bh_parallel_use(size_t threads);
+// drops what the callbacks allocated in the worker arenas
+void bh_parallel_reset(void);
+
+void bh_sb_init(bh_sb_t *sb, bh_arena_t *arena);
+void bh_sb_append(bh_sb_t *sb, const char *s);
+void bh_sb_append_sv(bh_sb_t *sb, bh_sv_t sv);
+void bh_sb_append_char(bh_sb_t *sb, char ch);
+void bh_sb_appendf(bh_sb_t *sb, const char *fmt, ...);
+void bh_sb_append_files(bh_sb_t *sb, bh_files_t *files, const unsigned char seperator);
+char *bh_sb_finish(bh_sb_t *sb);
+
 bool bh_mkdir(const char *path);
 bh_path_kind_t bh_path_exist(const char *path);
 bool bh_dir_get(const char *path, bh_files_t *dirs);
@@ -274,78 +830,327 @@ bool bh_dir_get(const char *path, bh_files_t *dirs);
 char *bh_files_to_string(bh_files_t *files, const unsigned char seperator);
 bool bh_files_get(const char *path, bh_files_t *files);
 bool bh_recursive_files_get(const char *path, bh_files_t *files);
+// writes the directory listing cache when it changed. bh_graph_build and
+// exit do it too, call it when other processes should see the listings sooner
+bool bh_dircache_flush(void);
 char *bh_file_read(const char *path);
 bool bh_file_write(const char *path, const char *buffer, size_t size);
 time_t bh_file_get_time(const char *path);
 
+// many paths at once, through io_uring on linux: mtimes in nanoseconds (-1
+// when missing), and malloc'd NUL terminated contents (NULL when unreadable)
+void bh_stat_many(const char **paths, size_t count, int64_t *mtimes);
+void bh_read_many(const char **paths, size_t count, char **data, size_t *lens);
+bool bh_io_uring_use(bool enabled);
+
 char *bh_string_join(const char *f, const char *s);
 char *bh_string_chop(const char *s, size_t from, size_t to);
 char *bh_string_replace_char(char *s, char from, char to);
+char *bh_string_replace_char_inplace(char *s, char from, char to);
+
+// vectorized byte kernels, `set` is a NUL terminated list of up to 16 bytes.
+// searches return `len` when nothing matches. the best level is picked on
+// first use; bh_simd_use forces one and must be called before starting threads.
+bh_simd_t bh_simd_detect(void);
+bh_simd_t bh_simd_use(bh_simd_t level);
+size_t bh_bytes_find(const char *data, size_t len, char ch);
+size_t bh_bytes_find_any(const char *data, size_t len, const char *set);
+size_t bh_bytes_skip_any(const char *data, size_t len, const char *set);
+size_t bh_bytes_replace(char *data, size_t len, const char *set, char to);
+size_t bh_bytes_delete(char *data, size_t len, const char *set);
 
 bool bh_string_to_array(bh_strings_t *strings, const char *string, const unsigned char seperator);
 
+// arena-aware variants, the functions above use `build_arena`
+char *bh_files_to_string_arena(bh_arena_t *arena, bh_files_t *files, const unsigned char seperator);
+char *bh_string_join_arena(bh_arena_t *arena, const char *f, const char *s);
+char *bh_string_chop_arena(bh_arena_t *arena, const char *s, size_t from, size_t to);
+bool bh_string_to_array_arena(bh_arena_t *arena, bh_strings_t *strings, const char *string, const unsigned char seperator);
+
+// string views, none of these allocate
+bh_sv_t bh_sv_from_cstr(const char *s);
+bh_sv_t bh_sv_from_parts(const char *data, size_t len);
+bh_sv_t bh_sv_trim_left(bh_sv_t sv);
+bh_sv_t bh_sv_trim_right(bh_sv_t sv);
+bh_sv_t bh_sv_trim(bh_sv_t sv);
+bool bh_sv_find(bh_sv_t sv, char ch, size_t *index);
+bh_sv_t bh_sv_chop_by(bh_sv_t *sv, char delim);
+bh_sv_t bh_sv_chop_word(bh_sv_t *sv);
+bool bh_sv_split(bh_sv_t sv, char delim, bh_svs_t *out);
+bool bh_sv_eq(bh_sv_t a, bh_sv_t b);
+bool bh_sv_starts_with(bh_sv_t sv, bh_sv_t prefix);
+bool bh_sv_ends_with(bh_sv_t sv, bh_sv_t suffix);
+size_t bh_sv_join(char *buffer, size_t size, const bh_sv_t *items, size_t count, bh_sv_t seperator);
+char *bh_sv_to_cstr(bh_arena_t *arena, bh_sv_t sv);
+
+uint64_t bh_hash(const void *data, size_t size);
+
+void bh_intern_init(bh_intern_t *table, size_t capacity);
+bh_str_id bh_intern(bh_intern_t *table, const char *s);
+bh_str_id bh_intern_n(bh_intern_t *table, const char *s, size_t len);
+bh_str_id bh_intern_find(bh_intern_t *table, const char *s, size_t len);
+const char *bh_intern_str(bh_intern_t *table, bh_str_id id);
+size_t bh_intern_len(bh_intern_t *table, bh_str_id id);
+void bh_intern_free(bh_intern_t *table);
+bool bh_files_intern(bh_intern_t *table, bh_files_t *files, bh_str_ids_t *ids);
+
 bool bh_execute(const char *command);
+char *bh_command_rsp(const char *command);
 bool bh_is_binary_old(const char *bin_path, bh_files_t *files);
+bh_stale_t bh_binary_staleness(const char *bin_path, bh_files_t *files, const char **culprit);
+const char *bh_stale_reason(bh_stale_t stale);
+bool bh_command_changed(const char *output, const char *command);
+void bh_command_record(const char *output, const char *command, int64_t duration);
+int64_t bh_command_duration(const char *output);
+void bh_compdb_add(const char *file, const char *output, const char *command);
+bool bh_compdb_flush(void);
 bool bh_on_binary_old_execute(const char *bin_path, bh_files_t *files, const char *command);
 bool bh_push_async(bh_async_t *async, const char *command);
 bool bh_await(bh_async_t *async);
 
+// test runner: `command` runs with sh in a fresh directory of its own, also
+// $TMPDIR, with $BH_TEST_ROOT and $BH_TEST_NAME set. output is only shown
+// for failures. bh_test_run runs `jobs` at a time (0 for one per CPU),
+// reruns failures, and is true when every test of this shard passed.
+typedef struct {
+  const char *name;
+  const char *command;
+  int64_t duration;       // ms of the last attempt, the recorded one before, -1 unknown
+  int attempts;
+  bool passed;
+  bool flaky;             // passed after failing
+  bool skipped;           // in another shard
+} bh_test_t;
+
+bh_define_darray(bh_test_t) bh_tests_t;
+
+void bh_test_add(bh_tests_t *tests, const char *name, const char *command);
+bool bh_test_run(bh_tests_t *tests, int jobs);
+
+// distributed compiles (unix): once a worker is added, bh_push_async sends
+// single `cc ... -c x.c -o x.o` jobs to the workers in turn. sources are
+// preprocessed locally, workers compile the result and send back the
+// object and diagnostics. unreachable workers fall back to a local compile.
+bool bh_remote_add(const char *host);          // "host:port", or --remote h1:p,h2:p
+int bh_worker_serve(const char *address);      // "[host:]port", the worker side
+
+// runs `command` and lists the files under the current directory it read
+// (`inputs`) and wrote (`outputs`), either may be NULL. linux only.
+typedef enum {
+  BH_TRACE_AUTO = 0,      // the LD_PRELOAD shim, ptrace when it can't be built
+  BH_TRACE_PRELOAD,
+  BH_TRACE_PTRACE,        // also sees static binaries, x86_64 only
+} bh_trace_t;
+
+bool bh_execute_traced(const char *command, bh_files_t *inputs, bh_files_t *outputs);
+bh_trace_t bh_trace_use(bh_trace_t mode);
+
+// build graph: targets are rebuilt when an input (or a header listed in their
+// depfile) is newer than the output. targets whose inputs are other targets'
+// outputs are built after them.
+size_t bh_graph_add(bh_graph_t *graph, const char *output, bh_files_t *inputs, const char *command);
+void bh_graph_set_depfile(bh_graph_t *graph, size_t target, const char *depfile);
+void bh_graph_set_restat(bh_graph_t *graph, size_t target, bh_restat_t restat);
+void bh_graph_set_traced(bh_graph_t *graph, size_t target);
+bool bh_graph_build(bh_graph_t *graph);
+void bh_graph_invalidate(bh_graph_t *graph, const char *path);
+void bh_graph_reset(bh_graph_t *graph);
+void bh_graph_free(bh_graph_t *graph);
+bool bh_graph_watch(bh_graph_t *graph, bh_files_t *dirs, void (*replan)(bh_graph_t *graph));
+bool bh_graph_write_ninja(bh_graph_t *graph, const char *path);
+void bh_graph_import_ninja(bh_graph_t *graph, const char *log_path, const char *deps_path);
+int bh_graph_main(int argc, char *argv[], bh_files_t *dirs, void (*plan)(bh_graph_t *graph));
+
+bool bh_depfile_read(const char *path, bh_files_t *deps);
+void bh_depfile_parse(const char *text, bh_files_t *deps);
+void bh_parse_options(int argc, char *argv[]);
+
 // C specific stuff
 bool bh_c_source_get_include_paths(
   bh_files_t *include_paths,
   const char *source,
   const char *args,
   const char *out_filename);
+// `source` and the headers it includes, found with -I/-iquote/-isystem in
+// `args`. false for computed includes, which need `gcc -MM` instead.
+bool bh_c_scan_includes(bh_files_t *deps, const char *source, const char *args);
+void bh_c_scan_reset(void);
 
 #ifdef BUILD_IMPLEMENTATION
 
 char *bh_fmt_fn(char *s, ...)
 {
-	// allocate small size buffer
-	size_t buffer_size = 64; // bytes
-	char *buffer = (char *)bh_arena_alloc(build_arena, buffer_size);
+  bh_arena_t *arena = build_arena;
 
-	if (buffer == NULL) {
-		perror("failed to allocate memory for formating string: ");
-		return NULL;
-	}
+  // format straight into the free tail of the arena, a second pass is only
+  // needed when the arena can't hold the result (and then alloc asserts).
+  size_t avail = arena->size - arena->offset;
+  char *buffer = arena->buffer + arena->offset;
 
-	va_list ap;
-	va_start(ap, s);
+  va_list ap;
+  va_start(ap, s);
+  int n = vsnprintf(buffer, avail, s, ap);
+  va_end(ap);
 
-	size_t nSize = vsnprintf(buffer, buffer_size, s, ap);
-	if (!nSize) {
-		va_end(ap);
-	}
+  if (n < 0) {
+    perror("failed to format string: ");
+    return NULL;
+  }
 
-	// if buffer does not have enough space then extend it.
-	if (nSize >= buffer_size) {
-		buffer_size = nSize + 1;
-		buffer = (char*)bh_arena_alloc(build_arena, buffer_size);
+  if ((size_t)n < avail) {
+    arena->offset += (size_t)n + 1;
+    return buffer;
+  }
 
-		if (buffer == NULL) {
-			perror("failed to extend buffer for allocating formated string: ");
-			va_end(ap);
+  buffer = (char *)bh_arena_alloc(arena, (size_t)n + 1);
+  if (buffer == NULL) {
+    perror("failed to allocate memory for formating string: ");
+    return NULL;
+  }
 
-			return NULL;
-		}
+  va_start(ap, s);
+  vsnprintf(buffer, (size_t)n + 1, s, ap);
+  va_end(ap);
 
-		va_start(ap, s);
-		vsnprintf(buffer, buffer_size, s, ap);
-	}
+  return buffer;
+}
 
-	va_end(ap);
+int64_t bh_clock_ns(void)
+{
+#if __UNIX__
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#elif __WIN32__
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (int64_t)((double)count.QuadPart * 1e9 / frequency.QuadPart);
+#endif
+}
 
-	return buffer;
+typedef struct {
+  size_t len;
+  char data[BUILD_LOG_BUFFER];
+} bh_log_sink_t;
+
+// one sink per stream and thread: 0 is stdout, 1 is stderr. they are
+// flushed when full, on errors, and by bh_log_flush before anything else
+// can write to the same descriptors (spawning commands, exit).
+static _Thread_local bh_log_sink_t bh_log_sinks[2];
+static _Atomic int64_t bh_log_epoch;   // 0 until the first message
+
+static void bh_log_sink_flush(int index)
+{
+  bh_log_sink_t *sink = &bh_log_sinks[index];
+  if (!sink->len) return;
+
+  fwrite(sink->data, 1, sink->len, index ? stderr : stdout);
+  sink->len = 0;
+}
+
+// threads other than the main one have to call this before they exit
+void bh_log_flush(void)
+{
+  bh_log_sink_flush(0);
+  bh_log_sink_flush(1);
+  fflush(stdout);
+  fflush(stderr);
+}
+
+static void bh_log_put(int index, const char *data, size_t len)
+{
+  bh_log_sink_t *sink = &bh_log_sinks[index];
+  if (sink->len + len > BUILD_LOG_BUFFER) bh_log_sink_flush(index);
+
+  if (len > BUILD_LOG_BUFFER) {
+    fwrite(data, 1, len, index ? stderr : stdout);
+    return;
+  }
+
+  memcpy(sink->data + sink->len, data, len);
+  sink->len += len;
+}
+
+static void bh_log_write(int level, const char *message, size_t len)
+{
+  static const char *names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+  static const char *json_names[] = { "debug", "info", "warn", "error" };
+  if (level < BH_LOG_DEBUG || level > BH_LOG_ERROR) return;
+
+  // threads can log first at the same time, only one sets the epoch
+  int64_t unset = 0;
+  if (!atomic_load_explicit(&bh_log_epoch, memory_order_acquire) &&
+      atomic_compare_exchange_strong(&bh_log_epoch, &unset, bh_clock_ns()))
+    atexit(bh_log_flush);
+
+  int index = level == BH_LOG_ERROR;
+
+  if (!build_options.log_json) {
+    char head[16];
+    int n = snprintf(head, sizeof(head), "[%s]: ", names[level]);
+    bh_log_put(index, head, n);
+    bh_log_put(index, message, len);
+  } else {
+    int64_t ns = bh_clock_ns() - atomic_load_explicit(&bh_log_epoch, memory_order_acquire);
+    char head[96];
+    int n = snprintf(head, sizeof(head), "{\"ts\":%lld.%06lld,\"level\":\"%s\",\"msg\":\"",
+      (long long)(ns / 1000000000), (long long)(ns % 1000000000 / 1000), json_names[level]);
+    bh_log_put(index, head, n);
+
+    if (len && message[len - 1] == '\n') len--;
+
+    size_t run = 0;
+    for (size_t i = 0; i < len; ++i) {
+      unsigned char c = (unsigned char)message[i];
+      if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+      bh_log_put(index, message + run, i - run);
+      char escape[8];
+      n = (c == '"' || c == '\\') ? snprintf(escape, sizeof(escape), "\\%c", c)
+                                  : snprintf(escape, sizeof(escape), "\\u%04x", c);
+      bh_log_put(index, escape, n);
+      run = i + 1;
+    }
+
+    bh_log_put(index, message + run, len - run);
+    bh_log_put(index, "\"}\n", 3);
+  }
+
+  // errors go out right away, after whatever was logged before them
+  if (index) {
+    bh_log_sink_flush(0);
+    fflush(stdout);
+    bh_log_sink_flush(1);
+  }
 }
 
 void bh_log(int level, const char *message)
 {
-  switch (level) {
-    case 1: fprintf(stdout, "[INFO]: %s", message); break;
-    case 2: fprintf(stdout, "[WARN]: %s", message); break;
-    case 3: fprintf(stderr, "[ERROR]: %s", message); break;
+  if (level < BUILD_LOG_MIN_LEVEL || level < BH_LOG_INFO - build_options.verbosity) return;
+  bh_log_write(level, message, strlen(message));
+}
+
+void bh_logf_fn(int level, const char *fmt, ...)
+{
+  char stack[512];
+  char *message = stack;
+
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(stack, sizeof(stack), fmt, ap);
+  va_end(ap);
+  if (n < 0) return;
+
+  if ((size_t)n >= sizeof(stack)) {
+    message = (char *)malloc(n + 1);
+    va_start(ap, fmt);
+    vsnprintf(message, n + 1, fmt, ap);
+    va_end(ap);
   }
+
+  bh_log_write(level, message, n);
+  if (message != stack) free(message);
 }
 
 void bh_init_arena(bh_arena_t *arena, size_t size)
@@ -362,578 +1167,5633 @@ void *bh_arena_alloc(bh_arena_t *arena, size_t size)
   return block;
 }
 
-bool bh_mkdir(const char *path)
-{
-	size_t pos = 0;
-	for (size_t i = 0; i < strlen(path); ++i) {
-		if (path[i] == '/') {
-			char *pre = bh_string_chop(path, 0, pos);
-			char *sub = bh_string_chop(path, pos, i);
-
-			if (sub) {
-				const char *final_dir_path = pre ?
-					bh_fmt((char *)"mkdir %s%s", pre, sub) :
-					bh_fmt((char *)"mkdir %s", sub);
-
-				if (bh_path_exist(bh_string_chop(final_dir_path, 6, strlen(final_dir_path))) != is_dir) {
-          if (!bh_execute(final_dir_path)) return false;
-        }
-			}
+// freed thread arenas wait here for the next thread. each slot is taken
+// with an exchange and filled with a compare-exchange from NULL, so the
+// pool needs no lock and a slot can't be handed out twice.
+static _Atomic(bh_arena_t *) bh_arena_pool[BUILD_ARENA_POOL];
 
-			pos = i + 1;
-		}
-	}
-
-	char *pre = bh_string_chop(path, 0, pos);
-	char *sub = bh_string_chop(path, pos, strlen(path));
+bh_arena_t *bh_arena_acquire(size_t size)
+{
+  for (size_t i = 0; i < BUILD_ARENA_POOL; ++i) {
+    if (!atomic_load_explicit(&bh_arena_pool[i], memory_order_relaxed)) continue;
 
-	if (sub) {
-		const char *final_dir_path = pre ?
-			bh_fmt((char *)"mkdir %s%s", pre, sub) :
-			bh_fmt((char *)"mkdir %s", sub);
+    bh_arena_t *arena = atomic_exchange(&bh_arena_pool[i], NULL);
+    if (!arena) continue;
 
-		if (bh_path_exist(bh_string_chop(final_dir_path, 6, strlen(final_dir_path))) != is_dir) {
-      if (!bh_execute(final_dir_path))
-        return false;
+    if (arena->size >= size) {
+      arena->offset = 0;
+      return arena;
     }
-	}
 
-  return true;
+    // too small for this caller, another one may still want it
+    bh_arena_release(arena);
+  }
+
+  bh_arena_t *arena = (bh_arena_t *)calloc(1, sizeof(bh_arena_t));
+  bh_init_arena(arena, size);
+  return arena;
 }
 
-bh_path_kind_t bh_path_exist(const char *path)
+void bh_arena_release(bh_arena_t *arena)
 {
-  bh_path_kind_t kind = is_none;
-
-#if __UNIX__
-  struct stat bf;
+  if (!arena) return;
 
-  if (stat(path, &bf)) {
-    return kind;
+  for (size_t i = 0; i < BUILD_ARENA_POOL; ++i) {
+    bh_arena_t *empty = NULL;
+    if (atomic_compare_exchange_strong(&bh_arena_pool[i], &empty, arena)) return;
   }
 
-  if (S_ISREG(bf.st_mode)) kind = is_file;
-  else if (S_ISDIR(bf.st_mode)) kind = is_dir;
-
-#elif __WIN32__
-  DWORD attrib = GetFileAttributes(path);
-  if (attrib == INVALID_FILE_ATTRIBUTES)
-    return kind;
+  bh_arena_free(arena);
+  free(arena);
+}
 
-  if (attrib & FILE_ATTRIBUTE_DIRECTORY)
-    kind = is_dir;
-  else
-    kind = is_file;
+// gives the calling thread its own build_arena, for worker threads
+void bh_arena_thread_begin(size_t size)
+{
+  build_arena = bh_arena_acquire(size);
+}
 
-#endif
+void bh_arena_thread_end(void)
+{
+  bh_arena_release(build_arena);
+  build_arena = NULL;
+}
 
-  return kind;
+// copies a result out of a worker's arena, before that arena is released
+void *bh_arena_adopt(bh_arena_t *arena, const void *data, size_t size)
+{
+  void *copy = bh_arena_alloc(arena, size);
+  memcpy(copy, data, size);
+  return copy;
 }
 
-bool bh_dir_get(const char *path, bh_files_t *dirs)
+// moves the strings of `files` into `arena`, the list itself is kept
+void bh_files_adopt(bh_arena_t *arena, bh_files_t *files)
 {
-  bh_path_kind_t kind = bh_path_exist(path);
-  if (kind == is_none || kind == is_file) {
-    bh_log(3, "expected directory path.\n");
-    return false;
-  }
+  for (size_t i = 0; i < bh_darray_len(files); ++i)
+    files->items[i] = (char *)bh_arena_adopt(arena, files->items[i], strlen(files->items[i]) + 1);
+}
 
-  bool has_slash = false;
-  char slash = bh_string_chop(path, strlen(path) - 1, strlen(path))[0];
+// a participant's share of the current job, [begin, end) packed into one
+// word so the owner and thieves can both move it with a compare-exchange.
+#define bh_pool_pack(begin, end) (((uint64_t)(end) << 32) | (uint64_t)(begin))
+#define bh_pool_begin(range) ((size_t)((range) & 0xffffffff))
+#define bh_pool_end(range) ((size_t)((range) >> 32))
 
-  if (slash == '/' || slash == '\\')
-    has_slash = true;
-  else
+typedef struct {
+  void (*fn)(void *ctx, size_t begin, size_t end);
+  void *ctx;
+  size_t chunk;
+  _Atomic uint64_t *ranges;   // one per worker, the caller's is last
+} bh_pool_job_t;
+
+typedef struct {
 #if __UNIX__
-    slash = '/';
-#elif __WIN32__
-    slash = '\\';
+  pthread_mutex_t lock;
+  pthread_cond_t wake, idle;
+  pthread_t *threads;
 #endif
+  bh_arena_t **arenas;
+  size_t threads_len;
+  bool started, stop;
+  uint64_t generation;
+  size_t busy;                // workers still inside the current job
+  bh_pool_job_t job;
+  atomic_bool claimed;
+} bh_pool_t;
+
+static bh_pool_t build_pool;
+static _Thread_local bool bh_pool_inside;
+
+// the owner takes chunks off the front of its own range
+static bool bh_pool_take(_Atomic uint64_t *range, size_t chunk, size_t *begin, size_t *end)
+{
+  uint64_t current = atomic_load(range);
+  for (;;) {
+    size_t b = bh_pool_begin(current), e = bh_pool_end(current);
+    if (b >= e) return false;
+
+    size_t next = e - b > chunk ? b + chunk : e;
+    if (atomic_compare_exchange_weak(range, &current, bh_pool_pack(next, e))) {
+      *begin = b;
+      *end = next;
+      return true;
+    }
+  }
+}
 
-  DIR *dir = opendir(path);
-  if (dir == NULL) {
-    bh_log(3, bh_fmt("failed to open directory, `%s`.\n", path));
-    return false;
+// moves the back half of the fullest other range into `self`, which is empty.
+// only owners fill an empty range, so the plain store can't race a thief.
+static bool bh_pool_steal(bh_pool_job_t *job, size_t participants, size_t self)
+{
+  for (;;) {
+    size_t victim = self, most = 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < participants; ++i) {
+      uint64_t range = atomic_load(&job->ranges[i]);
+      size_t left = bh_pool_end(range) - bh_pool_begin(range);
+      if (i != self && bh_pool_end(range) > bh_pool_begin(range) && left > most) {
+        victim = i;
+        most = left;
+        seen = range;
+      }
+    }
+    if (victim == self) return false;
+
+    size_t b = bh_pool_begin(seen), e = bh_pool_end(seen), mid = b + (e - b) / 2;
+    if (atomic_compare_exchange_strong(&job->ranges[victim], &seen, bh_pool_pack(b, mid))) {
+      atomic_store(&job->ranges[self], bh_pool_pack(mid, e));
+      return true;
+    }
   }
+}
 
-  struct dirent *data;
-  while ((data = readdir(dir)) != NULL)
-  {
-    char *next_path = bh_fmt("%s%c%s", path, slash, data->d_name);
+static void bh_pool_work(bh_pool_job_t *job, size_t participants, size_t self)
+{
+  size_t begin, end;
+  for (;;) {
+    if (bh_pool_take(&job->ranges[self], job->chunk, &begin, &end)) job->fn(job->ctx, begin, end);
+    else if (!bh_pool_steal(job, participants, self)) return;
+  }
+}
 
 #if __UNIX__
-    if (data->d_type == DT_DIR)
-    {
-      bh_darray_push(dirs, next_path);
-    }
-#elif __WIN32__
-    if ((strcmp(data->d_name, "..") && strcmp(data->d_name, ".")) &&
-      bh_path_exist(next_path) == is_dir)
-    {
-      bh_darray_push(dirs, next_path);
+static void *bh_pool_worker(void *data)
+{
+  bh_pool_t *pool = &build_pool;
+  size_t self = (size_t)data;
+  bh_arena_thread_begin(BUILD_POOL_ARENA);
+  pool->arenas[self] = build_arena;
+  bh_pool_inside = true;
+
+  uint64_t seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == seen && !pool->stop) pthread_cond_wait(&pool->wake, &pool->lock);
+    if (pool->stop) break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    bh_pool_work(&pool->job, pool->threads_len + 1, self);
+    bh_log_flush();
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0) pthread_cond_signal(&pool->idle);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  bh_arena_thread_end();
+  return NULL;
+}
+
+static void bh_pool_stop(bh_pool_t *pool)
+{
+  if (!pool->started) return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 0; i < pool->threads_len; ++i)
+    pthread_join(pool->threads[i], NULL);
+
+  free(pool->threads);
+  free(pool->arenas);
+  free((void *)pool->job.ranges);
+  pool->threads = NULL;
+  pool->arenas = NULL;
+  pool->job.ranges = NULL;
+  pool->started = pool->stop = false;
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->idle);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+static void bh_pool_start(bh_pool_t *pool, size_t threads)
+{
+  if (!threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 1 ? (size_t)cpus - 1 : 0;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+  pool->threads = (pthread_t *)calloc(threads ? threads : 1, sizeof(pthread_t));
+  pool->arenas = (bh_arena_t **)calloc(threads ? threads : 1, sizeof(bh_arena_t *));
+  pool->job.ranges = (_Atomic uint64_t *)calloc(threads + 1, sizeof(uint64_t));
+  pool->generation = 0;
+  pool->started = true;
+
+  pool->threads_len = 0;
+  for (size_t i = 0; i < threads; ++i) {
+    if (pthread_create(&pool->threads[i], NULL, bh_pool_worker, (void *)i) != 0) {
+      bh_logf(BH_LOG_WARN, "started %zu of %zu pool threads: %s\n", i, threads, strerror(errno));
+      break;
     }
+    pool->threads_len++;
+  }
+}
+#endif
+
+size_t bh_parallel_use(size_t threads)
+{
+#if __UNIX__
+  bool expected = false;
+  if (bh_pool_inside || !atomic_compare_exchange_strong(&build_pool.claimed, &expected, true))
+    return build_pool.threads_len;
+
+  bh_pool_stop(&build_pool);
+  bh_pool_start(&build_pool, threads ? threads : BUILD_POOL_THREADS);
+  atomic_store(&build_pool.claimed, false);
+  return build_pool.threads_len;
+#else
+  (void)threads;
+  return 0;
 #endif
+}
+
+void bh_parallel_for(size_t count, void (*fn)(void *ctx, size_t begin, size_t end), void *ctx)
+{
+  if (!count) return;
+
+#if __UNIX__
+  bh_pool_t *pool = &build_pool;
+  bool expected = false;
+  assert(count <= UINT32_MAX);
+  if (bh_pool_inside || !atomic_compare_exchange_strong(&pool->claimed, &expected, true)) {
+    fn(ctx, 0, count);
+    return;
   }
 
-  return true;
+  if (!pool->started) bh_pool_start(pool, BUILD_POOL_THREADS);
+  size_t participants = pool->threads_len + 1;
+  if (participants == 1 || count == 1) {
+    atomic_store(&pool->claimed, false);
+    fn(ctx, 0, count);
+    return;
+  }
+
+  // small enough chunks to balance, big enough that claiming them is noise
+  size_t chunk = count / (participants * 16);
+  pool->job.chunk = chunk < 1 ? 1 : chunk > 1024 ? 1024 : chunk;
+  pool->job.fn = fn;
+  pool->job.ctx = ctx;
+  for (size_t i = 0; i < participants; ++i)
+    atomic_store(&pool->job.ranges[i], bh_pool_pack(count * i / participants, count * (i + 1) / participants));
+
+  pthread_mutex_lock(&pool->lock);
+  pool->busy = pool->threads_len;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  bh_pool_inside = true;
+  bh_pool_work(&pool->job, participants, participants - 1);
+  bh_pool_inside = false;
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy) pthread_cond_wait(&pool->idle, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  atomic_store(&pool->claimed, false);
+#else
+  fn(ctx, 0, count);
+#endif
 }
 
-char *bh_files_to_string(bh_files_t *files, const unsigned char seperator)
+void bh_parallel_reset(void)
 {
-	size_t total_size_of_string = 1;
+  bool expected = false;
+  if (bh_pool_inside || !atomic_compare_exchange_strong(&build_pool.claimed, &expected, true)) return;
 
-	for (size_t i = 0; i < bh_darray_len(files); ++i)
-  {
-		total_size_of_string += strlen(files->items[i]);
-    if (i != bh_darray_len(files) - 1 && seperator) {
-      total_size_of_string++;
-    }
+  for (size_t i = 0; i < build_pool.threads_len; ++i)
+    if (build_pool.arenas[i]) bh_arena_reset(build_pool.arenas[i]);
+  atomic_store(&build_pool.claimed, false);
+}
+
+typedef struct {
+  const char *in;
+  char *out;
+  size_t in_size, out_size;
+  void (*fn)(void);           // one of the three callback types
+  void *ctx;
+  bool *keep;
+} bh_parallel_items_t;
+
+static void bh_parallel_foreach_chunk(void *ctx, size_t begin, size_t end)
+{
+  bh_parallel_items_t *items = (bh_parallel_items_t *)ctx;
+  void (*fn)(void *, void *) = (void (*)(void *, void *))items->fn;
+  for (size_t i = begin; i < end; ++i) fn(items->ctx, (char *)items->in + i * items->in_size);
+}
+
+static void bh_parallel_map_chunk(void *ctx, size_t begin, size_t end)
+{
+  bh_parallel_items_t *items = (bh_parallel_items_t *)ctx;
+  void (*fn)(void *, const void *, void *) = (void (*)(void *, const void *, void *))items->fn;
+  for (size_t i = begin; i < end; ++i)
+    fn(items->ctx, items->in + i * items->in_size, items->out + i * items->out_size);
+}
+
+static void bh_parallel_filter_chunk(void *ctx, size_t begin, size_t end)
+{
+  bh_parallel_items_t *items = (bh_parallel_items_t *)ctx;
+  bool (*fn)(void *, const void *) = (bool (*)(void *, const void *))items->fn;
+  for (size_t i = begin; i < end; ++i) items->keep[i] = fn(items->ctx, items->in + i * items->in_size);
+}
+
+void bh_parallel_foreach(void *items, size_t count, size_t size, void (*fn)(void *ctx, void *item), void *ctx)
+{
+  bh_parallel_items_t job = { .in = (const char *)items, .in_size = size, .fn = (void (*)(void))fn, .ctx = ctx };
+  bh_parallel_for(count, bh_parallel_foreach_chunk, &job);
+}
+
+void bh_parallel_map(const void *in, size_t count, size_t in_size, void *out, size_t out_size,
+  void (*fn)(void *ctx, const void *in, void *out), void *ctx)
+{
+  bh_parallel_items_t job = {
+    .in = (const char *)in, .out = (char *)out, .in_size = in_size, .out_size = out_size,
+    .fn = (void (*)(void))fn, .ctx = ctx,
+  };
+  bh_parallel_for(count, bh_parallel_map_chunk, &job);
+}
+
+// the predicate runs in parallel, the kept items are packed in order after
+size_t bh_parallel_filter(const void *in, size_t count, size_t size, void *out,
+  bool (*fn)(void *ctx, const void *item), void *ctx)
+{
+  bh_parallel_items_t job = {
+    .in = (const char *)in, .in_size = size, .fn = (void (*)(void))fn, .ctx = ctx,
+    .keep = (bool *)malloc(count ? count : 1),
+  };
+  bh_parallel_for(count, bh_parallel_filter_chunk, &job);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!job.keep[i]) continue;
+    memcpy((char *)out + kept * size, job.in + i * size, size);
+    kept++;
   }
 
-	char *string = (char *)malloc(total_size_of_string);
-  if (!string) return NULL;
+  free(job.keep);
+  return kept;
+}
 
-	size_t pos = 0;
-	for (size_t i = 0; i < bh_darray_len(files); ++i)
-	{
-    size_t len = strlen(files->items[i]);
-    strncpy(string + pos, files->items[i], len);
-    pos += len;
+void bh_sb_init(bh_sb_t *sb, bh_arena_t *arena)
+{
+  sb->arena = arena;
+  sb->data = arena->buffer + arena->offset;
+  sb->len = 0;
+  sb->cap = 0;
+}
 
-    if (i != bh_darray_len(files) - 1 && seperator) {
-      string[pos] = seperator;
-      pos++;
-    }
-	}
+// make room for `extra` more bytes plus the terminator. while the builder owns
+// the end of the arena it grows in place, otherwise it moves to the tail once.
+static void bh_sb_grow(bh_sb_t *sb, size_t extra)
+{
+  size_t need = sb->len + extra + 1;
+  if (need <= sb->cap) return;
 
-	string[pos] = '\0';
+  bh_arena_t *arena = sb->arena;
 
-	return string;
+  if (sb->data + sb->cap == arena->buffer + arena->offset) {
+    bh_arena_alloc(arena, need - sb->cap);
+  } else {
+    char *data = (char *)bh_arena_alloc(arena, need);
+    memcpy(data, sb->data, sb->len);
+    sb->data = data;
+  }
+
+  sb->cap = need;
 }
 
-bool bh_files_get(const char *path, bh_files_t *files)
+void bh_sb_append_sv(bh_sb_t *sb, bh_sv_t sv)
 {
-  bh_path_kind_t kind = bh_path_exist(path);
-  if (kind == is_none || kind == is_file) {
-    bh_log(3, "expected directory path.\n");
-    return false;
+  bh_sb_grow(sb, sv.len);
+  memcpy(sb->data + sb->len, sv.data, sv.len);
+  sb->len += sv.len;
+}
+
+void bh_sb_append(bh_sb_t *sb, const char *s)
+{
+  bh_sb_append_sv(sb, bh_sv_from_cstr(s));
+}
+
+void bh_sb_append_char(bh_sb_t *sb, char ch)
+{
+  bh_sb_grow(sb, 1);
+  sb->data[sb->len++] = ch;
+}
+
+void bh_sb_appendf(bh_sb_t *sb, const char *fmt, ...)
+{
+  // claim the whole free tail so the common case formats exactly once
+  bh_sb_grow(sb, 0);
+
+  bh_arena_t *arena = sb->arena;
+  bool at_tail = sb->data + sb->cap == arena->buffer + arena->offset;
+  size_t room = sb->cap - sb->len + (at_tail ? arena->size - arena->offset : 0);
+
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(sb->data + sb->len, room, fmt, ap);
+  va_end(ap);
+
+  if (n < 0) return;
+
+  if ((size_t)n < room) {
+    bh_sb_grow(sb, (size_t)n);
+    sb->len += (size_t)n;
+    return;
   }
 
-	bool has_slash = false;
-	char slash = bh_string_chop(path, strlen(path) - 1, strlen(path))[0];
+  bh_sb_grow(sb, (size_t)n);
 
-	if (slash == '/' || slash == '\\')
-		has_slash = true;
+  va_start(ap, fmt);
+  vsnprintf(sb->data + sb->len, (size_t)n + 1, fmt, ap);
+  va_end(ap);
 
-	DIR *dir = opendir(path);
-	if (dir == NULL) {
-    bh_log(3, bh_fmt("failed to open directory, `%s`.\n", path));
-    return false;
+  sb->len += (size_t)n;
+}
+
+void bh_sb_append_files(bh_sb_t *sb, bh_files_t *files, const unsigned char seperator)
+{
+  for (size_t i = 0; i < bh_darray_len(files); ++i) {
+    if (i && seperator) bh_sb_append_char(sb, seperator);
+    bh_sb_append(sb, files->items[i]);
   }
+}
 
-	struct dirent *data;
-	while ((data = readdir(dir)) != NULL)
-	{
+char *bh_sb_finish(bh_sb_t *sb)
+{
+  bh_sb_grow(sb, 0);
+  sb->data[sb->len] = '\0';
 
-#if __UNIX__
-		if (data->d_type != DT_DIR)
-		{
-			char *fileName = data->d_name;
-			char *item = NULL;
-			if (has_slash) {
-        item = bh_fmt((char *)"%s%s", path, fileName);
-      }
-			else {
-        item = bh_fmt((char *)"%s/%s", path, fileName);
+  char *result = sb->data;
+  bh_sb_init(sb, sb->arena);
+
+  return result;
+}
+
+bool bh_mkdir(const char *path)
+{
+  size_t size = strlen(path);
+  size_t pos = 0;
+
+  // `mkdir a`, `mkdir a/b`, ... for every missing prefix
+  for (size_t i = 0; i <= size; ++i) {
+    if (i < size && path[i] != '/') continue;
+
+    if (i > pos) {
+      bh_sb_t command;
+      bh_sb_init(&command, build_arena);
+      bh_sb_append(&command, "mkdir ");
+      bh_sb_append_sv(&command, bh_sv_from_parts(path, i));
+
+      char *final_dir_path = bh_sb_finish(&command);
+      if (bh_path_exist(final_dir_path + 6) != is_dir) {
+        if (!bh_execute(final_dir_path)) return false;
       }
+    }
+
+    pos = i + 1;
+  }
+
+  return true;
+}
+
+bh_path_kind_t bh_path_exist(const char *path)
+{
+  bh_path_kind_t kind = is_none;
+
+#if __UNIX__
+  struct stat bf;
+
+  if (stat(path, &bf)) {
+    return kind;
+  }
+
+  if (S_ISREG(bf.st_mode)) kind = is_file;
+  else if (S_ISDIR(bf.st_mode)) kind = is_dir;
 
-      bh_darray_push(files, item);
-		}
 #elif __WIN32__
-		if (data->d_ino != ENOTDIR && (strcmp(data->d_name, ".") && strcmp(data->d_name, "..")))
-		{
-			char *fileName = data->d_name;
-			char *item = NULL;
-			if (has_slash) {
-        item = bh_fmt((char *)"%s%s", path, fileName);
-      }
-			else {
-        item = bh_fmt((char *)"%s/%s", path, fileName);
-      }
+  DWORD attrib = GetFileAttributes(path);
+  if (attrib == INVALID_FILE_ATTRIBUTES)
+    return kind;
+
+  if (attrib & FILE_ATTRIBUTE_DIRECTORY)
+    kind = is_dir;
+  else
+    kind = is_file;
 
-      bh_darray_push(files, item);
-		}
 #endif
-	}
 
-  return true;
+  return kind;
 }
 
-bool bh_recursive_files_get(const char *path, bh_files_t *files)
+#ifndef DT_DIR
+#define DT_UNKNOWN 0
+#define DT_DIR 4
+#define DT_REG 8
+#endif
+
+static char *bh_read_all(const char *path, size_t *len);
+static bool bh_file_replace(const char *tmp, const char *path);
+
+// one directory as it was read: `count` entries of { d_type, name, NUL }
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtime;          // nanoseconds, a changed directory has a newer one
+  uint32_t count;
+  uint32_t size;
+  char *data;
+  bool owned;             // malloc'd, otherwise it points into the loaded file
+} bh_dir_listing_t;
+
+// listings of the directories walked by previous runs, kept in
+// BUILD_DIR_CACHE. only one thread uses it, the others read the disk.
+typedef struct {
+  bool loaded;
+  bool dirty;
+  char *file;
+  bh_intern_t paths;
+  bh_dir_listing_t *listings;
+  size_t listings_size;
+} bh_dircache_t;
+
+static bh_dircache_t build_dircache;
+static atomic_bool bh_dircache_claimed;
+static _Thread_local bool bh_dircache_owner;
+
+static bool bh_dircache_usable(void)
+{
+  if (bh_dircache_owner) return true;
+
+  bool expected = false;
+  return bh_dircache_owner = atomic_compare_exchange_strong(&bh_dircache_claimed, &expected, true);
+}
+
+static bh_dir_listing_t *bh_dircache_slot(const char *path, size_t len)
+{
+  bh_str_id id = bh_intern_n(&build_dircache.paths, path, len);
+
+  if (id >= build_dircache.listings_size) {
+    size_t size = build_dircache.listings_size ? build_dircache.listings_size : 64;
+    while (size <= id) size *= 2;
+
+    build_dircache.listings = (bh_dir_listing_t *)realloc(build_dircache.listings, size * sizeof(bh_dir_listing_t));
+    memset(build_dircache.listings + build_dircache.listings_size, 0, (size - build_dircache.listings_size) * sizeof(bh_dir_listing_t));
+    build_dircache.listings_size = size;
+  }
+
+  return &build_dircache.listings[id];
+}
+
+#define BH_DIRCACHE_MAGIC "bhdirs1\n"
+
+// listing calls only mark the cache dirty, it is written once at exit.
+// forked children inherit the hook but leave the file to their parent
+static pid_t bh_dircache_pid;
+static void bh_dircache_at_exit(void);
+
+// records are { u32 path length, path, dev, ino, mtime, count, size, data },
+// and the data is used where it lies
+static void bh_dircache_load(void)
+{
+  if (build_dircache.loaded) return;
+  build_dircache.loaded = true;
+  bh_dircache_pid = getpid();
+  atexit(bh_dircache_at_exit);
+
+  size_t len;
+  char *file = bh_read_all(BUILD_DIR_CACHE, &len);
+  if (!file) return;
+
+  size_t magic = sizeof(BH_DIRCACHE_MAGIC) - 1;
+  if (len < magic || memcmp(file, BH_DIRCACHE_MAGIC, magic)) {
+    free(file);
+    return;
+  }
+
+  build_dircache.file = file;
+  size_t pos = magic;
+  while (pos + 4 <= len) {
+    uint32_t path_len;
+    memcpy(&path_len, file + pos, 4);
+    if (len - pos - 4 < (size_t)path_len + 32) break;
+
+    bh_dir_listing_t listing = { 0 };
+    const char *path = file + pos + 4;
+    const char *header = path + path_len;
+    memcpy(&listing.dev, header, 8);
+    memcpy(&listing.ino, header + 8, 8);
+    memcpy(&listing.mtime, header + 16, 8);
+    memcpy(&listing.count, header + 24, 4);
+    memcpy(&listing.size, header + 28, 4);
+
+    pos += 4 + path_len + 32;
+    if (len - pos < listing.size) break;
+
+    listing.data = file + pos;
+    pos += listing.size;
+    *bh_dircache_slot(path, path_len) = listing;
+  }
+}
+
+static bool bh_dircache_write(void)
 {
-  bh_path_kind_t kind = bh_path_exist(path);
-  if (kind == is_none || kind == is_file) {
-    bh_log(3, "expected directory path.\n");
+  if (!build_dircache.dirty) return true;
+
+  bh_mkdir(".build_cache");
+  const char *tmp = BUILD_DIR_CACHE ".tmp";
+  FILE *fp = fopen(tmp, "wb");
+  if (!fp) {
+    bh_logf(BH_LOG_ERROR, "failed to open files, `%s`.\n", tmp);
+    return false;
+  }
+
+  fputs(BH_DIRCACHE_MAGIC, fp);
+  for (size_t id = 0; id < build_dircache.paths.count; ++id) {
+    bh_dir_listing_t *listing = &build_dircache.listings[id];
+    if (!listing->data) continue;
+
+    uint32_t path_len = (uint32_t)bh_intern_len(&build_dircache.paths, id);
+    fwrite(&path_len, 4, 1, fp);
+    fwrite(bh_intern_str(&build_dircache.paths, id), 1, path_len, fp);
+    fwrite(&listing->dev, 8, 1, fp);
+    fwrite(&listing->ino, 8, 1, fp);
+    fwrite(&listing->mtime, 8, 1, fp);
+    fwrite(&listing->count, 4, 1, fp);
+    fwrite(&listing->size, 4, 1, fp);
+    fwrite(listing->data, 1, listing->size, fp);
+  }
+
+  if (fclose(fp) != 0 || !bh_file_replace(tmp, BUILD_DIR_CACHE)) {
+    bh_logf(BH_LOG_ERROR, "failed to write `%s`.\n", BUILD_DIR_CACHE);
     return false;
   }
 
-	bool has_slash = false;
-	char slash = bh_string_chop(path, strlen(path) - 1, strlen(path))[0];
+  build_dircache.dirty = false;
+  return true;
+}
+
+bool bh_dircache_flush(void)
+{
+  return !bh_dircache_owner || bh_dircache_write();
+}
+
+static void bh_dircache_at_exit(void)
+{
+  if (getpid() == bh_dircache_pid) bh_dircache_write();
+}
+
+static void bh_dir_listing_add(bh_dir_listing_t *listing, size_t *capacity, unsigned char type, const char *name)
+{
+  size_t len = strlen(name) + 2;
+  if (listing->size + len > *capacity) {
+    while (listing->size + len > *capacity) *capacity = *capacity ? *capacity * 2 : 4096;
+    listing->data = (char *)realloc(listing->data, *capacity);
+  }
+
+  listing->data[listing->size] = (char)type;
+  memcpy(listing->data + listing->size + 1, name, len - 1);
+  listing->size += len;
+  listing->count++;
+}
+
+#if __linux__
+// what getdents64 fills in, glibc doesn't declare it
+struct bh_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
 
-	if (slash == '/' || slash == '\\')
-		has_slash = true;
+// reads `path` into a malloc'd listing, with getdents64 on linux so a
+// directory of a few thousand entries is one or two syscalls
+static bool bh_dir_read(const char *path, bh_dir_listing_t *listing)
+{
+  size_t capacity = 0;
+  *listing = (bh_dir_listing_t){ .owned = true };
+
+#if __linux__
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  char buffer[64 * 1024];
+  long n;
+  while ((n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+    for (long pos = 0; pos < n;) {
+      struct bh_dirent64 *entry = (struct bh_dirent64 *)(buffer + pos);
+      unsigned char type = entry->d_type;
+
+      // some filesystems don't fill in the type
+      struct stat st;
+      if (type == DT_UNKNOWN && fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+
+      bh_dir_listing_add(listing, &capacity, type, entry->d_name);
+      pos += entry->d_reclen;
+    }
+  }
 
-	DIR *dir = opendir(path);
-	if (dir == NULL) {
-    bh_log(3, bh_fmt("failed to open directory, `%s`.\n", path));
+  close(fd);
+  if (n < 0) {
+    free(listing->data);
+    listing->data = NULL;
     return false;
   }
+#else
+  DIR *dir = opendir(path);
+  if (dir == NULL) return false;
+
+  struct dirent *data;
+  while ((data = readdir(dir)) != NULL) {
+#if __UNIX__
+    unsigned char type = data->d_type;
+#elif __WIN32__
+    unsigned char type = DT_REG;
+    if (!strcmp(data->d_name, ".") || !strcmp(data->d_name, "..") ||
+      bh_path_exist(bh_fmt("%s/%s", path, data->d_name)) == is_dir)
+      type = DT_DIR;
+#endif
+    bh_dir_listing_add(listing, &capacity, type, data->d_name);
+  }
 
-	struct dirent *data;
-	while ((data = readdir(dir)) != NULL)
-	{
+  closedir(dir);
+#endif
+
+  return true;
+}
+
+// the entries of `path`, from the cache when the directory's inode and
+// mtime didn't change. cached data stays valid until `path` is read again.
+static bool bh_dir_list(const char *path, bh_dir_listing_t *listing)
+{
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
 
 #if __UNIX__
-    if (data->d_type == DT_DIR) {
-      if (strncmp(data->d_name, ".", 1) && strncmp(data->d_name, "..", 2)) {
-        const char *npath = (has_slash) ? bh_fmt("%s%s", path, data->d_name) :
-          bh_fmt("%s/%s", path, data->d_name);
-        if (!bh_recursive_files_get(npath, files))
-          return false;
-      }
-    }
+  int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
 #elif __WIN32__
-    if (data->d_ino == EISDIR) {
-      if (strncmp(data->d_name, ".", 1) && strncmp(data->d_name, "..", 2)) {
-        const char *npath = (has_slash) ? bh_fmt("%s%s", path, data->d_name) :
-          bh_fmt("%s/%s", path, data->d_name);
-        if (!bh_recursive_files_get(npath, files))
-          return false;
-      }
-    }
+  int64_t mtime = (int64_t)st.st_mtime * 1000000000;
 #endif
-    else {
-      char *fileName = data->d_name;
-      char *item = NULL;
-      if (has_slash) {
-        item = bh_fmt((char *)"%s%s", path, fileName);
-      }
-      else {
-        item = bh_fmt((char *)"%s/%s", path, fileName);
-      }
 
-      bh_darray_push(files, item);
+  bh_dir_listing_t *slot = NULL;
+  if (bh_dircache_usable()) {
+    bh_dircache_load();
+    slot = bh_dircache_slot(path, strlen(path));
+    if (slot->data && slot->dev == (uint64_t)st.st_dev && slot->ino == (uint64_t)st.st_ino && slot->mtime == mtime) {
+      *listing = *slot;
+      listing->owned = false;
+      return true;
     }
-	}
+  }
+
+  if (!bh_dir_read(path, listing)) return false;
+
+  // a directory changed within the mtime granularity could change again
+  // without its mtime moving, so it is only cached once it is a second old
+  if (slot && time(NULL) > st.st_mtime + 1) {
+    if (slot->owned) free(slot->data);
+    listing->dev = (uint64_t)st.st_dev;
+    listing->ino = (uint64_t)st.st_ino;
+    listing->mtime = mtime;
+    *slot = *listing;
+    listing->owned = false;
+    build_dircache.dirty = true;
+  }
+
+  return true;
+}
+
+static void bh_dir_listing_free(bh_dir_listing_t *listing)
+{
+  if (listing->owned) free(listing->data);
+}
+
+static bool bh_dir_error(const char *path)
+{
+  if (bh_path_exist(path) != is_dir)
+    bh_log(BH_LOG_ERROR, "expected directory path.\n");
+  else
+    bh_logf(BH_LOG_ERROR, "failed to open directory, `%s`.\n", path);
+  return false;
+}
+
+#define bh_dir_listing_foreach(listing, type, name, body) do {           \
+  const char *bh_entry_ = (listing)->data;                               \
+  for (uint32_t bh_i_ = 0; bh_i_ < (listing)->count; ++bh_i_) {         \
+    unsigned char type = (unsigned char)bh_entry_[0];                    \
+    const char *name = bh_entry_ + 1;                                    \
+    bh_entry_ = name + strlen(name) + 1;                                 \
+    body;                                                                \
+  }                                                                      \
+} while (0)
+
+bool bh_dir_get(const char *path, bh_files_t *dirs)
+{
+  bh_dir_listing_t listing;
+  if (!bh_dir_list(path, &listing)) return bh_dir_error(path);
+
+  char slash = path[strlen(path) - 1];
+  if (slash != '/' && slash != '\\')
+#if __UNIX__
+    slash = '/';
+#elif __WIN32__
+    slash = '\\';
+#endif
+
+  bh_dir_listing_foreach(&listing, type, name, {
+#if __WIN32__
+    if (!strcmp(name, "..") || !strcmp(name, ".")) continue;
+#endif
+    if (type == DT_DIR) {
+      char *next_path = bh_fmt("%s%c%s", path, slash, name);
+      bh_darray_push(dirs, next_path);
+    }
+  });
+
+  bh_dir_listing_free(&listing);
+  return true;
+}
+
+// `path` + separator + `name`, interned when `build_intern` is set
+static char *bh_path_item(const char *path, bool has_slash, const char *name)
+{
+  if (build_intern) {
+    char buffer[PATH_MAX];
+    int len = snprintf(buffer, sizeof(buffer), has_slash ? "%s%s" : "%s/%s", path, name);
+
+    if (len > 0 && (size_t)len < sizeof(buffer))
+      return (char *)bh_intern_str(build_intern, bh_intern_n(build_intern, buffer, len));
+  }
+
+  if (has_slash) return bh_fmt((char *)"%s%s", path, name);
+  return bh_fmt((char *)"%s/%s", path, name);
+}
+
+char *bh_files_to_string(bh_files_t *files, const unsigned char seperator)
+{
+	size_t total_size_of_string = 1;
+
+	for (size_t i = 0; i < bh_darray_len(files); ++i)
+  {
+		total_size_of_string += strlen(files->items[i]);
+    if (i != bh_darray_len(files) - 1 && seperator) {
+      total_size_of_string++;
+    }
+  }
+
+	char *string = (char *)malloc(total_size_of_string);
+  if (!string) return NULL;
+
+	size_t pos = 0;
+	for (size_t i = 0; i < bh_darray_len(files); ++i)
+	{
+    size_t len = strlen(files->items[i]);
+    memcpy(string + pos, files->items[i], len);
+    pos += len;
+
+    if (i != bh_darray_len(files) - 1 && seperator) {
+      string[pos] = seperator;
+      pos++;
+    }
+	}
+
+	string[pos] = '\0';
+
+	return string;
+}
+
+char *bh_files_to_string_arena(bh_arena_t *arena, bh_files_t *files, const unsigned char seperator)
+{
+  bh_sb_t sb;
+  bh_sb_init(&sb, arena);
+  bh_sb_append_files(&sb, files, seperator);
+
+  return bh_sb_finish(&sb);
+}
+
+bool bh_files_get(const char *path, bh_files_t *files)
+{
+  bh_dir_listing_t listing;
+  if (!bh_dir_list(path, &listing)) return bh_dir_error(path);
+
+	char slash = path[strlen(path) - 1];
+	bool has_slash = slash == '/' || slash == '\\';
+
+  bh_dir_listing_foreach(&listing, type, name, {
+    if (type != DT_DIR) {
+      char *item = bh_path_item(path, has_slash, name);
+      bh_darray_push(files, item);
+    }
+  });
+
+  bh_dir_listing_free(&listing);
+  return true;
+}
+
+static bool bh_files_walk(const char *path, bh_files_t *files)
+{
+  bh_dir_listing_t listing;
+  if (!bh_dir_list(path, &listing)) return bh_dir_error(path);
+
+	char slash = path[strlen(path) - 1];
+	bool has_slash = slash == '/' || slash == '\\';
+
+  bool ok = true;
+  bh_dir_listing_foreach(&listing, type, name, {
+    if (type != DT_DIR) {
+      char *item = bh_path_item(path, has_slash, name);
+      bh_darray_push(files, item);
+    } else if (name[0] != '.') {
+      // hidden directories, `.` and `..` are skipped
+      const char *npath = has_slash ? bh_fmt("%s%s", path, name) : bh_fmt("%s/%s", path, name);
+      if (!(ok = bh_files_walk(npath, files))) break;
+    }
+  });
+
+  bh_dir_listing_free(&listing);
+  return ok;
+}
+
+bool bh_recursive_files_get(const char *path, bh_files_t *files)
+{
+  return bh_files_walk(path, files);
+}
+
+char *bh_file_read(const char *path)
+{
+	FILE *fp;
+	long len;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+    bh_logf(BH_LOG_ERROR, "failed to open files, `%s`.\n", path);
+		return NULL;
+	}
+
+	fseek(fp, 0L, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0L, SEEK_SET);
+
+	char *buffer = (char*)bh_arena_alloc(build_arena, len + 1);
+	if (buffer == NULL) {
+    bh_logf(BH_LOG_ERROR, "failed to allocate memory.\n");
+    return NULL;
+  }
+
+	fread(buffer, 1, len, fp);
+	buffer[len] = 0;
+	fclose(fp);
+
+	return buffer;
+}
+
+bool bh_file_write(const char *path, const char *buffer, size_t size)
+{
+	FILE *fp;
+
+  bh_try {
+    fp = fopen(path, "wb");
+    bh_uthrow(fp, bh_FileNotFoundError);
+  } bh_catch(bh_FileNotFoundError) {
+    bh_logf(BH_LOG_ERROR, "failed to open files, `%s`.\n", path);
+		return false;
+  }
+
+	size_t total_size_written = fwrite(buffer, sizeof(char), size, fp);
+  if (total_size_written != size) {
+    bh_logf(BH_LOG_ERROR, "Failed to write complete file `%s`.\n", path);
+    fclose(fp);
+    return false;
+  }
+
+  if (fflush(fp) != 0) {
+    bh_logf(BH_LOG_ERROR, "failed to flush data to file `%s`.\n", path);
+    fclose(fp);
+    return false;
+  }
+
+  if (fclose(fp) != 0) {
+    bh_logf(BH_LOG_ERROR, "failed to properly close file `%s`.\n", path);
+    return false;
+  }
+
+	return true;
+}
+
+static int64_t bh_stat_mtime_ns(const char *path)
+{
+  struct stat bf;
+  if (stat(path, &bf)) return -1;
+
+#if __linux__
+  return (int64_t)bf.st_mtim.tv_sec * 1000000000 + bf.st_mtim.tv_nsec;
+#elif __APPLE__
+  return (int64_t)bf.st_mtimespec.tv_sec * 1000000000 + bf.st_mtimespec.tv_nsec;
+#else
+  return (int64_t)bf.st_mtime * 1000000000;
+#endif
+}
+
+// batched metadata and reads. with --io-uring (or bh_io_uring_use) these go
+// through an io_uring when the kernel allows one (5.6+, not blocked by
+// seccomp), which turns a no-op check of a big graph on a network filesystem
+// from thousands of stat round trips into a few submissions. on a local disk
+// with a warm cache the kernel hands each statx to a worker thread, which is
+// slower than plain stat, hence opt-in. whatever fails in the ring is retried
+// synchronously.
+#if __linux__ && BUILD_IO_URING
+typedef struct {
+  int fd;
+  unsigned entries;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+} bh_uring_t;
+
+// one ring per thread, set up on first use
+static _Thread_local bh_uring_t build_uring;
+static _Thread_local int bh_uring_state;    // 0 not set up yet, 1 ready, -1 unavailable
+static bool bh_uring_disabled = true;
+
+static bool bh_uring_setup(void)
+{
+  if (bh_uring_disabled) return false;
+  if (bh_uring_state) return bh_uring_state > 0;
+  bh_uring_state = -1;
+
+  struct io_uring_params params = { 0 };
+  int fd = (int)syscall(__NR_io_uring_setup, BUILD_IO_URING_DEPTH, &params);
+  if (fd < 0) return false;
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_size > sq_size) sq_size = cq_size;
+    cq_size = sq_size;
+  }
+
+  char *sq = (char *)mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  char *cq = sq;
+  if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+    cq = (char *)mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  build_uring = (bh_uring_t){
+    .fd = fd,
+    .entries = params.sq_entries,
+    .sq_head = (unsigned *)(sq + params.sq_off.head),
+    .sq_tail = (unsigned *)(sq + params.sq_off.tail),
+    .sq_mask = (unsigned *)(sq + params.sq_off.ring_mask),
+    .sq_array = (unsigned *)(sq + params.sq_off.array),
+    .cq_head = (unsigned *)(cq + params.cq_off.head),
+    .cq_tail = (unsigned *)(cq + params.cq_off.tail),
+    .cq_mask = (unsigned *)(cq + params.cq_off.ring_mask),
+    .sqes = (struct io_uring_sqe *)sqes,
+    .cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes),
+  };
+
+  bh_uring_state = 1;
+  return true;
+}
+
+// runs `count` prepared requests, at most a ring's worth at a time, and
+// stores each result (a syscall return value, -errno) at its index
+static bool bh_uring_run(struct io_uring_sqe *requests, int32_t *results, size_t count)
+{
+  if (!bh_uring_setup()) return false;
+
+  bh_uring_t *ring = &build_uring;
+  for (size_t done = 0; done < count;) {
+    unsigned batch = count - done < ring->entries ? (unsigned)(count - done) : ring->entries;
+
+    unsigned tail = *ring->sq_tail;
+    for (unsigned i = 0; i < batch; ++i) {
+      unsigned index = (tail + i) & *ring->sq_mask;
+      ring->sqes[index] = requests[done + i];
+      ring->sqes[index].user_data = done + i;
+      ring->sq_array[index] = index;
+    }
+    __atomic_store_n(ring->sq_tail, tail + batch, __ATOMIC_RELEASE);
+
+    for (unsigned submitted = 0, reaped = 0; reaped < batch;) {
+      int n = (int)syscall(__NR_io_uring_enter, ring->fd, batch - submitted, batch - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (n < 0 && errno != EINTR) {
+        bh_uring_state = -1;
+        return false;
+      }
+      if (n > 0) submitted += n;
+
+      unsigned head = *ring->cq_head;
+      unsigned end = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != end; ++head, ++reaped) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        results[cqe->user_data] = cqe->res;
+      }
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    done += batch;
+  }
+
+  return true;
+}
+
+static struct io_uring_sqe bh_uring_prep(int op, int fd, const void *addr, unsigned len, uint64_t off)
+{
+  return (struct io_uring_sqe){ .opcode = (uint8_t)op, .fd = fd, .addr = (uint64_t)(uintptr_t)addr, .len = len, .off = off };
+}
+#endif
+
+bool bh_io_uring_use(bool enabled)
+{
+#if __linux__ && BUILD_IO_URING
+  bh_uring_disabled = !enabled;
+  return bh_uring_setup();
+#else
+  (void)enabled;
+  return false;
+#endif
+}
+
+void bh_stat_many(const char **paths, size_t count, int64_t *mtimes)
+{
+  size_t done = 0;
+
+#if __linux__ && BUILD_IO_URING
+  struct io_uring_sqe *requests = (struct io_uring_sqe *)malloc(count * sizeof(struct io_uring_sqe) + 1);
+  struct statx *stats = (struct statx *)malloc(count * sizeof(struct statx) + 1);
+  int32_t *results = (int32_t *)malloc(count * sizeof(int32_t) + 1);
+
+  for (size_t i = 0; i < count; ++i)
+    requests[i] = bh_uring_prep(IORING_OP_STATX, AT_FDCWD, paths[i], STATX_MTIME, (uint64_t)(uintptr_t)&stats[i]);
+
+  if (count && bh_uring_run(requests, results, count)) {
+    for (size_t i = 0; i < count; ++i) {
+      if (results[i] == 0)
+        mtimes[i] = (int64_t)stats[i].stx_mtime.tv_sec * 1000000000 + stats[i].stx_mtime.tv_nsec;
+      else if (results[i] == -ENOENT || results[i] == -ENOTDIR)
+        mtimes[i] = -1;
+      else
+        mtimes[i] = bh_stat_mtime_ns(paths[i]);
+    }
+    done = count;
+  }
+
+  free(requests);
+  free(stats);
+  free(results);
+#endif
+
+  for (size_t i = done; i < count; ++i)
+    mtimes[i] = bh_stat_mtime_ns(paths[i]);
+}
+
+void bh_read_many(const char **paths, size_t count, char **data, size_t *lens)
+{
+  size_t done = 0;
+
+#if __linux__ && BUILD_IO_URING
+  // open and size every file, then read them all, then close them all
+  struct io_uring_sqe *requests = (struct io_uring_sqe *)malloc(2 * count * sizeof(struct io_uring_sqe) + 1);
+  struct statx *stats = (struct statx *)malloc(count * sizeof(struct statx) + 1);
+  int32_t *results = (int32_t *)malloc(2 * count * sizeof(int32_t) + 1);
+  int *fds = (int *)malloc(count * sizeof(int) + 1);
+
+  for (size_t i = 0; i < count; ++i) {
+    requests[2 * i] = bh_uring_prep(IORING_OP_OPENAT, AT_FDCWD, paths[i], 0, 0);
+    requests[2 * i].open_flags = O_RDONLY | O_CLOEXEC;
+    requests[2 * i + 1] = bh_uring_prep(IORING_OP_STATX, AT_FDCWD, paths[i], STATX_SIZE, (uint64_t)(uintptr_t)&stats[i]);
+  }
+
+  if (count && bh_uring_run(requests, results, 2 * count)) {
+    size_t reads = 0;
+    for (size_t i = 0; i < count; ++i) {
+      fds[i] = results[2 * i];
+      data[i] = NULL;
+      lens[i] = 0;
+      if (fds[i] < 0 || results[2 * i + 1] < 0) continue;
+
+      lens[i] = (size_t)stats[i].stx_size;
+      data[i] = (char *)malloc(lens[i] + 1);
+      requests[reads++] = bh_uring_prep(IORING_OP_READ, fds[i], data[i], (unsigned)lens[i], 0);
+    }
+
+    bool ok = !reads || bh_uring_run(requests, results, reads);
+    for (size_t i = 0, r = 0; i < count; ++i) {
+      if (!data[i]) continue;
+
+      // short reads (and a ring that went away) finish synchronously
+      ssize_t got = ok ? results[r] : 0;
+      r++;
+      if (got < 0) got = 0;
+      while ((size_t)got < lens[i]) {
+        ssize_t n = pread(fds[i], data[i] + got, lens[i] - got, got);
+        if (n <= 0) break;
+        got += n;
+      }
+      lens[i] = (size_t)got;
+      data[i][got] = 0;
+    }
+
+    size_t closes = 0;
+    for (size_t i = 0; i < count; ++i)
+      if (fds[i] >= 0) requests[closes++] = bh_uring_prep(IORING_OP_CLOSE, fds[i], NULL, 0, 0);
+    if (closes && !bh_uring_run(requests, results, closes)) {
+      for (size_t i = 0; i < count; ++i)
+        if (fds[i] >= 0) close(fds[i]);
+    }
+
+    // whatever the ring refused is read the usual way
+    for (size_t i = 0; i < count; ++i) {
+      if (!data[i] && fds[i] != -ENOENT)
+        data[i] = bh_read_all(paths[i], &lens[i]);
+    }
+    done = count;
+  }
+
+  free(requests);
+  free(stats);
+  free(results);
+  free(fds);
+#endif
+
+  for (size_t i = done; i < count; ++i)
+    data[i] = bh_read_all(paths[i], &lens[i]);
+}
+
+time_t bh_file_get_time(const char *path)
+{
+	struct stat file_stat;
+	if (stat(path, &file_stat) == -1) {
+		perror(bh_fmt("Failed to get file status: %s, ", path));
+		return (time_t)(-1);  // Return -1 on error
+	}
+
+	return file_stat.st_mtime;
+}
+
+char *bh_string_join(const char *f, const char *s)
+{
+  return bh_string_join_arena(build_arena, f, s);
+}
+
+char *bh_string_join_arena(bh_arena_t *arena, const char *f, const char *s)
+{
+  size_t f_size = strlen(f);
+  size_t s_size = strlen(s);
+  char *new_string = (char *)bh_arena_alloc(arena, f_size + s_size + 1);
+
+  memcpy(new_string, f, f_size);
+  memcpy(new_string + f_size, s, s_size);
+  new_string[f_size + s_size] = '\0';
+
+  return new_string;
+}
+
+char *bh_string_chop(const char *s, size_t from, size_t to)
+{
+  return bh_string_chop_arena(build_arena, s, from, to);
+}
+
+char *bh_string_chop_arena(bh_arena_t *arena, const char *s, size_t from, size_t to)
+{
+	if (from >= to) return NULL;
+
+	char *sub = (char *)bh_arena_alloc(arena, (to - from) + 1);
+  memcpy(sub, s + from, to - from);
+	sub[(to - from)] = '\0';
+
+	return sub;
+}
+
+// byte scanning kernels, `set` holds up to 16 bytes. returns the index of the
+// first byte whose membership in `set` equals `in`, or `len` if there is none.
+static void bh_scan_table(bool table[256], const char *set, size_t n)
+{
+  memset(table, 0, 256 * sizeof(bool));
+  for (size_t k = 0; k < n; ++k)
+    table[(unsigned char)set[k]] = true;
+}
+
+static size_t bh_scan_scalar(const char *data, size_t len, const char *set, size_t n, bool in)
+{
+  if (n == 1 && in) {
+    const char *at = len ? (const char *)memchr(data, set[0], len) : NULL;
+    return at ? (size_t)(at - data) : len;
+  }
+
+  // short tails of the vector kernels aren't worth a table
+  if (len < 64) {
+    for (size_t i = 0; i < len; ++i) {
+      bool hit = false;
+      for (size_t k = 0; k < n; ++k)
+        hit |= data[i] == set[k];
+
+      if (hit == in) return i;
+    }
+    return len;
+  }
+
+  bool table[256];
+  bh_scan_table(table, set, n);
+  for (size_t i = 0; i < len; ++i)
+    if (table[(unsigned char)data[i]] == in) return i;
+
+  return len;
+}
+
+#if BH_X86_SIMD
+__attribute__((target("sse2")))
+static size_t bh_scan_sse2(const char *data, size_t len, const char *set, size_t n, bool in)
+{
+  __m128i needles[16];
+  for (size_t k = 0; k < n; ++k)
+    needles[k] = _mm_set1_epi8(set[k]);
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i hit = _mm_setzero_si128();
+
+    for (size_t k = 0; k < n; ++k)
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[k]));
+
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+    if (!in) mask = ~mask & 0xffff;
+    if (mask) return i + __builtin_ctz(mask);
+  }
+
+  return i + bh_scan_scalar(data + i, len - i, set, n, in);
+}
+
+__attribute__((target("avx2")))
+static size_t bh_scan_avx2(const char *data, size_t len, const char *set, size_t n, bool in)
+{
+  __m256i needles[16];
+  for (size_t k = 0; k < n; ++k)
+    needles[k] = _mm256_set1_epi8(set[k]);
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i hit = _mm256_setzero_si256();
+
+    for (size_t k = 0; k < n; ++k)
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, needles[k]));
+
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+    if (!in) mask = ~mask;
+    if (mask) return i + __builtin_ctz(mask);
+  }
+
+  return i + bh_scan_scalar(data + i, len - i, set, n, in);
+}
+#endif
+
+typedef size_t (*bh_scan_fn)(const char *, size_t, const char *, size_t, bool);
+
+// set once, by the first scan or bh_simd_use, and read by every thread
+static _Atomic(bh_scan_fn) bh_scan_impl = NULL;
+
+bh_simd_t bh_simd_detect(void)
+{
+#if BH_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return BH_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2")) return BH_SIMD_SSE2;
+#endif
+  return BH_SIMD_SCALAR;
+}
+
+static bh_scan_fn bh_scan_pick(bh_simd_t *level)
+{
+  bh_simd_t detected = bh_simd_detect();
+  if (*level == BH_SIMD_NONE || *level > detected) *level = detected;
+
+  switch (*level) {
+#if BH_X86_SIMD
+    case BH_SIMD_AVX2: return bh_scan_avx2;
+    case BH_SIMD_SSE2: return bh_scan_sse2;
+#endif
+    default: *level = BH_SIMD_SCALAR; return bh_scan_scalar;
+  }
+}
+
+// the kernel is swapped without waiting for scans in flight, call it before
+// starting threads
+bh_simd_t bh_simd_use(bh_simd_t level)
+{
+  atomic_store(&bh_scan_impl, bh_scan_pick(&level));
+  return level;
+}
+
+static inline bh_scan_fn bh_scan_kernel(void)
+{
+  bh_scan_fn impl = atomic_load_explicit(&bh_scan_impl, memory_order_acquire);
+  if (impl) return impl;
+
+  // racing threads detect the same kernel, a bh_simd_use in between wins
+  bh_simd_t level = BH_SIMD_NONE;
+  bh_scan_fn expected = NULL;
+  impl = bh_scan_pick(&level);
+  if (!atomic_compare_exchange_strong(&bh_scan_impl, &expected, impl)) impl = expected;
+  return impl;
+}
+
+static inline size_t bh_scan(const char *data, size_t len, const char *set, size_t n, bool in)
+{
+  // memchr is vectorized already, and anything over 16 bytes has no kernel
+  if ((n == 1 && in) || n > 16) return bh_scan_scalar(data, len, set, n, in);
+  return bh_scan_kernel()(data, len, set, n, in);
+}
+
+// delete and replace call a scan per match, without vector kernels a single
+// table driven pass is cheaper
+static inline bool bh_scan_per_byte(size_t n)
+{
+  return n > 16 || (n > 1 && bh_scan_kernel() == bh_scan_scalar);
+}
+
+size_t bh_bytes_find(const char *data, size_t len, char ch)
+{
+  return bh_scan(data, len, &ch, 1, true);
+}
+
+size_t bh_bytes_find_any(const char *data, size_t len, const char *set)
+{
+  return bh_scan(data, len, set, strlen(set), true);
+}
+
+size_t bh_bytes_skip_any(const char *data, size_t len, const char *set)
+{
+  return bh_scan(data, len, set, strlen(set), false);
+}
+
+size_t bh_bytes_replace(char *data, size_t len, const char *set, char to)
+{
+  size_t n = strlen(set);
+  size_t replaced = 0;
+  size_t pos = 0;
+
+  if (bh_scan_per_byte(n)) {
+    bool table[256];
+    bh_scan_table(table, set, n);
+    for (size_t i = 0; i < len; ++i) {
+      if (table[(unsigned char)data[i]]) {
+        data[i] = to;
+        replaced++;
+      }
+    }
+    return replaced;
+  }
+
+  while (pos < len) {
+    pos += bh_scan(data + pos, len - pos, set, n, true);
+    if (pos >= len) break;
+
+    data[pos++] = to;
+    replaced++;
+  }
+
+  return replaced;
+}
+
+size_t bh_bytes_delete(char *data, size_t len, const char *set)
+{
+  size_t n = strlen(set);
+  size_t read = 0, write = 0;
+
+  if (bh_scan_per_byte(n)) {
+    bool table[256];
+    bh_scan_table(table, set, n);
+    for (; read < len; ++read) {
+      data[write] = data[read];
+      write += !table[(unsigned char)data[read]];
+    }
+    return write;
+  }
+
+  // move the runs between matches down, matches are usually sparse
+  while (read < len) {
+    size_t run = bh_scan(data + read, len - read, set, n, true);
+
+    if (write != read) memmove(data + write, data + read, run);
+    write += run;
+    read += run + 1;
+  }
+
+  return write;
+}
+
+// returns a malloc'd copy, `to == 0` removes `from`
+char *bh_string_replace_char(char *s, char from, char to)
+{
+  if (!s) return NULL;
+
+  size_t s_size = strlen(s);
+  char *copy = (char *)malloc(s_size + 1);
+  if (!copy) return NULL;
+
+  memcpy(copy, s, s_size + 1);
+
+  return bh_string_replace_char_inplace(copy, from, to);
+}
+
+char *bh_string_replace_char_inplace(char *s, char from, char to)
+{
+  if (!s || !from) return s;
+
+  char set[2] = { from, 0 };
+  size_t s_size = strlen(s);
+
+  if (to) bh_bytes_replace(s, s_size, set, to);
+  else s[bh_bytes_delete(s, s_size, set)] = '\0';
+
+  return s;
+}
+
+bool bh_string_to_array(bh_strings_t *strings, const char *string, const unsigned char seperator)
+{
+  return bh_string_to_array_arena(build_arena, strings, string, seperator);
+}
+
+bool bh_string_to_array_arena(bh_arena_t *arena, bh_strings_t *strings, const char *string, const unsigned char seperator)
+{
+  if (!string) return false;
+
+  bh_sv_t rest = bh_sv_from_cstr(string);
+  while (rest.len) {
+    bh_sv_t item = bh_sv_chop_by(&rest, seperator);
+    if (item.len) bh_darray_push(strings, bh_sv_to_cstr(arena, item));
+  }
+
+  return true;
+}
+
+bh_sv_t bh_sv_from_cstr(const char *s)
+{
+  return (bh_sv_t){ .data = s, .len = s ? strlen(s) : 0 };
+}
+
+bh_sv_t bh_sv_from_parts(const char *data, size_t len)
+{
+  return (bh_sv_t){ .data = data, .len = len };
+}
+
+#define BH_SPACES " \t\n\r\v\f"
+
+static inline bool bh_is_space(char ch)
+{
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+bh_sv_t bh_sv_trim_left(bh_sv_t sv)
+{
+  size_t i = bh_bytes_skip_any(sv.data, sv.len, BH_SPACES);
+  return bh_sv_from_parts(sv.data + i, sv.len - i);
+}
+
+bh_sv_t bh_sv_trim_right(bh_sv_t sv)
+{
+  size_t len = sv.len;
+  while (len > 0 && bh_is_space(sv.data[len - 1])) --len;
+  return bh_sv_from_parts(sv.data, len);
+}
+
+bh_sv_t bh_sv_trim(bh_sv_t sv)
+{
+  return bh_sv_trim_right(bh_sv_trim_left(sv));
+}
+
+bool bh_sv_find(bh_sv_t sv, char ch, size_t *index)
+{
+  size_t at = bh_bytes_find(sv.data, sv.len, ch);
+  if (at == sv.len) return false;
+
+  if (index) *index = at;
+  return true;
+}
+
+// returns everything before `delim` and advances `sv` past it
+bh_sv_t bh_sv_chop_by(bh_sv_t *sv, char delim)
+{
+  size_t index = 0;
+
+  if (!bh_sv_find(*sv, delim, &index)) {
+    bh_sv_t head = *sv;
+    sv->data += sv->len;
+    sv->len = 0;
+    return head;
+  }
+
+  bh_sv_t head = bh_sv_from_parts(sv->data, index);
+  sv->data += index + 1;
+  sv->len -= index + 1;
+
+  return head;
+}
+
+// returns the next whitespace separated word and advances `sv` past it
+bh_sv_t bh_sv_chop_word(bh_sv_t *sv)
+{
+  *sv = bh_sv_trim_left(*sv);
+
+  size_t i = bh_bytes_find_any(sv->data, sv->len, BH_SPACES);
+
+  bh_sv_t word = bh_sv_from_parts(sv->data, i);
+  sv->data += i;
+  sv->len -= i;
+
+  return word;
+}
+
+bool bh_sv_split(bh_sv_t sv, char delim, bh_svs_t *out)
+{
+  if (!out) return false;
+
+  while (sv.len) {
+    bh_sv_t item = bh_sv_chop_by(&sv, delim);
+    if (item.len) bh_darray_push(out, item);
+  }
+
+  return true;
+}
+
+bool bh_sv_eq(bh_sv_t a, bh_sv_t b)
+{
+  return a.len == b.len && (a.len == 0 || !memcmp(a.data, b.data, a.len));
+}
+
+bool bh_sv_starts_with(bh_sv_t sv, bh_sv_t prefix)
+{
+  return sv.len >= prefix.len && !memcmp(sv.data, prefix.data, prefix.len);
+}
+
+bool bh_sv_ends_with(bh_sv_t sv, bh_sv_t suffix)
+{
+  return sv.len >= suffix.len && !memcmp(sv.data + sv.len - suffix.len, suffix.data, suffix.len);
+}
+
+// copies as much of `sv` as fits below `size`, starting at `pos`
+static inline void bh_sv_copy_clamped(char *buffer, size_t size, size_t pos, bh_sv_t sv)
+{
+  if (pos + 1 >= size) return;
+
+  size_t n = size - 1 - pos;
+  memcpy(buffer + pos, sv.data, sv.len < n ? sv.len : n);
+}
+
+// joins into `buffer` like snprintf: writes at most `size` bytes (NUL included)
+// and returns the length the full result needs.
+size_t bh_sv_join(char *buffer, size_t size, const bh_sv_t *items, size_t count, bh_sv_t seperator)
+{
+  size_t pos = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    if (i) {
+      bh_sv_copy_clamped(buffer, size, pos, seperator);
+      pos += seperator.len;
+    }
+
+    bh_sv_copy_clamped(buffer, size, pos, items[i]);
+    pos += items[i].len;
+  }
+
+  if (size) buffer[pos < size ? pos : size - 1] = '\0';
+
+  return pos;
+}
+
+char *bh_sv_to_cstr(bh_arena_t *arena, bh_sv_t sv)
+{
+  char *s = (char *)bh_arena_alloc(arena, sv.len + 1);
+  if (sv.len) memcpy(s, sv.data, sv.len);
+  s[sv.len] = '\0';
+  return s;
+}
+
+uint64_t bh_hash(const void *data, size_t size)
+{
+  // FNV-1a
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// bitmask of control bytes in the 16-wide group equal to `tag`
+static inline uint32_t bh_intern_group_match(const uint8_t *group, uint8_t tag)
+{
+#if defined(__SSE2__)
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < 16; ++i)
+    mask |= (uint32_t)(group[i] == tag) << i;
+  return mask;
+#endif
+}
+
+static void bh_intern_rehash(bh_intern_t *table, size_t capacity)
+{
+  free(table->ctrl);
+  free(table->slots);
+
+  table->capacity = capacity;
+  table->ctrl = (uint8_t *)calloc(capacity, 1);
+  table->slots = (bh_str_id *)malloc(capacity * sizeof(bh_str_id));
+
+  size_t groups = capacity / 16;
+  for (size_t id = 0; id < table->count; ++id) {
+    uint64_t hash = table->hashes[id];
+    size_t group = (hash >> 7) & (groups - 1);
+
+    for (;;) {
+      uint32_t empty = bh_intern_group_match(table->ctrl + group * 16, 0);
+      if (empty) {
+        size_t slot = group * 16 + __builtin_ctz(empty);
+        table->ctrl[slot] = 0x80 | (hash & 0x7f);
+        table->slots[slot] = (bh_str_id)id;
+        break;
+      }
+      group = (group + 1) & (groups - 1);
+    }
+  }
+}
+
+void bh_intern_init(bh_intern_t *table, size_t capacity)
+{
+  memset(table, 0, sizeof(*table));
+
+  size_t cap = 64;
+  while (cap < capacity) cap <<= 1;
+
+  bh_intern_rehash(table, cap);
+}
+
+// probe for `s`, returns the id if present, otherwise the empty slot to insert at
+static bh_str_id bh_intern_probe(bh_intern_t *table, const char *s, size_t len, uint64_t hash, size_t *insert_slot)
+{
+  size_t groups = table->capacity / 16;
+  size_t group = (hash >> 7) & (groups - 1);
+  uint8_t tag = 0x80 | (hash & 0x7f);
+
+  for (;;) {
+    const uint8_t *ctrl = table->ctrl + group * 16;
+
+    uint32_t match = bh_intern_group_match(ctrl, tag);
+    while (match) {
+      size_t slot = group * 16 + __builtin_ctz(match);
+      bh_str_id id = table->slots[slot];
+
+      if (table->hashes[id] == hash && table->lengths[id] == len &&
+          !memcmp(table->strings[id], s, len))
+        return id;
+
+      match &= match - 1;
+    }
+
+    // nothing is ever removed, so a group with a hole ends the probe sequence
+    uint32_t empty = bh_intern_group_match(ctrl, 0);
+    if (empty) {
+      if (insert_slot) *insert_slot = group * 16 + __builtin_ctz(empty);
+      return BH_STR_ID_NONE;
+    }
+
+    group = (group + 1) & (groups - 1);
+  }
+}
+
+bh_str_id bh_intern_find(bh_intern_t *table, const char *s, size_t len)
+{
+  if (!table || !table->capacity || !s) return BH_STR_ID_NONE;
+  return bh_intern_probe(table, s, len, bh_hash(s, len), NULL);
+}
+
+bh_str_id bh_intern_n(bh_intern_t *table, const char *s, size_t len)
+{
+  if (!table || !s) return BH_STR_ID_NONE;
+  if (!table->capacity) bh_intern_init(table, 0);
+
+  uint64_t hash = bh_hash(s, len);
+  size_t slot = 0;
+
+  bh_str_id id = bh_intern_probe(table, s, len, hash, &slot);
+  if (id != BH_STR_ID_NONE) return id;
+
+  // keep load factor under 7/8
+  if ((table->count + 1) * 8 > table->capacity * 7) {
+    bh_intern_rehash(table, table->capacity * 2);
+    bh_intern_probe(table, s, len, hash, &slot);
+  }
+
+  if (table->count >= table->size) {
+    table->size = table->size ? table->size * 2 : 64;
+    table->strings = (char **)realloc(table->strings, table->size * sizeof(char *));
+    table->lengths = (size_t *)realloc(table->lengths, table->size * sizeof(size_t));
+    table->hashes = (uint64_t *)realloc(table->hashes, table->size * sizeof(uint64_t));
+  }
+
+  // string storage lives in blocks owned by the table, so pointers stay stable
+  if (!table->block || table->block_used + len + 1 > table->block_size) {
+    table->block_size = len + 1 > 64 * 1024 ? len + 1 : 64 * 1024;
+    table->block = (char *)malloc(table->block_size);
+    table->block_used = 0;
+    bh_darray_push(&table->blocks, table->block);
+  }
+
+  char *copy = table->block + table->block_used;
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  table->block_used += len + 1;
+
+  id = (bh_str_id)table->count++;
+  table->strings[id] = copy;
+  table->lengths[id] = len;
+  table->hashes[id] = hash;
+
+  table->ctrl[slot] = 0x80 | (hash & 0x7f);
+  table->slots[slot] = id;
+
+  return id;
+}
+
+bh_str_id bh_intern(bh_intern_t *table, const char *s)
+{
+  if (!s) return BH_STR_ID_NONE;
+  return bh_intern_n(table, s, strlen(s));
+}
+
+const char *bh_intern_str(bh_intern_t *table, bh_str_id id)
+{
+  if (!table || id >= table->count) return NULL;
+  return table->strings[id];
+}
+
+size_t bh_intern_len(bh_intern_t *table, bh_str_id id)
+{
+  if (!table || id >= table->count) return 0;
+  return table->lengths[id];
+}
+
+void bh_intern_free(bh_intern_t *table)
+{
+  if (!table) return;
+
+  for (size_t i = 0; i < bh_darray_len(&table->blocks); ++i)
+    free(table->blocks.items[i]);
+  bh_darray_free(&table->blocks);
+
+  free(table->ctrl);
+  free(table->slots);
+  free(table->strings);
+  free(table->lengths);
+  free(table->hashes);
+
+  memset(table, 0, sizeof(*table));
+}
+
+bool bh_files_intern(bh_intern_t *table, bh_files_t *files, bh_str_ids_t *ids)
+{
+  if (!table || !files) return false;
+
+  for (size_t i = 0; i < bh_darray_len(files); ++i) {
+    bh_str_id id = bh_intern(table, files->items[i]);
+    if (id == BH_STR_ID_NONE) return false;
+
+    // point the list at the shared copy
+    files->items[i] = (char *)bh_intern_str(table, id);
+    if (ids) bh_darray_push(ids, id);
+  }
+
+  return true;
+}
+
+#if __UNIX__
+static void bh_rsp_put(bh_sb_t *out, char ch, bool escape)
+{
+  // gcc, clang, ld and ar all read @files with backslash escapes
+  if (escape && strchr(" \t\n\r\v\f'\"\\", ch))
+    bh_sb_append_char(out, '\\');
+  bh_sb_append_char(out, ch);
+}
+
+// reads one `sh` word from `*cursor` into `out`. returns 1 for a word, 0 at the
+// end and -1 for shell syntax that can't be moved into a response file.
+static int bh_shell_word(const char **cursor, bh_sb_t *out, bool escape)
+{
+  const char *p = *cursor;
+  while (*p == ' ' || *p == '\t') p++;
+
+  if (!*p) {
+    *cursor = p;
+    return 0;
+  }
+
+  if (*p == '#' || *p == '~') return -1;
+
+  while (*p && *p != ' ' && *p != '\t') {
+    if (*p == '\'') {
+      for (p++; *p && *p != '\''; p++)
+        bh_rsp_put(out, *p, escape);
+      if (!*p++) return -1;
+    }
+    else if (*p == '"') {
+      for (p++; *p && *p != '"'; p++) {
+        if (*p == '$' || *p == '`') return -1;
+        if (*p == '\\' && p[1] && strchr("\"\\", p[1])) p++;
+        bh_rsp_put(out, *p, escape);
+      }
+      if (!*p++) return -1;
+    }
+    else if (*p == '\\') {
+      if (!p[1] || p[1] == '\n') return -1;
+      bh_rsp_put(out, p[1], escape);
+      p += 2;
+    }
+    else if (strchr("|&;<>()$`*?[\n", *p)) {
+      return -1;
+    }
+    else {
+      bh_rsp_put(out, *p++, escape);
+    }
+  }
+
+  *cursor = p;
+  return 1;
+}
+#endif
+
+// moves the arguments of a long command into `.build_cache/rsp/<hash>.rsp` and
+// returns `program @file`. the file is named after its contents, so an
+// unchanged command line reuses it. returns `command` when it is short enough
+// or uses shell syntax (pipes, redirections, expansions).
+char *bh_command_rsp(const char *command)
+{
+  if (!command || strlen(command) < BUILD_RSP_THRESHOLD) return (char *)command;
+
+#if __UNIX__
+  const char *cursor = command;
+
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  if (bh_shell_word(&cursor, &sb, false) != 1) return (char *)command;
+
+  char *program = bh_sb_finish(&sb);
+  if (strchr(program, '=')) return (char *)command;
+
+  int got;
+  while ((got = bh_shell_word(&cursor, &sb, true)) == 1)
+    bh_sb_append_char(&sb, '\n');
+
+  char *args = bh_sb_finish(&sb);
+  if (got < 0) return (char *)command;
+
+  size_t size = strlen(args);
+  char *path = bh_fmt(".build_cache/rsp/%016llx.rsp", (unsigned long long)bh_hash(args, size));
+
+  struct stat bf;
+  if (stat(path, &bf) || (size_t)bf.st_size != size) {
+    if (!bh_mkdir(".build_cache/rsp") || !bh_file_write(path, args, size))
+      return (char *)command;
+  }
+
+  return bh_fmt("%s @%s", program, path);
+#else
+  return (char *)command;
+#endif
+}
+
+bool bh_execute(const char *command)
+{
+	if (command == NULL) return false;
+
+  command = bh_command_rsp(command);
+#ifdef BUILD_EXECUTE_LOG
+	bh_logf(BH_LOG_INFO, "$ %s\n", command);
+#endif
+	bh_log_flush();
+
+#if __UNIX__
+  // system() can't time out, run it as a job instead
+  if (build_options.job_timeout > 0 || BUILD_JOB_TIMEOUT > 0) {
+    bh_async_t job = { 0 };
+    if (!bh_push_async(&job, command)) return false;
+    job.items[0].command = NULL;
+    bool failed = bh_await(&job);
+    bh_darray_free(&job);
+    return !failed;
+  }
+#endif
+
+	return !system(command);
+}
+
+// whole file into a malloc'd, NUL terminated buffer, for files that can
+// outgrow the arena
+static char *bh_read_all(const char *path, size_t *len)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp) return NULL;
+
+  fseek(fp, 0L, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0L, SEEK_SET);
+
+  char *buffer = (char *)malloc(size > 0 ? size + 1 : 1);
+  *len = fread(buffer, 1, size > 0 ? size : 0, fp);
+  buffer[*len] = 0;
+  fclose(fp);
+  return buffer;
+}
+
+// atomically replaces `path` with the finished temporary file `tmp`
+static bool bh_file_replace(const char *tmp, const char *path)
+{
+#if __UNIX__
+  if (rename(tmp, path) == 0) return true;
+#elif __WIN32__
+  if (MoveFileEx(tmp, path, MOVEFILE_REPLACE_EXISTING)) return true;
+#endif
+  remove(tmp);
+  return false;
+}
+
+// what the last successful command of each output left behind. restat
+// targets also keep a digest of the output and the mtimes that let an
+// unchanged rebuild stay invisible to their dependents.
+typedef struct {
+  uint64_t hash;        // 0 when unknown
+  int64_t duration;     // ms, -1 when unknown
+  uint64_t digest;      // restat only: content digest of the output, else 0
+  int64_t mtime;        // restat only: output mtime after the build
+  int64_t logical;      // restat only: when the content last changed
+  int64_t horizon;      // restat only: newest input the build saw
+} bh_command_entry_t;
+
+// BUILD_COMMAND_LOG keeps the entries between runs, one line each, newest last:
+// "<hash> <ms> <digest> <mtime> <logical> <horizon> <output>"
+typedef struct {
+  bool loaded;
+  bh_intern_t outputs;
+  bh_command_entry_t *entries;  // per output id
+  size_t entries_size;
+  size_t lines;
+  FILE *fp;
+} bh_command_log_t;
+
+static bh_command_log_t build_commands;
+
+static int64_t bh_now_ms(void)
+{
+  return bh_clock_ns() / 1000000;
+}
+
+static uint64_t bh_command_hash(const char *command)
+{
+  uint64_t hash = bh_hash(command, strlen(command));
+  return hash ? hash : 1;
+}
+
+static bh_str_id bh_command_log_id(const char *output, size_t len)
+{
+  bh_str_id id = bh_intern_n(&build_commands.outputs, output, len);
+
+  if (id >= build_commands.entries_size) {
+    size_t size = build_commands.entries_size ? build_commands.entries_size : 64;
+    while (size <= id) size *= 2;
+
+    build_commands.entries = (bh_command_entry_t *)realloc(build_commands.entries, size * sizeof(bh_command_entry_t));
+    for (size_t i = build_commands.entries_size; i < size; ++i)
+      build_commands.entries[i] = (bh_command_entry_t){ .duration = -1 };
+    build_commands.entries_size = size;
+  }
+
+  return id;
+}
+
+static void bh_command_log_load(void);
+
+static bh_command_entry_t *bh_command_entry(const char *output)
+{
+  bh_command_log_load();
+
+  bh_str_id id = bh_intern_find(&build_commands.outputs, output, strlen(output));
+  if (id == BH_STR_ID_NONE || !build_commands.entries[id].hash) return NULL;
+  return &build_commands.entries[id];
+}
+
+static void bh_command_log_line(FILE *fp, bh_str_id id)
+{
+  bh_command_entry_t *e = &build_commands.entries[id];
+  fprintf(fp, "%016llx %lld %016llx %lld %lld %lld %s\n", (unsigned long long)e->hash, (long long)e->duration,
+    (unsigned long long)e->digest, (long long)e->mtime, (long long)e->logical, (long long)e->horizon,
+    bh_intern_str(&build_commands.outputs, id));
+}
+
+// rewrites the log with one line per output once it is mostly dead entries
+static void bh_command_log_compact(void)
+{
+  const char *tmp = BUILD_COMMAND_LOG ".tmp";
+  FILE *fp = fopen(tmp, "wb");
+  if (!fp) return;
+
+  for (size_t id = 0; id < build_commands.outputs.count; ++id) {
+    if (build_commands.entries[id].hash) bh_command_log_line(fp, id);
+  }
+
+  if (fclose(fp) == 0 && bh_file_replace(tmp, BUILD_COMMAND_LOG))
+    build_commands.lines = build_commands.outputs.count;
+}
+
+static void bh_command_log_load(void)
+{
+  if (build_commands.loaded) return;
+  build_commands.loaded = true;
+
+  size_t len;
+  char *buffer = bh_read_all(BUILD_COMMAND_LOG, &len);
+  if (!buffer) return;
+
+  bh_sv_t sv = bh_sv_from_parts(buffer, len);
+  char line[PATH_MAX + 128];
+
+  while (sv.len) {
+    bh_sv_t next = bh_sv_chop_by(&sv, '\n');
+    if (next.len >= sizeof(line)) continue;
+    memcpy(line, next.data, next.len);
+    line[next.len] = '\0';
+
+    // a torn last line from a killed build simply doesn't parse
+    unsigned long long hash, digest;
+    long long duration, mtime, logical, horizon;
+    int output = 0;
+    if (sscanf(line, "%llx %lld %llx %lld %lld %lld %n", &hash, &duration, &digest, &mtime, &logical, &horizon, &output) < 6 ||
+        !output || !line[output] || !hash) continue;
+
+    bh_str_id id = bh_command_log_id(line + output, next.len - output);
+    build_commands.entries[id] = (bh_command_entry_t){ hash, duration, digest, mtime, logical, horizon };
+    build_commands.lines++;
+  }
+
+  free(buffer);
+
+  if (build_commands.lines > 1024 && build_commands.lines > 3 * build_commands.outputs.count)
+    bh_command_log_compact();
+}
+
+static void bh_command_log_append(bh_str_id id)
+{
+  if (!build_commands.fp) {
+    bh_mkdir(".build_cache");
+    build_commands.fp = fopen(BUILD_COMMAND_LOG, "ab");
+    if (!build_commands.fp) {
+      bh_logf(BH_LOG_WARN, "failed to open `%s`, commands won't be tracked.\n", BUILD_COMMAND_LOG);
+      return;
+    }
+  }
+
+  // flushed per line so a crash loses at most the command that was running
+  bh_command_log_line(build_commands.fp, id);
+  fflush(build_commands.fp);
+  build_commands.lines++;
+}
+
+bool bh_command_changed(const char *output, const char *command)
+{
+  bh_command_entry_t *entry = bh_command_entry(output);
+  return !entry || entry->hash != bh_command_hash(command);
+}
+
+int64_t bh_command_duration(const char *output)
+{
+  bh_command_entry_t *entry = bh_command_entry(output);
+  return entry ? entry->duration : -1;
+}
+
+void bh_command_record(const char *output, const char *command, int64_t duration)
+{
+  uint64_t hash = bh_command_hash(command);
+  bh_command_entry_t *entry = bh_command_entry(output);
+  if (entry && entry->hash == hash && duration < 0) return;
+
+  bh_str_id id = bh_command_log_id(output, strlen(output));
+  entry = &build_commands.entries[id];
+  entry->hash = hash;
+  if (duration >= 0) entry->duration = duration;
+
+  // a plain record means the output isn't restat'ed (anymore)
+  entry->digest = 0;
+  entry->mtime = entry->logical = entry->horizon = 0;
+
+  bh_command_log_append(id);
+}
+
+// only the duration of an entry `command` already has, everything the
+// rebuild decisions use stays as it is
+static void bh_command_retime(const char *output, const char *command, int64_t duration)
+{
+  bh_command_entry_t *entry = bh_command_entry(output);
+  if (!entry || entry->hash != bh_command_hash(command) || entry->duration == duration) return;
+
+  entry->duration = duration;
+  bh_command_log_append(bh_intern_find(&build_commands.outputs, output, strlen(output)));
+}
+
+// compilation database, one JSON object per source keyed by its absolute
+// path. entries read back from BUILD_COMPDB are kept byte for byte, so the
+// file is only rewritten when a command actually changed.
+typedef struct {
+  bool loaded;
+  bool dirty;
+  char directory[PATH_MAX];
+  bh_intern_t files;
+  char **entries;       // per file id, malloc'd
+  size_t entries_size;
+} bh_compdb_t;
+
+static bh_compdb_t build_compdb;
+
+static void bh_json_string(bh_sb_t *sb, const char *s)
+{
+  bh_sb_append_char(sb, '"');
+  for (const unsigned char *c = (const unsigned char *)s; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      bh_sb_append_char(sb, '\\');
+      bh_sb_append_char(sb, *c);
+    } else if (*c < 0x20) {
+      bh_sb_appendf(sb, "\\u%04x", *c);
+    } else {
+      bh_sb_append_char(sb, *c);
+    }
+  }
+  bh_sb_append_char(sb, '"');
+}
+
+// skips one JSON value (or a string key), returns false on malformed input
+static bool bh_json_skip(bh_sv_t *sv)
+{
+  size_t depth = 0, i = 0;
+  bool in_string = false;
+
+  for (; i < sv->len; ++i) {
+    char c = sv->data[i];
+
+    if (in_string) {
+      if (c == '\\') ++i;
+      else if (c == '"') {
+        in_string = false;
+        if (!depth) { ++i; break; }
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      if (!depth) break;  // ends a bare literal
+      if (--depth == 0) { ++i; break; }
+    } else if (!depth && (c == ',' || c == ':')) {
+      break;
+    }
+  }
+
+  if (in_string || depth) return false;
+  *sv = bh_sv_from_parts(sv->data + i, sv->len - i);
+  return true;
+}
+
+// the unescaped contents of the string `sv` starts with, into the arena
+static char *bh_json_unescape(bh_sv_t sv)
+{
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+
+  for (size_t i = 1; i < sv.len && sv.data[i] != '"'; ++i) {
+    char c = sv.data[i];
+    if (c == '\\' && i + 1 < sv.len) {
+      c = sv.data[++i];
+      if (c == 'n') c = '\n';
+      else if (c == 't') c = '\t';
+      else if (c == 'u' && i + 4 < sv.len) {
+        char hex[5] = { sv.data[i + 1], sv.data[i + 2], sv.data[i + 3], sv.data[i + 4], 0 };
+        uint32_t code = (uint32_t)strtol(hex, NULL, 16);
+        i += 4;
+
+        // a high surrogate takes the low one after it
+        if (code >= 0xd800 && code < 0xdc00 && i + 6 < sv.len && sv.data[i + 1] == '\\' && sv.data[i + 2] == 'u') {
+          char low_hex[5] = { sv.data[i + 3], sv.data[i + 4], sv.data[i + 5], sv.data[i + 6], 0 };
+          uint32_t low = (uint32_t)strtol(low_hex, NULL, 16);
+          if (low >= 0xdc00 && low < 0xe000) {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            i += 6;
+          }
+        }
+
+        // as UTF-8, which is how the paths it names are spelled on disk
+        if (code < 0x80) {
+          bh_sb_append_char(&sb, (char)code);
+        } else if (code < 0x800) {
+          bh_sb_append_char(&sb, (char)(0xc0 | (code >> 6)));
+          bh_sb_append_char(&sb, (char)(0x80 | (code & 0x3f)));
+        } else if (code < 0x10000) {
+          bh_sb_append_char(&sb, (char)(0xe0 | (code >> 12)));
+          bh_sb_append_char(&sb, (char)(0x80 | ((code >> 6) & 0x3f)));
+          bh_sb_append_char(&sb, (char)(0x80 | (code & 0x3f)));
+        } else {
+          bh_sb_append_char(&sb, (char)(0xf0 | (code >> 18)));
+          bh_sb_append_char(&sb, (char)(0x80 | ((code >> 12) & 0x3f)));
+          bh_sb_append_char(&sb, (char)(0x80 | ((code >> 6) & 0x3f)));
+          bh_sb_append_char(&sb, (char)(0x80 | (code & 0x3f)));
+        }
+        continue;
+      }
+    }
+    bh_sb_append_char(&sb, c);
+  }
+
+  return bh_sb_finish(&sb);
+}
+
+static char *bh_compdb_key(const char *directory, const char *file)
+{
+  if (file[0] == '/' || !directory) return bh_fmt("%s", file);
+  return bh_fmt("%s/%s", directory, file);
+}
+
+static void bh_compdb_set(const char *key, const char *entry, size_t len)
+{
+  bh_str_id id = bh_intern(&build_compdb.files, key);
+
+  if (id >= build_compdb.entries_size) {
+    size_t size = build_compdb.entries_size ? build_compdb.entries_size : 64;
+    while (size <= id) size *= 2;
+
+    build_compdb.entries = (char **)realloc(build_compdb.entries, size * sizeof(char *));
+    memset(build_compdb.entries + build_compdb.entries_size, 0, (size - build_compdb.entries_size) * sizeof(char *));
+    build_compdb.entries_size = size;
+  }
+
+  char *old = build_compdb.entries[id];
+  if (old && strlen(old) == len && !memcmp(old, entry, len)) return;
+
+  free(old);
+  build_compdb.entries[id] = (char *)malloc(len + 1);
+  memcpy(build_compdb.entries[id], entry, len);
+  build_compdb.entries[id][len] = '\0';
+  build_compdb.dirty = true;
+}
+
+static void bh_compdb_load(void)
+{
+  if (build_compdb.loaded) return;
+  build_compdb.loaded = true;
+
+#if __UNIX__
+  if (!getcwd(build_compdb.directory, sizeof(build_compdb.directory)))
+    build_compdb.directory[0] = '\0';
+#elif __WIN32__
+  GetCurrentDirectoryA(sizeof(build_compdb.directory), build_compdb.directory);
+#endif
+
+  size_t len;
+  char *buffer = bh_read_all(BUILD_COMPDB, &len);
+  if (!buffer) return;
+
+  size_t mark = build_arena->offset;
+  bh_sv_t sv = bh_sv_trim(bh_sv_from_parts(buffer, len));
+  if (!sv.len || sv.data[0] != '[') goto done;
+  sv = bh_sv_from_parts(sv.data + 1, sv.len - 1);
+
+  while ((sv = bh_sv_trim_left(sv)).len && sv.data[0] == '{') {
+    const char *start = sv.data;
+    bh_sv_t object = bh_sv_from_parts(sv.data + 1, sv.len - 1);
+    char *file = NULL, *directory = NULL;
+
+    // "key": value pairs until the closing brace
+    while ((object = bh_sv_trim_left(object)).len && object.data[0] == '"') {
+      bh_sv_t key = object;
+      if (!bh_json_skip(&object)) goto done;
+
+      object = bh_sv_trim_left(object);
+      if (!object.len || object.data[0] != ':') goto done;
+      object = bh_sv_trim_left(bh_sv_from_parts(object.data + 1, object.len - 1));
+
+      bh_sv_t value = object;
+      if (!bh_json_skip(&object)) goto done;
+
+      if (bh_sv_starts_with(key, bh_sv_from_cstr("\"file\"")) && value.data[0] == '"')
+        file = bh_json_unescape(value);
+      else if (bh_sv_starts_with(key, bh_sv_from_cstr("\"directory\"")) && value.data[0] == '"')
+        directory = bh_json_unescape(value);
+
+      object = bh_sv_trim_left(object);
+      if (object.len && object.data[0] == ',')
+        object = bh_sv_from_parts(object.data + 1, object.len - 1);
+    }
+
+    if (!object.len || object.data[0] != '}') goto done;
+    sv = bh_sv_from_parts(object.data + 1, object.len - 1);
+
+    // an entry without a directory is relative to where the database is
+    if (file) bh_compdb_set(bh_compdb_key(directory ? directory : build_compdb.directory, file), start, sv.data - start);
+
+    sv = bh_sv_trim_left(sv);
+    if (sv.len && sv.data[0] == ',') sv = bh_sv_from_parts(sv.data + 1, sv.len - 1);
+  }
+
+done:
+  // what was on disk isn't a change
+  build_compdb.dirty = false;
+  build_arena->offset = mark;
+  free(buffer);
+}
+
+void bh_compdb_add(const char *file, const char *output, const char *command)
+{
+  bh_compdb_load();
+
+  size_t mark = build_arena->offset;
+
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bh_sb_append(&sb, "{\n    \"directory\": ");
+  bh_json_string(&sb, build_compdb.directory);
+  bh_sb_append(&sb, ",\n    \"file\": ");
+  bh_json_string(&sb, file);
+  if (output) {
+    bh_sb_append(&sb, ",\n    \"output\": ");
+    bh_json_string(&sb, output);
+  }
+  bh_sb_append(&sb, ",\n    \"command\": ");
+  bh_json_string(&sb, command);
+  bh_sb_append(&sb, "\n  }");
+
+  char *key = bh_compdb_key(build_compdb.directory, file);
+  bh_compdb_set(key, sb.data, sb.len);
+
+  build_arena->offset = mark;
+}
+
+// writes BUILD_COMPDB through a temporary file, only if an entry changed
+bool bh_compdb_flush(void)
+{
+  if (!build_compdb.dirty) return true;
+
+  const char *tmp = BUILD_COMPDB ".tmp";
+  FILE *fp = fopen(tmp, "wb");
+  if (!fp) {
+    bh_logf(BH_LOG_ERROR, "failed to open files, `%s`.\n", tmp);
+    return false;
+  }
+
+  fputs("[\n", fp);
+  bool first = true;
+  for (size_t id = 0; id < build_compdb.files.count; ++id) {
+    if (!build_compdb.entries[id]) continue;
+    fputs(first ? "  " : ",\n  ", fp);
+    fputs(build_compdb.entries[id], fp);
+    first = false;
+  }
+  fputs("\n]\n", fp);
+
+  if (fclose(fp) != 0 || !bh_file_replace(tmp, BUILD_COMPDB)) {
+    bh_logf(BH_LOG_ERROR, "failed to write `%s`.\n", BUILD_COMPDB);
+    return false;
+  }
+
+  build_compdb.dirty = false;
+  return true;
+}
+
+const char *bh_stale_reason(bh_stale_t stale)
+{
+  switch (stale) {
+    case BH_FRESH: return "up to date";
+    case BH_STALE_MISSING_OUTPUT: return "output is missing";
+    case BH_STALE_NEWER_INPUT: return "input is newer";
+    case BH_STALE_MISSING_INPUT: return "input can't be stat'ed";
+    case BH_STALE_DEPENDENCY: return "input will be rebuilt";
+    case BH_STALE_COMMAND_CHANGED: return "command line changed";
+  }
+  return "unknown";
+}
+
+// logs why `output` would be rebuilt
+static void bh_explain(const char *output, bh_stale_t stale, const char *culprit)
+{
+  if (culprit)
+    bh_logf(BH_LOG_INFO, "explain: `%s`: %s (`%s`)\n", output, bh_stale_reason(stale), culprit);
+  else
+    bh_logf(BH_LOG_INFO, "explain: `%s`: %s\n", output, bh_stale_reason(stale));
+}
+
+bh_stale_t bh_binary_staleness(const char *bin_path, bh_files_t *files, const char **culprit)
+{
+  if (culprit) *culprit = NULL;
+
+  int64_t binary_timestamp = bh_stat_mtime_ns(bin_path);
+  if (binary_timestamp < 0)
+    return BH_STALE_MISSING_OUTPUT;
+
+  for (size_t i = 0; i < bh_darray_len(files); ++i) {
+    int64_t source_timestamp = bh_stat_mtime_ns(files->items[i]);
+
+    // a missing header must not be skipped, the command will report it
+    if (source_timestamp < 0 || source_timestamp > binary_timestamp) {
+      if (culprit) *culprit = files->items[i];
+      return source_timestamp < 0 ? BH_STALE_MISSING_INPUT : BH_STALE_NEWER_INPUT;
+    }
+  }
+
+  return BH_FRESH;
+}
+
+bool bh_is_binary_old(const char *bin_path, bh_files_t *files)
+{
+  const char *culprit = NULL;
+  bh_stale_t stale = bh_binary_staleness(bin_path, files, &culprit);
+
+  if (stale == BH_STALE_MISSING_INPUT)
+    bh_logf(BH_LOG_ERROR, "Failed to get modification time for source file: %s\n", culprit);
+
+  return stale != BH_FRESH;
+}
+
+bool bh_on_binary_old_execute(const char *bin_path, bh_files_t *files, const char *command)
+{
+  const char *culprit = NULL;
+  bh_stale_t stale = bh_binary_staleness(bin_path, files, &culprit);
+  if (stale == BH_FRESH && bh_command_changed(bin_path, command))
+    stale = BH_STALE_COMMAND_CHANGED;
+  if (stale == BH_FRESH) return false;
+
+  if (build_options.explain) {
+    bh_explain(bin_path, stale, culprit);
+    return false;
+  }
+
+  if (stale == BH_STALE_MISSING_INPUT)
+    bh_logf(BH_LOG_ERROR, "Failed to get modification time for source file: %s\n", culprit);
+
+  int64_t start = bh_now_ms();
+  if (!bh_execute(command)) return false;
+
+  bh_command_record(bin_path, command, bh_now_ms() - start);
+  return true;
+}
+
+#if __UNIX__
+static void bh_job_reaped(bh_command_t *job, int status)
+{
+  job->state = BH_JOB_DONE;
+  job->failed = !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+}
+
+// reaps the jobs that already exited without blocking, true if one failed
+static bool bh_async_poll(bh_async_t *async)
+{
+  // one syscall tells whether any child exited at all, and leaves it waitable
+  siginfo_t info = { 0 };
+  bool exited = waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid;
+
+  bool failed = false;
+  for (size_t i = 0; i < bh_darray_len(async); ++i) {
+    bh_command_t *job = &async->items[i];
+    int status;
+    if (exited && job->state != BH_JOB_DONE && waitpid(job->pid, &status, WNOHANG) == job->pid)
+      bh_job_reaped(job, status);
+    failed |= job->state == BH_JOB_DONE && job->failed;
+  }
+
+  return failed;
+}
+
+// distributed compiles. a remotable job is a single `cc ... -c x.c -o x.o`
+// with no shell syntax. the forked job preprocesses it here, so the depfile
+// and all headers stay local, and sends the output of -E to a worker:
+//
+//   request:  bh_remote_header_t, the compiler and its flags (NUL separated,
+//             preprocessor flags removed), then the preprocessed source
+//   response: bh_remote_header_t (`status` is the compiler's exit status),
+//             the diagnostics, then the object when the status is 0
+//
+// sizes travel in network byte order. a job whose worker can't be reached
+// or answers garbage compiles locally instead, a compile error is final.
+#define BH_REMOTE_MAGIC 0x62687730u   // "bhw0"
+
+typedef struct {
+  uint32_t magic;
+  int32_t status;
+  uint32_t args_size;
+  uint32_t data_size;     // source, or diagnostics + object
+  uint32_t diagnostics_size;
+} bh_remote_header_t;
+
+static bh_files_t bh_remote_hosts;
+static size_t bh_remote_next;
+
+// every caller has a socket, a peer that hangs up makes the write fail
+// instead of raising SIGPIPE
+static bool bh_io_all(int fd, void *buffer, size_t size, bool writing)
+{
+  char *p = (char *)buffer;
+  while (size) {
+    ssize_t n = writing ? send(fd, p, size, MSG_NOSIGNAL) : read(fd, p, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+bool bh_remote_add(const char *host)
+{
+  const char *colon = strrchr(host, ':');
+  if (!colon || colon == host || atoi(colon + 1) <= 0) {
+    bh_logf(BH_LOG_ERROR, "remote host `%s` isn't host:port.\n", host);
+    return false;
+  }
+
+  bh_darray_push(&bh_remote_hosts, strdup(host));
+  return true;
+}
+
+static bool bh_remote_compiler(const char *name)
+{
+  const char *base = strrchr(name, '/');
+  base = base ? base + 1 : name;
+  static const char *known[] = { "cc", "gcc", "clang", "c++", "g++", "clang++" };
+  for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); ++i)
+    if (!strcmp(base, known[i])) return true;
+  return false;
+}
+
+// preprocessor flags with a separate argument, they stay local
+static bool bh_remote_local_pair(const char *arg)
+{
+  static const char *pairs[] = {
+    "-I", "-D", "-U", "-include", "-imacros", "-isystem", "-iquote", "-idirafter", "-MF", "-MT", "-MQ",
+  };
+  for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i)
+    if (!strcmp(arg, pairs[i])) return true;
+  return false;
+}
+
+static bool bh_remote_local_flag(const char *arg)
+{
+  return !strncmp(arg, "-I", 2) || !strncmp(arg, "-D", 2) || !strncmp(arg, "-U", 2) ||
+    !strncmp(arg, "-M", 2) || !strncmp(arg, "-isystem", 8) || !strncmp(arg, "-iquote", 7) ||
+    !strcmp(arg, "-nostdinc");
+}
+
+// the only flags a worker takes: optimization, debug info, warnings, code
+// generation and the standard. gcc has `--` aliases for the flags that load
+// files or programs (`--specs=`, `--prefix=`), so those are all refused, and
+// so is anything naming a path
+static bool bh_remote_safe_flag(const char *arg)
+{
+  if (arg[0] != '-' || arg[1] == '-' || strchr(arg, '/')) return false;
+  if (!strncmp(arg, "-W", 2)) return strncmp(arg, "-Wa,", 4) && strncmp(arg, "-Wl,", 4) && strncmp(arg, "-Wp,", 4);
+  if (!strncmp(arg, "-f", 2)) return !strstr(arg, "plugin") && !strstr(arg, "profile");
+  return !strncmp(arg, "-O", 2) || !strncmp(arg, "-g", 2) || !strncmp(arg, "-m", 2) ||
+    !strncmp(arg, "-std=", 5) || !strncmp(arg, "-D", 2) || !strncmp(arg, "-U", 2) ||
+    !strcmp(arg, "-w") || !strcmp(arg, "-pedantic") || !strcmp(arg, "-pedantic-errors");
+}
+
+typedef struct {
+  bh_files_t args;        // the whole command, split
+  const char *source;
+  const char *output;
+  bool cxx;
+} bh_remote_job_t;
+
+// splits `command` when it is a single compile the workers can take
+static bool bh_remote_parse(const char *command, bh_remote_job_t *job)
+{
+  if (strpbrk(command, "'\"`$\\|&;<>()*?[]{}~#\n")) return false;
+
+  char *copy = bh_fmt("%s", command);
+  for (char *arg = strtok(copy, " \t"); arg; arg = strtok(NULL, " \t"))
+    bh_darray_push(&job->args, arg);
+  if (!bh_darray_len(&job->args) || !bh_remote_compiler(job->args.items[0])) return false;
+
+  bool compile = false;
+  for (size_t i = 1; i < bh_darray_len(&job->args); ++i) {
+    const char *arg = job->args.items[i];
+    if (!strcmp(arg, "-c")) compile = true;
+    else if (!strcmp(arg, "-o") && i + 1 < bh_darray_len(&job->args)) job->output = job->args.items[++i];
+    else if (bh_remote_local_pair(arg)) ++i;
+    else if (arg[0] != '-') {
+      if (job->source) return false;
+      job->source = arg;
+    }
+    // what a worker would refuse compiles here
+    else if (!bh_remote_local_flag(arg) && !bh_remote_safe_flag(arg)) return false;
+  }
+
+  if (!compile || !job->source || !job->output) return false;
+  const char *ext = strrchr(job->source, '.');
+  if (!ext) return false;
+  job->cxx = !strcmp(ext, ".cc") || !strcmp(ext, ".cpp") || !strcmp(ext, ".cxx") || !strcmp(ext, ".C");
+  if (strcmp(ext, ".c") && !job->cxx) return false;
+  const char *base = strrchr(job->args.items[0], '/');
+  job->cxx |= strstr(base ? base : job->args.items[0], "++") != NULL;
+  return true;
+}
+
+static int bh_remote_connect(const char *host)
+{
+  const char *colon = strrchr(host, ':');
+  char *name = bh_fmt("%.*s", (int)(colon - host), host);
+
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *found;
+  if (getaddrinfo(name, colon + 1, &hints, &found)) return -1;
+
+  int fd = -1;
+  for (struct addrinfo *ai = found; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) continue;
+
+    // connect gives up after the send timeout, compiles get longer
+    struct timeval timeout = { .tv_sec = BUILD_REMOTE_CONNECT_MS / 1000, .tv_usec = BUILD_REMOTE_CONNECT_MS % 1000 * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+      close(fd);
+      fd = -1;
+      continue;
+    }
+
+    timeout = (struct timeval){ .tv_sec = BUILD_REMOTE_TIMEOUT };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  freeaddrinfo(found);
+  return fd;
+}
+
+// runs in the forked job: the exit status of the compile, or -1 when it
+// has to run locally after all
+static int bh_remote_run(bh_remote_job_t *job, const char *host)
+{
+  // preprocessing keeps every flag, the depfile is written here
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bool depfile = false, target = false, deps = false;
+  const char *pre = bh_fmt(".build_cache/remote/%d.i", (int)getpid());
+  for (size_t i = 0; i < bh_darray_len(&job->args); ++i) {
+    const char *arg = job->args.items[i];
+    if (!strcmp(arg, "-c")) continue;
+    if (!strcmp(arg, "-o")) {
+      ++i;
+      continue;
+    }
+    deps |= !strcmp(arg, "-MD") || !strcmp(arg, "-MMD");
+    depfile |= !strcmp(arg, "-MF");
+    target |= !strcmp(arg, "-MT") || !strcmp(arg, "-MQ");
+    bh_sb_appendf(&sb, "%s ", arg);
+  }
+  // without them gcc would name the depfile and its target after the .i
+  if (deps && !depfile) {
+    const char *dot = strrchr(job->output, '.');
+    bh_sb_appendf(&sb, "-MF %.*s.d ", (int)(dot ? dot - job->output : (ptrdiff_t)strlen(job->output)), job->output);
+  }
+  if (deps && !target) bh_sb_appendf(&sb, "-MT %s ", job->output);
+  bh_sb_appendf(&sb, "-E -o %s", pre);
+  const char *preprocess = bh_sb_finish(&sb);
+
+  bh_mkdir(".build_cache/remote");
+  if (system(preprocess) != 0) {
+    remove(pre);
+    return 1;
+  }
+
+  size_t source_len;
+  char *source = bh_read_all(pre, &source_len);
+  remove(pre);
+  if (!source) return -1;
+
+  // the compile flags, what only the preprocessor needs stays here
+  bh_sb_init(&sb, build_arena);
+  for (size_t i = 0; i < bh_darray_len(&job->args); ++i) {
+    const char *arg = job->args.items[i];
+    if (!strcmp(arg, "-o") || bh_remote_local_pair(arg)) ++i;
+    else if (!strcmp(arg, "-c") || arg == job->source || bh_remote_local_flag(arg)) continue;
+    else {
+      bh_sb_append(&sb, arg);
+      bh_sb_append_char(&sb, '\0');
+    }
+  }
+
+  int status = -1;
+  char *data = NULL;
+  int fd = bh_remote_connect(host);
+  if (fd < 0) {
+    bh_logf(BH_LOG_WARN, "can't reach `%s`, compiling `%s` here.\n", host, job->source);
+    free(source);
+    return -1;
+  }
+
+  bh_remote_header_t header = {
+    .magic = htonl(BH_REMOTE_MAGIC),
+    .status = (int32_t)htonl(job->cxx),
+    .args_size = htonl((uint32_t)sb.len),
+    .data_size = htonl((uint32_t)source_len),
+  };
+  bh_remote_header_t answer;
+  bool ok = bh_io_all(fd, &header, sizeof(header), true) &&
+    bh_io_all(fd, sb.data, sb.len, true) &&
+    bh_io_all(fd, source, source_len, true) &&
+    bh_io_all(fd, &answer, sizeof(answer), false) &&
+    ntohl(answer.magic) == BH_REMOTE_MAGIC &&
+    ntohl(answer.diagnostics_size) <= ntohl(answer.data_size);
+  free(source);
+
+  if (ok) {
+    size_t size = ntohl(answer.data_size), diagnostics = ntohl(answer.diagnostics_size);
+    data = (char *)malloc(size ? size : 1);
+    ok = bh_io_all(fd, data, size, false);
+
+    if (ok) {
+      status = (int32_t)ntohl((uint32_t)answer.status);
+      bh_log_flush();
+      if (diagnostics) fwrite(data, 1, diagnostics, stderr);
+      fflush(stderr);
+
+      const char *tmp = bh_fmt("%s.remote.tmp", job->output);
+      if (status == 0 && (!bh_file_write(tmp, data + diagnostics, size - diagnostics) || !bh_file_replace(tmp, job->output)))
+        status = 1;
+    }
+  }
+  close(fd);
+  free(data);
+
+  if (!ok) {
+    bh_logf(BH_LOG_WARN, "`%s` failed to compile `%s`, compiling it here.\n", host, job->source);
+    return -1;
+  }
+  return status;
+}
+
+static int bh_worker_listen(const char *address, int *port)
+{
+  const char *colon = strrchr(address, ':');
+  const char *name = colon && colon != address ? bh_fmt("%.*s", (int)(colon - address), address) : NULL;
+
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE }, *found;
+  if (getaddrinfo(name, colon ? colon + 1 : address, &hints, &found)) {
+    bh_logf(BH_LOG_ERROR, "can't resolve `%s`.\n", address);
+    return -1;
+  }
+
+  int fd = socket(found->ai_family, found->ai_socktype | SOCK_CLOEXEC, found->ai_protocol);
+  int one = 1;
+  if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (fd < 0 || bind(fd, found->ai_addr, found->ai_addrlen) || listen(fd, 64)) {
+    bh_logf(BH_LOG_ERROR, "failed to listen on `%s`: %s\n", address, strerror(errno));
+    if (fd >= 0) close(fd);
+    freeaddrinfo(found);
+    return -1;
+  }
+  freeaddrinfo(found);
+
+  struct sockaddr_storage bound;
+  socklen_t len = sizeof(bound);
+  getsockname(fd, (struct sockaddr *)&bound, &len);
+  *port = ntohs(bound.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&bound)->sin6_port : ((struct sockaddr_in *)&bound)->sin_port);
+  return fd;
+}
+
+// one request in a forked worker, the compiler never sees a shell
+static void bh_worker_handle(int client)
+{
+  struct timeval timeout = { .tv_sec = BUILD_REMOTE_TIMEOUT };
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  bh_remote_header_t header;
+  if (!bh_io_all(client, &header, sizeof(header), false) || ntohl(header.magic) != BH_REMOTE_MAGIC) return;
+
+  size_t args_size = ntohl(header.args_size), source_size = ntohl(header.data_size);
+  if (!args_size || args_size > (1u << 20)) return;
+  char *args = (char *)malloc(args_size + 1);
+  char *source = (char *)malloc(source_size ? source_size : 1);
+  args[args_size] = '\0';
+  if (!bh_io_all(client, args, args_size, false) || !bh_io_all(client, source, source_size, false)) return;
+
+  char dir[] = "/tmp/bh-worker-XXXXXX";
+  if (!mkdtemp(dir)) return;
+  const char *input = bh_fmt("%s/in.i", dir), *object = bh_fmt("%s/out.o", dir), *log = bh_fmt("%s/out.log", dir);
+
+  bh_files_t argv = { 0 };
+  bool safe = args[args_size - 1] == '\0';
+  for (char *p = args; safe && p < args + args_size; p += strlen(p) + 1) {
+    safe = bh_darray_len(&argv) ? bh_remote_safe_flag(p) : bh_remote_compiler(p);
+    bh_darray_push(&argv, p);
+  }
+  bh_darray_push(&argv, "-x");
+  bh_darray_push(&argv, ntohl((uint32_t)header.status) ? "c++-cpp-output" : "cpp-output");
+  bh_darray_push(&argv, "-c");
+  bh_darray_push(&argv, (char *)input);
+  bh_darray_push(&argv, "-o");
+  bh_darray_push(&argv, (char *)object);
+  bh_darray_push(&argv, NULL);
+
+  int status = 1;
+  if (safe && bh_file_write(input, source, source_size)) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+      }
+      // side files like dumps land in the scratch dir
+      if (chdir(dir)) _exit(127);
+      execvp(argv.items[0], argv.items);
+      _exit(127);
+    }
+    int wstatus;
+    if (pid > 0 && waitpid(pid, &wstatus, 0) == pid)
+      status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+  }
+
+  size_t diagnostics_len = 0, object_len = 0;
+  char *diagnostics = bh_read_all(log, &diagnostics_len);
+  char *code = status == 0 ? bh_read_all(object, &object_len) : NULL;
+  if (status == 0 && !code) status = 1;
+  if (!safe) {
+    free(diagnostics);
+    diagnostics = strdup("bh-worker: refused the compiler or a flag\n");
+    diagnostics_len = strlen(diagnostics);
+  }
+
+  bh_remote_header_t answer = {
+    .magic = htonl(BH_REMOTE_MAGIC),
+    .status = (int32_t)htonl((uint32_t)status),
+    .data_size = htonl((uint32_t)(diagnostics_len + object_len)),
+    .diagnostics_size = htonl((uint32_t)diagnostics_len),
+  };
+  if (bh_io_all(client, &answer, sizeof(answer), true) && bh_io_all(client, diagnostics, diagnostics_len, true))
+    bh_io_all(client, code, object_len, true);
+
+  // the compiler's side files are in there too
+  bh_dir_listing_t listing;
+  if (bh_dir_read(dir, &listing)) {
+    bh_dir_listing_foreach(&listing, type, name, {
+      if (type != DT_DIR) remove(bh_fmt("%s/%s", dir, name));
+    });
+    bh_dir_listing_free(&listing);
+  }
+  rmdir(dir);
+}
+
+static int bh_worker_loop(int listener)
+{
+  // requests are forked off, nobody waits for them
+  signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    int client = accept(listener, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      bh_logf(BH_LOG_ERROR, "accept failed: %s\n", strerror(errno));
+      return 1;
+    }
+
+    bh_log_flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listener);
+      signal(SIGCHLD, SIG_DFL);
+      bh_worker_handle(client);
+      _exit(0);
+    }
+    close(client);
+  }
+}
+
+// a bh-worker: serves compiles on `address` ("[host:]port") until killed.
+// anyone who can connect can compile, keep it on a trusted network.
+int bh_worker_serve(const char *address)
+{
+  int port;
+  int listener = bh_worker_listen(address, &port);
+  if (listener < 0) return 1;
+
+  bh_logf(BH_LOG_INFO, "bh-worker listening on port %d\n", port);
+  return bh_worker_loop(listener);
+}
+
+// jobs lead their own process groups, so the terminal's ^C doesn't reach
+// them. from the first push until bh_await takes over, a ^C or SIGTERM
+// stops the groups pushed so far and then ends the driver as before.
+static pid_t *bh_async_groups;
+static size_t bh_async_groups_count, bh_async_groups_size;
+static bool bh_async_forwarding;
+static struct sigaction bh_async_old_int, bh_async_old_term;
+
+static void bh_async_on_signal(int sig)
+{
+  for (size_t i = 0; i < bh_async_groups_count; ++i)
+    killpg(bh_async_groups[i], SIGTERM);
+
+  sigaction(sig, sig == SIGINT ? &bh_async_old_int : &bh_async_old_term, NULL);
+  raise(sig);
+}
+
+// the handler only runs with both signals blocked, so it never sees the
+// list halfway through a push
+static void bh_async_forward(pid_t group)
+{
+  if (!bh_async_forwarding) {
+    struct sigaction action = { .sa_handler = bh_async_on_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &bh_async_old_int);
+    sigaction(SIGTERM, &action, &bh_async_old_term);
+    bh_async_forwarding = true;
+  }
+
+  if (bh_async_groups_count == bh_async_groups_size) {
+    bh_async_groups_size = bh_async_groups_size ? bh_async_groups_size * 2 : 16;
+    bh_async_groups = (pid_t *)realloc(bh_async_groups, bh_async_groups_size * sizeof(pid_t));
+  }
+  bh_async_groups[bh_async_groups_count++] = group;
+}
+
+bool bh_push_async(bh_async_t *async, const char *command)
+{
+  // fail fast: nothing new starts once a job of this batch failed
+  if (!build_options.keep_going && bh_async_poll(async)) {
+    bh_logf(BH_LOG_ERROR, "not starting `%s` after a failed job.\n", command);
+    return false;
+  }
+
+  // compiles go to the remote workers in turn
+  bh_remote_job_t remote = { 0 };
+  const char *host = NULL;
+  if (bh_darray_len(&bh_remote_hosts) && bh_remote_parse(command, &remote))
+    host = bh_remote_hosts.items[bh_remote_next++ % bh_darray_len(&bh_remote_hosts)];
+
+  const char *run = bh_command_rsp(command);
+  bh_log_flush();
+
+  sigset_t block, old_mask;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  sigprocmask(SIG_BLOCK, &block, &old_mask);
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    bh_darray_free(&remote.args);
+    return false;
+  } else if (pid == 0) {
+    setpgid(0, 0);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    if (host) {
+      int status = bh_remote_run(&remote, host);
+      bh_log_flush();
+      if (status >= 0) _exit(status);
+    }
+    execlp("sh", "sh", "-c", run, NULL);
+    bh_log(BH_LOG_ERROR, "Async failed");
+    bh_log_flush();
+    _exit(127);
+  }
+
+  // both sides set the group, whichever runs first wins the race with killpg
+  setpgid(pid, pid);
+  bh_async_forward(pid);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  bh_darray_free(&remote.args);
+  bh_darray_push(async, ((bh_command_t){
+    .pid = pid,
+    .command = (char*)command,
+    .started = bh_now_ms(),
+  }));
+
+  return true;
+}
+#elif __WIN32__
+bool bh_push_async(bh_async_t *async, const char *command)
+{
+    STARTUPINFO si = { sizeof(si) };
+    PROCESS_INFORMATION pi;
+    WINBOOL success;
+    char *cmdline;
+
+    // Create a modifiable command line string
+    // Note: CreateProcess may modify the command line string
+    cmdline = _strdup(command);
+    if (!cmdline) {
+        return false;
+    }
+
+    success = CreateProcess(
+        NULL,           // No application name (use command line)
+        cmdline,        // Command line (needs to be writable)
+        NULL,           // Process handle not inheritable
+        NULL,           // Thread handle not inheritable
+        FALSE,          // Set handle inheritance to FALSE
+        CREATE_NO_WINDOW, // Don't create a console window
+        NULL,           // Use parent's environment block
+        NULL,           // Use parent's starting directory 
+        &si,            // Pointer to STARTUPINFO structure
+        &pi             // Pointer to PROCESS_INFORMATION structure
+    );
+
+    free(cmdline);  // Free the duplicated command line
+
+    if (!success) {
+        bh_logf(BH_LOG_ERROR, "Async failed (CreateProcess error: %lu)", GetLastError());
+        return false;
+    }
+
+    // We don't need the thread handle
+    CloseHandle(pi.hThread);
+
+    // Push the process information to the async array
+    // Note: You'll need to change bh_command_t to store HANDLE instead of pid_t
+    bh_darray_push(async, ((bh_command_t){
+        .pid = pi.hProcess,  // Store the process handle
+        .command = _strdup(command)  // Duplicate the command string
+    }));
+
+    return true;
+}
+#endif
+
+#if __UNIX__
+static volatile sig_atomic_t bh_await_signal;
+
+static void bh_await_on_signal(int sig)
+{
+  bh_await_signal = sig;
+}
+
+static void bh_job_stop(bh_command_t *job, int64_t now)
+{
+  if (job->state != BH_JOB_RUNNING) return;
+  killpg(job->pid, SIGTERM);
+  job->state = BH_JOB_STOPPING;
+  job->stopping = now;
+}
+
+static int bh_pidfd_open(pid_t pid)
+{
+#if __linux__ && defined(SYS_pidfd_open)
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+// progress line for bh_await on a terminal: finished/running/total, jobs
+// per second, the job running longest and an ETA. jobs whose command has
+// `-o <output>` are expected to take what the command log recorded for
+// that output, the others the average of those. it is redrawn at most
+// every BUILD_PROGRESS_MS on the terminal's last row, which is taken out
+// of the scroll region so log lines and the commands' own output scroll
+// above it.
+typedef struct {
+  bool tty;
+  int64_t start;
+  int64_t drawn;
+  int64_t *expected;      // ms per job, -1 unknown
+  int64_t mean;           // of the known ones, -1 when none is
+  int rows;               // of the terminal, 0 until the last row is reserved
+} bh_progress_t;
+
+// the word after ` -o `, for looking up the job in the command log
+static const char *bh_command_output(const char *command)
+{
+  const char *o = strstr(command, " -o ");
+  if (!o) return NULL;
+  o += 4;
+  while (*o == ' ') o++;
+  size_t len = strcspn(o, " \t\n;&|");
+  return len ? bh_fmt("%.*s", (int)len, o) : NULL;
+}
+
+static void bh_progress_begin(bh_progress_t *progress, bh_async_t *async, int64_t now)
+{
+  const char *term = getenv("TERM");
+  size_t count = bh_darray_len(async);
+  *progress = (bh_progress_t){
+    .tty = !build_options.no_progress && !build_options.log_json && isatty(STDERR_FILENO) && !(term && !strcmp(term, "dumb")),
+    .start = now,
+    .drawn = now,         // batches that finish quickly never show it
+    .mean = -1,
+  };
+
+  int64_t known = 0, total = 0;
+  progress->expected = (int64_t *)malloc((count ? count : 1) * sizeof(int64_t));
+  for (size_t i = 0; i < count; ++i) {
+    const char *command = async->items[i].command;
+    const char *output = command ? bh_command_output(command) : NULL;
+    progress->expected[i] = output ? bh_command_duration(output) : -1;
+    if (progress->expected[i] >= 0) {
+      known++;
+      total += progress->expected[i];
+    }
+  }
+  if (known) progress->mean = total / known;
+}
+
+static void bh_progress_format(bh_progress_t *progress, bh_async_t *async, int64_t now, char *line, size_t size)
+{
+  size_t count = bh_darray_len(async), done = 0, running = 0;
+  int64_t left = 0;
+  bh_command_t *longest = NULL;
+
+  for (size_t i = 0; i < count; ++i) {
+    bh_command_t *job = &async->items[i];
+    if (job->state == BH_JOB_DONE) {
+      done++;
+      continue;
+    }
+
+    running++;
+    if (!longest || job->started < longest->started) longest = job;
+    int64_t expected = progress->expected[i] >= 0 ? progress->expected[i] : progress->mean;
+    if (expected > now - job->started) left += expected - (now - job->started);
+  }
+
+  int64_t elapsed = now - progress->start;
+  double rate = elapsed > 0 ? done * 1000.0 / elapsed : 0;
+
+  // the jobs all run at once, so what is left is spread over them
+  char eta[32] = "?";
+  if (progress->mean >= 0 && running) snprintf(eta, sizeof(eta), "%llds", (long long)((left / (int64_t)running + 999) / 1000));
+  else if (rate > 0) snprintf(eta, sizeof(eta), "%.0fs", (count - done) / rate);
+
+  int n = snprintf(line, size, "[%zu/%zu done, %zu running] %.1f jobs/s, eta %s", done, count, running, rate, eta);
+  if (longest && n >= 0 && (size_t)n < size)
+    snprintf(line + n, size - n, ", %.1fs: %s", (now - longest->started) / 1000.0, longest->command ? longest->command : "");
+}
+
+static void bh_progress_draw(bh_progress_t *progress, bh_async_t *async, int64_t now)
+{
+  char line[1024];
+  bh_progress_format(progress, async, now, line, sizeof(line));
+
+  int rows = 24, cols = 80;
+  struct winsize ws;
+  if (ioctl(STDERR_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 2 && ws.ws_col > 1) {
+    rows = ws.ws_row;
+    cols = ws.ws_col;
+  }
+
+  bh_log_flush();
+  // a new line for the cursor, then the scroll region ends above the last row
+  if (rows != progress->rows) {
+    fprintf(stderr, "\n\0337\033[1;%dr\0338\033[1A", rows - 1);
+    progress->rows = rows;
+  }
+  fprintf(stderr, "\0337\033[%d;1H\033[K%.*s\0338", rows, cols - 1, line);
+  fflush(stderr);
+  progress->drawn = now;
+}
+
+static void bh_progress_end(bh_progress_t *progress)
+{
+  free(progress->expected);
+  progress->expected = NULL;
+  if (!progress->rows) return;
+
+  bh_log_flush();
+  fprintf(stderr, "\0337\033[r\033[%d;1H\033[K\0338", progress->rows);
+  fflush(stderr);
+  progress->rows = 0;
+}
+
+// waits for every job, returns true if one failed. a pidfd per job makes
+// the wait a single poll that also wakes up for the next deadline; without
+// pidfds (before linux 5.3, other unixes) it polls every 10ms instead.
+bool bh_await(bh_async_t *async)
+{
+  size_t count = bh_darray_len(async);
+  int64_t timeout = (build_options.job_timeout > 0 ? build_options.job_timeout : BUILD_JOB_TIMEOUT) * (int64_t)1000;
+  int64_t now = bh_now_ms();
+
+  struct pollfd *fds = (struct pollfd *)malloc((count ? count : 1) * sizeof(struct pollfd));
+  for (size_t i = 0; i < count; ++i) {
+    bh_command_t *job = &async->items[i];
+    if (job->command)
+      bh_logf(BH_LOG_INFO, "%s\n", job->command);
+    if (!job->started) job->started = now;
+
+    fds[i] = (struct pollfd){ .fd = job->state == BH_JOB_DONE ? -1 : bh_pidfd_open(job->pid), .events = POLLIN, .revents = POLLIN };
+  }
+  bh_log_flush();
+
+  bh_progress_t progress;
+  bh_progress_begin(&progress, async, now);
+
+  // the jobs lead their own process groups, so ^C has to be passed on.
+  // this takes over from the handler the pushes installed
+  struct sigaction action = { .sa_handler = bh_await_on_signal }, old_int, old_term;
+  sigemptyset(&action.sa_mask);
+  bh_await_signal = 0;
+  sigaction(SIGINT, &action, &old_int);
+  sigaction(SIGTERM, &action, &old_term);
+  if (bh_async_forwarding) {
+    old_int = bh_async_old_int;
+    old_term = bh_async_old_term;
+    bh_async_forwarding = false;
+  }
+  bh_async_groups_count = 0;
+
+  bool failed = false;
+  for (size_t i = 0; i < count; ++i)
+    failed |= async->items[i].state == BH_JOB_DONE && async->items[i].failed;
+
+  for (;;) {
+    size_t running = 0;
+    int64_t wake = -1;
+    bool blind = false;
+    now = bh_now_ms();
+
+    for (size_t i = 0; i < count; ++i) {
+      bh_command_t *job = &async->items[i];
+      if (job->state == BH_JOB_DONE) continue;
+
+      int status;
+      if ((fds[i].fd < 0 || fds[i].revents) && waitpid(job->pid, &status, WNOHANG) == job->pid) {
+        bh_job_reaped(job, status);
+        if (fds[i].fd >= 0) close(fds[i].fd);
+        fds[i].fd = -1;
+        failed |= job->failed;
+
+        // what the next ETA is based on, for outputs the log already tracks
+        const char *output = progress.tty && job->command && !job->failed ? bh_command_output(job->command) : NULL;
+        if (output) bh_command_retime(output, job->command, now - job->started);
+        continue;
+      }
+
+      running++;
+      blind |= fds[i].fd < 0;
+
+      int64_t due = -1;
+      if (job->state == BH_JOB_RUNNING && timeout) due = job->started + timeout;
+      else if (job->state == BH_JOB_STOPPING) due = job->stopping + BUILD_JOB_KILL_GRACE_MS;
+
+      if (due >= 0 && now >= due) {
+        if (job->state == BH_JOB_RUNNING) {
+          if (job->command)
+            bh_logf(BH_LOG_ERROR, "`%s` timed out after %llds.\n", job->command, (long long)(timeout / 1000));
+          else
+            bh_logf(BH_LOG_ERROR, "process %d timed out after %llds.\n", (int)job->pid, (long long)(timeout / 1000));
+          bh_job_stop(job, now);
+          failed = true;
+          due = now + BUILD_JOB_KILL_GRACE_MS;
+        } else {
+          killpg(job->pid, SIGKILL);
+          job->state = BH_JOB_KILLED;
+          due = -1;
+        }
+      }
+      if (due >= 0 && (wake < 0 || due < wake)) wake = due;
+    }
+
+    if (!running) break;
+
+    if ((failed && !build_options.keep_going) || bh_await_signal) {
+      size_t stopped = 0;
+      for (size_t i = 0; i < count; ++i) {
+        if (async->items[i].state == BH_JOB_RUNNING) {
+          bh_job_stop(&async->items[i], now);
+          stopped++;
+        }
+      }
+
+      if (stopped) {
+        bh_logf(BH_LOG_WARN, "stopping %zu job(s)%s.\n", stopped, bh_await_signal ? "" : " after a failure, -k lets them finish");
+        int64_t due = now + BUILD_JOB_KILL_GRACE_MS;
+        if (wake < 0 || due < wake) wake = due;
+      }
+    }
+
+    if (progress.tty) {
+      if (now - progress.drawn >= BUILD_PROGRESS_MS) bh_progress_draw(&progress, async, now);
+      int64_t due = progress.drawn + BUILD_PROGRESS_MS;
+      if (wake < 0 || due < wake) wake = due;
+    }
+
+    int wait = wake < 0 ? -1 : (int)(wake - now);
+    if (blind && (wait < 0 || wait > 10)) wait = 10;
+    for (size_t i = 0; i < count; ++i) fds[i].revents = 0;
+    poll(fds, count, wait);
+  }
+
+  free(fds);
+  bh_progress_end(&progress);
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+  bh_log_flush();
+  if (bh_await_signal) raise(bh_await_signal);
+
+  return failed;
+}
+#elif __WIN32__
+bool bh_await(bh_async_t *async)
+{
+    bool ret = false;
+    bh_foreach(async, command, {
+        if (command.command)
+            bh_logf(BH_LOG_INFO, "%s\n", command.command);
+
+        // Wait for the process to complete
+        WaitForSingleObject(command.pid, INFINITE);
+        
+        // Get the exit code
+        DWORD exitCode;
+        GetExitCodeProcess(command.pid, &exitCode);
+        
+        // Clean up the process handle
+        CloseHandle(command.pid);
+        
+        // Check if the process failed
+        if (exitCode != EXIT_SUCCESS) {
+            ret = true;
+        }
+        
+        // Free the command string if it was allocated
+        if (command.command) {
+            free(command.command);
+        }
+    });
+    
+    // Clear the async array after waiting
+    bh_darray_reset(async);
+    
+    return ret;
+}
+#endif
+
+// test runner: every attempt runs in its own process group inside a fresh
+// BUILD_TEST_DIR/<name> directory, with stdout and stderr going to
+// output.log there. tests start longest first by their recorded
+// durations, so the run ends close to the longest test rather than the
+// sum. shards are cut the same way, so every runner that sees the same
+// command log computes the same split; sharded runs don't record, only
+// full runs update the durations.
+#if __UNIX__
+// tests can leave anything behind, the listing isn't cached
+static void bh_test_remove_tree(const char *path)
+{
+  bh_dir_listing_t listing;
+  if (bh_dir_read(path, &listing)) {
+    bh_dir_listing_foreach(&listing, type, name, {
+      if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+      const char *child = bh_fmt("%s/%s", path, name);
+      if (type == DT_DIR) bh_test_remove_tree(child);
+      else remove(child);
+    });
+    bh_dir_listing_free(&listing);
+  }
+  rmdir(path);
+}
+
+static const char *bh_test_dir(const char *name)
+{
+  char *safe = bh_fmt("%s", name);
+  for (char *p = safe; *p; ++p)
+    if (!strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-.", *p)) *p = '_';
+  return bh_fmt(BUILD_TEST_DIR "/%s-%08x", safe, (unsigned)bh_hash(name, strlen(name)));
+}
+
+typedef struct {
+  int64_t cost;
+  size_t index;
+} bh_test_order_t;
+
+static int bh_test_order_compare(const void *a, const void *b)
+{
+  const bh_test_order_t *x = (const bh_test_order_t *)a, *y = (const bh_test_order_t *)b;
+  if (x->cost != y->cost) return x->cost > y->cost ? -1 : 1;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static bool bh_test_start(bh_test_t *test, const char *root, bh_async_t *running)
+{
+  const char *dir = bh_test_dir(test->name);
+  bh_test_remove_tree(dir);
+  if (!bh_mkdir(dir)) return false;
+  const char *tmp = bh_fmt("%s/%s", root, dir);
+
+  bh_log_flush();
+  pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    setpgid(0, 0);
+    int null = open("/dev/null", O_RDONLY);
+    int log = open(bh_fmt("%s/output.log", tmp), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (chdir(tmp) || null < 0 || log < 0) _exit(127);
+    dup2(null, STDIN_FILENO);
+    dup2(log, STDOUT_FILENO);
+    dup2(log, STDERR_FILENO);
+
+    setenv("BH_TEST_ROOT", root, 1);
+    setenv("BH_TEST_NAME", test->name, 1);
+    setenv("TMPDIR", tmp, 1);
+    execlp("sh", "sh", "-c", test->command, NULL);
+    _exit(127);
+  }
+
+  setpgid(pid, pid);
+  bh_darray_push(running, ((bh_command_t){
+    .pid = pid,
+    .command = (char *)test->name,
+    .started = bh_now_ms(),
+  }));
+  return true;
+}
+#endif
+
+void bh_test_add(bh_tests_t *tests, const char *name, const char *command)
+{
+  bh_darray_push(tests, ((bh_test_t){ .name = name, .command = command, .duration = -1 }));
+}
+
+bool bh_test_run(bh_tests_t *tests, int jobs)
+{
+#if __UNIX__
+  size_t count = bh_darray_len(tests);
+  if (jobs <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cpus > 0 ? (int)cpus : 1;
+  }
+
+  char root[PATH_MAX];
+  if (!getcwd(root, sizeof(root)) || !bh_mkdir(BUILD_TEST_DIR)) return false;
+
+  // what each test took last time, unknown ones count as the average
+  bh_test_order_t *order = (bh_test_order_t *)malloc((count ? count : 1) * sizeof(bh_test_order_t));
+  int64_t known = 0, total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    bh_test_t *test = &tests->items[i];
+    test->duration = bh_command_duration(bh_fmt("test:%s", test->name));
+    test->attempts = 0;
+    test->passed = test->flaky = test->skipped = false;
+    if (test->duration >= 0) {
+      known++;
+      total += test->duration;
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    int64_t duration = tests->items[i].duration;
+    order[i] = (bh_test_order_t){ duration >= 0 ? duration : known ? total / known : 1000, i };
+  }
+  qsort(order, count, sizeof(bh_test_order_t), bh_test_order_compare);
+
+  // --shard K/N: longest first into the least loaded shard, keep the K-th
+  size_t selected = count;
+  if (build_options.shard_count > 1) {
+    int64_t *loads = (int64_t *)calloc(build_options.shard_count, sizeof(int64_t));
+    selected = 0;
+    for (size_t i = 0; i < count; ++i) {
+      int lightest = 0;
+      for (int s = 1; s < build_options.shard_count; ++s)
+        if (loads[s] < loads[lightest]) lightest = s;
+      loads[lightest] += order[i].cost;
+
+      if (lightest == build_options.shard_index - 1) order[selected++] = order[i];
+      else tests->items[order[i].index].skipped = true;
+    }
+    free(loads);
+  }
+
+  int64_t timeout = (build_options.job_timeout > 0 ? build_options.job_timeout : BUILD_JOB_TIMEOUT) * (int64_t)1000;
+  int64_t start = bh_now_ms(), sum = 0;
+  bh_async_t running = { 0 };
+  bh_str_ids_t retries = { 0 };   // tests to run again, by index
+  size_t *which = (size_t *)malloc((size_t)jobs * sizeof(size_t));
+  size_t next = 0, passed = 0, failed = 0, flaky = 0;
+
+  struct sigaction action = { .sa_handler = bh_await_on_signal }, old_int, old_term;
+  sigemptyset(&action.sa_mask);
+  bh_await_signal = 0;
+  sigaction(SIGINT, &action, &old_int);
+  sigaction(SIGTERM, &action, &old_term);
+
+  while ((next < selected || bh_darray_len(&retries) || bh_darray_len(&running)) && !bh_await_signal) {
+    while (bh_darray_len(&running) < (size_t)jobs && (bh_darray_len(&retries) || next < selected)) {
+      size_t index = bh_darray_len(&retries) ? retries.items[--retries.count] : order[next++].index;
+      which[bh_darray_len(&running)] = index;
+      if (!bh_test_start(&tests->items[index], root, &running)) {
+        bh_logf(BH_LOG_ERROR, "failed to start test `%s`.\n", tests->items[index].name);
+        tests->items[index].attempts = 1 + BUILD_TEST_RERUNS;
+        failed++;
+      }
+    }
+
+    poll(NULL, 0, 5);
+    bh_async_poll(&running);
+    int64_t now = bh_now_ms();
+
+    for (size_t i = bh_darray_len(&running); i-- > 0;) {
+      bh_command_t *job = &running.items[i];
+      bh_test_t *test = &tests->items[which[i]];
+
+      if (job->state == BH_JOB_RUNNING && timeout && now - job->started >= timeout) {
+        bh_logf(BH_LOG_ERROR, "test `%s` timed out after %llds.\n", test->name, (long long)(timeout / 1000));
+        bh_job_stop(job, now);
+      } else if (job->state == BH_JOB_STOPPING && now - job->stopping >= BUILD_JOB_KILL_GRACE_MS) {
+        killpg(job->pid, SIGKILL);
+        job->state = BH_JOB_KILLED;
+      }
+      if (job->state != BH_JOB_DONE) continue;
+
+      test->attempts++;
+      test->duration = now - job->started;
+      sum += test->duration;
+      bool ok = !job->failed && !job->stopping;
+      const char *dir = bh_test_dir(test->name);
+
+      if (ok) {
+        test->passed = true;
+        test->flaky = test->attempts > 1;
+        passed++;
+        flaky += test->flaky;
+        // a shard keeps the log as it found it, or the next shard would cut
+        // a different split and run some tests twice and others never
+        if (build_options.shard_count <= 1)
+          bh_command_record(bh_fmt("test:%s", test->name), test->command, test->duration);
+        if (test->flaky) bh_logf(BH_LOG_WARN, "test `%s` is flaky: passed on attempt %d.\n", test->name, test->attempts);
+        else bh_logf(BH_LOG_DEBUG, "test `%s` passed in %lld ms.\n", test->name, (long long)test->duration);
+        bh_test_remove_tree(dir);
+      } else if (test->attempts <= BUILD_TEST_RERUNS && !job->stopping) {
+        bh_logf(BH_LOG_WARN, "test `%s` failed, running it again.\n", test->name);
+        bh_darray_push(&retries, (bh_str_id)which[i]);
+      } else {
+        size_t len = 0;
+        char *output = bh_read_all(bh_fmt("%s/output.log", dir), &len);
+        bh_logf(BH_LOG_ERROR, "test `%s` failed (%s/output.log):\n%s", test->name, dir, output ? output : "");
+        free(output);
+        failed++;
+      }
+
+      // the last job takes this one's place
+      size_t last = bh_darray_len(&running) - 1;
+      running.items[i] = running.items[last];
+      which[i] = which[last];
+      running.count--;
+    }
+  }
+
+  // ^C: stop what is still running, then pass the signal on
+  for (size_t i = 0; i < bh_darray_len(&running); ++i) {
+    killpg(running.items[i].pid, SIGKILL);
+    waitpid(running.items[i].pid, NULL, 0);
+  }
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+
+  bh_logf(BH_LOG_INFO, "%zu tests: %zu passed (%zu flaky), %zu failed, %zu in other shards; %.2fs, %.2fs of test time\n",
+    selected, passed, flaky, failed, count - selected, (bh_now_ms() - start) / 1000.0, sum / 1000.0);
+
+  // the slowest ones, by their last attempt
+  size_t ran = 0;
+  for (size_t i = 0; i < count; ++i)
+    if (tests->items[i].attempts) order[ran++] = (bh_test_order_t){ tests->items[i].duration, i };
+  qsort(order, ran, sizeof(bh_test_order_t), bh_test_order_compare);
+  for (size_t i = 0; i < ran && i < BUILD_TEST_SLOWEST; ++i)
+    bh_logf(BH_LOG_INFO, "  %6lld ms  %s\n", (long long)order[i].cost, tests->items[order[i].index].name);
+
+  free(order);
+  free(which);
+  bh_darray_free(&running);
+  bh_darray_free(&retries);
+  bh_log_flush();
+  if (bh_await_signal) raise(bh_await_signal);
+
+  return !failed && passed == selected;
+#else
+  (void)tests;
+  (void)jobs;
+  bh_log(BH_LOG_ERROR, "the test runner needs a unix.\n");
+  return false;
+#endif
+}
+
+// dependency tracing: runs a command and reports the files under the
+// current directory it read and wrote. the LD_PRELOAD shim at the top of
+// this file is compiled on first use; static binaries, and machines
+// without a compiler, need the ptrace tracer (linux x86_64) instead.
+static bh_trace_t bh_trace_mode = BH_TRACE_AUTO;
+
+bh_trace_t bh_trace_use(bh_trace_t mode)
+{
+  bh_trace_mode = mode;
+  return mode;
+}
+
+#if __linux__
+// builds the shim from this header when it is missing or older
+static const char *bh_trace_shim(void)
+{
+  static char shim[PATH_MAX];
+  static int state;       // 0 not tried, 1 built, -1 failed
+  if (state) return state > 0 ? shim : NULL;
+  state = -1;
+
+  int64_t header = bh_stat_mtime_ns(__FILE__);
+  if (header < 0) {
+    bh_logf(BH_LOG_DEBUG, "can't find `%s` to build the trace shim.\n", __FILE__);
+    return NULL;
+  }
+
+  if (bh_stat_mtime_ns(BUILD_TRACE_SHIM_PATH) < header) {
+    bh_mkdir(".build_cache");
+    const char *command = bh_fmt(BUILD_TRACE_CC " -shared -fPIC -O2 -DBUILD_TRACE_SHIM_BUILD -x c '%s' -o " BUILD_TRACE_SHIM_PATH " -ldl 2>/dev/null", __FILE__);
+    if (system(command) != 0) {
+      bh_logf(BH_LOG_DEBUG, "failed to build the trace shim: %s\n", command);
+      return NULL;
+    }
+  }
+
+  // children change directories, the path has to be absolute
+  if (!realpath(BUILD_TRACE_SHIM_PATH, shim)) return NULL;
+  state = 1;
+  return shim;
+}
+
+static bool bh_trace_preload(const char *command, const char *shim, const char *log)
+{
+  const char *previous = getenv("LD_PRELOAD");
+  char *saved = previous ? strdup(previous) : NULL;
+  setenv("LD_PRELOAD", saved ? bh_fmt("%s:%s", shim, saved) : shim, 1);
+  setenv("BH_TRACE_FILE", log, 1);
+
+  // forked with the variables set, then the driver gets its own back
+  bh_async_t job = { 0 };
+  bool ok = bh_push_async(&job, command);
+  if (saved) setenv("LD_PRELOAD", saved, 1);
+  else unsetenv("LD_PRELOAD");
+  unsetenv("BH_TRACE_FILE");
+  free(saved);
+
+  if (ok) {
+    job.items[0].command = NULL;
+    ok = !bh_await(&job);
+  }
+  bh_darray_free(&job);
+  return ok;
+}
+
+#if defined(__x86_64__)
+// appends the path at `addr` in the tracee, relative to `dirfd`
+static void bh_trace_path(FILE *log, pid_t pid, long dirfd, unsigned long long addr, bool write)
+{
+  char path[PATH_MAX];
+  size_t len = 0;
+  bool terminated = false;
+
+  // page by page, the string can end right before an unmapped one
+  while (!terminated && len < sizeof(path)) {
+    size_t chunk = 4096 - ((addr + len) & 4095);
+    if (chunk > sizeof(path) - len) chunk = sizeof(path) - len;
+
+    struct iovec local = { path + len, chunk }, remote = { (void *)(uintptr_t)(addr + len), chunk };
+    long n = syscall(SYS_process_vm_readv, pid, &local, 1, &remote, 1, 0);
+    if (n <= 0) return;
+    terminated = memchr(path + len, 0, n) != NULL;
+    len += n;
+  }
+  if (!terminated || !path[0]) return;
+
+  char dir[PATH_MAX] = "";
+  if (path[0] != '/') {
+    char link[64];
+    if ((int)dirfd == AT_FDCWD) snprintf(link, sizeof(link), "/proc/%d/cwd", (int)pid);
+    else snprintf(link, sizeof(link), "/proc/%d/fd/%d", (int)pid, (int)dirfd);
+
+    ssize_t n = readlink(link, dir, sizeof(dir) - 2);
+    if (n <= 0) return;
+    dir[n] = '/';
+    dir[n + 1] = 0;
+  }
+
+  fprintf(log, "%c %s%s\n", write ? 'w' : 'r', dir, path);
+}
+
+static void bh_trace_syscall(FILE *log, pid_t pid)
+{
+  struct user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, pid, 0, &regs) != 0) return;
+
+  // entry stops still have -ENOSYS in rax, exits have the result
+  if ((long long)regs.rax != -ENOSYS) return;
+
+  int writes = O_WRONLY | O_RDWR | O_CREAT | O_TRUNC;
+  switch (regs.orig_rax) {
+    case SYS_open: bh_trace_path(log, pid, AT_FDCWD, regs.rdi, regs.rsi & writes); break;
+    case SYS_creat: bh_trace_path(log, pid, AT_FDCWD, regs.rdi, true); break;
+    case SYS_openat: bh_trace_path(log, pid, (long)regs.rdi, regs.rsi, regs.rdx & writes); break;
+    case SYS_stat:
+    case SYS_lstat:
+    case SYS_access:
+    case SYS_readlink:
+    case SYS_execve: bh_trace_path(log, pid, AT_FDCWD, regs.rdi, false); break;
+    case SYS_newfstatat:
+    case SYS_faccessat:
+    case SYS_statx:
+    case SYS_execveat: bh_trace_path(log, pid, (long)regs.rdi, regs.rsi, false); break;
+#ifdef SYS_faccessat2
+    case SYS_faccessat2: bh_trace_path(log, pid, (long)regs.rdi, regs.rsi, false); break;
+#endif
+#ifdef SYS_openat2
+    case SYS_openat2: {
+      uint64_t flags = 0;
+      struct iovec local = { &flags, 8 }, remote = { (void *)(uintptr_t)regs.rdx, 8 };
+      syscall(SYS_process_vm_readv, pid, &local, 1, &remote, 1, 0);
+      bh_trace_path(log, pid, (long)regs.rdi, regs.rsi, flags & writes);
+    } break;
+#endif
+  }
+}
+
+// follows the command and everything it forks through their syscall
+// stops. much slower than the shim, but it sees static binaries too.
+static bool bh_trace_ptrace(const char *command, const char *log_path)
+{
+  FILE *log = fopen(log_path, "wb");
+  if (!log) return false;
+
+  bh_log_flush();
+  pid_t child = fork();
+  if (child < 0) {
+    fclose(log);
+    return false;
+  }
+  if (child == 0) {
+    setpgid(0, 0);
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    raise(SIGSTOP);
+    execlp("sh", "sh", "-c", command, NULL);
+    _exit(127);
+  }
+  setpgid(child, child);
+
+  int status;
+  if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status)) {
+    fclose(log);
+    return false;
+  }
+  ptrace(PTRACE_SETOPTIONS, child, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK |
+    PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+  ptrace(PTRACE_SYSCALL, child, 0, 0);
+
+  // the whole process group, so other children of the driver aren't reaped
+  int result = -1;
+  for (;;) {
+    pid_t pid = waitpid(-child, &status, __WALL);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (pid == child) result = status;
+      continue;
+    }
+    if (!WIFSTOPPED(status)) continue;
+
+    // new processes start with a SIGSTOP of their own, events carry none
+    int sig = WSTOPSIG(status), deliver = 0;
+    if (sig == (SIGTRAP | 0x80)) bh_trace_syscall(log, pid);
+    else if (!(status >> 16) && sig != SIGSTOP) deliver = sig;
+    ptrace(PTRACE_SYSCALL, pid, 0, deliver);
+  }
+
+  fclose(log);
+  return result >= 0 && WIFEXITED(result) && WEXITSTATUS(result) == EXIT_SUCCESS;
+}
+#endif
+#endif
+
+// resolves `.` and `..` in an absolute path, in place
+static void bh_trace_normalize(char *path)
+{
+  char *out = path;
+  for (char *p = path; *p;) {
+    while (*p == '/') ++p;
+    char *end = p;
+    while (*end && *end != '/') ++end;
+    size_t len = end - p;
+
+    if (len == 1 && p[0] == '.') {
+      // nothing
+    } else if (len == 2 && p[0] == '.' && p[1] == '.') {
+      while (out > path && *--out != '/');
+    } else if (len) {
+      *out++ = '/';
+      memmove(out, p, len);
+      out += len;
+    }
+    p = end;
+  }
+
+  if (out == path) *out++ = '/';
+  *out = 0;
+}
+
+// the log as lists of existing files under the current directory, inputs
+// being read and never written
+static void bh_trace_collect(const char *log_path, bh_files_t *inputs, bh_files_t *outputs)
+{
+  size_t len;
+  char *text = bh_read_all(log_path, &len);
+  if (!text) return;
+
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    free(text);
+    return;
+  }
+  size_t cwd_len = strlen(cwd);
+
+  bh_intern_t reads = { 0 }, writes = { 0 };
+  for (char *line = text, *next; line < text + len; line = next) {
+    char *eol = strchr(line, '\n');
+    if (eol) *eol = 0;
+    next = eol ? eol + 1 : text + len;
+    if (strlen(line) < 3 || line[2] != '/') continue;
+
+    char *path = line + 2;
+    bh_trace_normalize(path);
+    if (strncmp(path, cwd, cwd_len) || path[cwd_len] != '/') continue;
+
+    const char *relative = path + cwd_len + 1;
+    if (!strncmp(relative, ".build_cache/", 13)) continue;
+    bh_intern(line[0] == 'w' ? &writes : &reads, relative);
+  }
+
+  for (size_t l = 0; l < 2; ++l) {
+    bh_intern_t *table = l ? &writes : &reads;
+    bh_files_t *list = l ? outputs : inputs;
+    if (!list) continue;
+
+    for (bh_str_id id = 0; id < table->count; ++id) {
+      const char *path = bh_intern_str(table, id);
+      struct stat st;
+      if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+      if (!l && bh_intern_find(&writes, path, strlen(path)) != BH_STR_ID_NONE) continue;
+
+      char *item = build_intern ?
+        (char *)bh_intern_str(build_intern, bh_intern(build_intern, path)) :
+        bh_sv_to_cstr(build_arena, bh_sv_from_cstr(path));
+      bh_darray_push(list, item);
+    }
+  }
+
+  bh_intern_free(&reads);
+  bh_intern_free(&writes);
+  free(text);
+}
+
+bool bh_execute_traced(const char *command, bh_files_t *inputs, bh_files_t *outputs)
+{
+#if __linux__
+  bh_mkdir(".build_cache");
+  char log[PATH_MAX];
+  if (!realpath(".build_cache", log)) return false;
+  strncat(log, bh_fmt("/trace.%d.log", (int)getpid()), sizeof(log) - strlen(log) - 1);
+  remove(log);
+
+  command = bh_command_rsp(command);
+#ifdef BUILD_EXECUTE_LOG
+  bh_logf(BH_LOG_INFO, "$ %s\n", command);
+#endif
+
+  const char *shim = bh_trace_mode != BH_TRACE_PTRACE ? bh_trace_shim() : NULL;
+  bool ok;
+  if (shim) {
+    ok = bh_trace_preload(command, shim, log);
+  } else if (bh_trace_mode == BH_TRACE_PRELOAD) {
+    bh_logf(BH_LOG_ERROR, "can't trace `%s`: failed to build the trace shim.\n", command);
+    return false;
+  } else {
+#if defined(__x86_64__)
+    ok = bh_trace_ptrace(command, log);
+#else
+    bh_logf(BH_LOG_ERROR, "can't trace `%s`: the shim isn't available and ptrace tracing needs x86_64.\n", command);
+    return false;
+#endif
+  }
+
+  bh_trace_collect(log, inputs, outputs);
+  remove(log);
+  return ok;
+#else
+  (void)inputs;
+  (void)outputs;
+  bh_logf(BH_LOG_WARN, "tracing is linux only, running `%s` untraced.\n", command);
+  return bh_execute(command);
+#endif
+}
+
+bool bh_depfile_read(const char *path, bh_files_t *deps)
+{
+  char *file = bh_file_read(path);
+  if (!file) return false;
+
+  bh_depfile_parse(file, deps);
+  return true;
+}
+
+void bh_depfile_parse(const char *text, bh_files_t *deps)
+{
+  // make-style rules, lone backslashes are line continuations and
+  // words ending in `:` are targets (including `-MP` phony ones).
+  bh_sv_t rest = bh_sv_from_cstr(text);
+  while (rest.len) {
+    bh_sv_t word = bh_sv_chop_word(&rest);
+    if (!word.len || bh_sv_eq(word, bh_sv_from_cstr("\\"))) continue;
+    if (word.data[word.len - 1] == ':') continue;
+
+    // shared header paths are stored once across every dependency list
+    char *item = build_intern ?
+      (char *)bh_intern_str(build_intern, bh_intern_n(build_intern, word.data, word.len)) :
+      bh_sv_to_cstr(build_arena, word);
+
+    bh_darray_push(deps, item);
+  }
+}
+
+// keeps the per-id side tables as large as the path table
+static void bh_graph_grow(bh_graph_t *graph)
+{
+  size_t count = graph->paths.count;
+
+  if (count > graph->mtimes_size) {
+    size_t size = graph->mtimes_size ? graph->mtimes_size : 64;
+    while (size < count) size *= 2;
+
+    graph->mtimes = (int64_t *)realloc(graph->mtimes, size * sizeof(int64_t));
+    for (size_t i = graph->mtimes_size; i < size; ++i)
+      graph->mtimes[i] = -2;
+    graph->mtimes_size = size;
+  }
+
+  if (count > graph->producers_size) {
+    size_t size = graph->producers_size ? graph->producers_size : 64;
+    while (size < count) size *= 2;
+
+    graph->producers = (size_t *)realloc(graph->producers, size * sizeof(size_t));
+    memset(graph->producers + graph->producers_size, 0, (size - graph->producers_size) * sizeof(size_t));
+    graph->producers_size = size;
+  }
+}
+
+static int64_t bh_graph_mtime(bh_graph_t *graph, bh_str_id id)
+{
+  bh_graph_grow(graph);
+
+  if (graph->mtimes[id] == -2)
+    graph->mtimes[id] = bh_stat_mtime_ns(bh_intern_str(&graph->paths, id));
+
+  return graph->mtimes[id];
+}
+
+// 0 when the file can't be read
+static uint64_t bh_file_digest(const char *path)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp) return 0;
+
+  // FNV-1a like bh_hash, fed a block at a time
+  uint64_t hash = 14695981039346656037ULL;
+  unsigned char buffer[64 * 1024];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    for (size_t i = 0; i < n; ++i) {
+      hash ^= buffer[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  fclose(fp);
+  return hash ? hash : 1;
+}
+
+static bool bh_set_mtime_ns(const char *path, int64_t mtime)
+{
+#if __UNIX__
+  struct timespec times[2] = {
+    { .tv_nsec = UTIME_OMIT },
+    { .tv_sec = mtime / 1000000000, .tv_nsec = mtime % 1000000000 },
+  };
+  return utimensat(AT_FDCWD, path, times, 0) == 0;
+#else
+  (void)path;
+  (void)mtime;
+  return false;
+#endif
+}
+
+// the log entry of a restat target, if it still describes the file on disk
+static bh_command_entry_t *bh_graph_restat_entry(bh_graph_t *graph, bh_target_t *target)
+{
+  if (!target->restat) return NULL;
+
+  int64_t mtime = bh_graph_mtime(graph, target->output);
+  bh_command_entry_t *entry = bh_command_entry(bh_intern_str(&graph->paths, target->output));
+  return entry && entry->digest && entry->mtime == mtime && mtime >= 0 ? entry : NULL;
+}
+
+// the mtime dependents compare against, which for a restat output is when
+// its content last changed
+static int64_t bh_graph_input_mtime(bh_graph_t *graph, bh_str_id id)
+{
+  size_t producer = graph->producers[id];
+  if (producer) {
+    bh_target_t *target = bh_graph_target(graph, producer - 1);
+    bh_command_entry_t *entry = target->output == id ? bh_graph_restat_entry(graph, target) : NULL;
+    if (entry) return entry->logical;
+  }
+
+  return bh_graph_mtime(graph, id);
+}
+
+size_t bh_graph_add(bh_graph_t *graph, const char *output, bh_files_t *inputs, const char *command)
+{
+  bh_target_t target = { 0 };
+  target.output = bh_intern(&graph->paths, output);
+  target.command = bh_intern(&graph->commands, command);
+  target.depfile = BH_STR_ID_NONE;
+  target.depfile_mtime = -2;
+
+  if (inputs) {
+    for (size_t i = 0; i < bh_darray_len(inputs); ++i)
+      bh_darray_push(&target.inputs, bh_intern(&graph->paths, inputs->items[i]));
+  }
+
+  bh_darray_push(&graph->targets, target);
+  size_t index = bh_darray_len(&graph->targets) - 1;
+
+  bh_graph_grow(graph);
+  graph->producers[target.output] = index + 1;
+
+  return index;
+}
+
+void bh_graph_set_restat(bh_graph_t *graph, size_t target, bh_restat_t restat)
+{
+  bh_graph_target(graph, target)->restat = (uint8_t)restat;
+}
+
+void bh_graph_set_depfile(bh_graph_t *graph, size_t target, const char *depfile)
+{
+  bh_target_t *t = bh_graph_target(graph, target);
+  t->depfile = bh_intern(&graph->paths, depfile);
+  t->depfile_mtime = -2;
+
+  bh_graph_grow(graph);
+  graph->producers[t->depfile] = target + 1;
+}
+
+// the command is traced and what it reads becomes the depfile, so tools
+// without a -MD of their own get precise rebuilds too
+void bh_graph_set_traced(bh_graph_t *graph, size_t target)
+{
+  const char *output = bh_intern_str(&graph->paths, bh_graph_target(graph, target)->output);
+  bh_graph_set_depfile(graph, target, bh_fmt(".build_cache/deps/%016llx.d", (unsigned long long)bh_hash(output, strlen(output))));
+  bh_graph_target(graph, target)->traced = true;
+}
+
+// runs a traced target and writes what it read as its depfile
+static bool bh_graph_run_traced(bh_graph_t *graph, bh_target_t *target)
+{
+  const char *output = bh_intern_str(&graph->paths, target->output);
+  bh_files_t inputs = { 0 };
+  if (!bh_execute_traced(bh_intern_str(&graph->commands, target->command), &inputs, NULL)) {
+    bh_darray_free(&inputs);
+    return false;
+  }
+
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bh_sb_append(&sb, output);
+  bh_sb_append_char(&sb, ':');
+  for (size_t i = 0; i < bh_darray_len(&inputs); ++i) {
+    // depfiles have no quoting here, such paths can't be tracked
+    if (strpbrk(inputs.items[i], " \t\\") || !strcmp(inputs.items[i], output)) continue;
+    bh_sb_append_char(&sb, ' ');
+    bh_sb_append(&sb, inputs.items[i]);
+  }
+  bh_sb_append_char(&sb, '\n');
+  char *text = bh_sb_finish(&sb);
+
+  bh_darray_free(&inputs);
+  bh_mkdir(".build_cache/deps");
+  return bh_file_write(bh_intern_str(&graph->paths, target->depfile), text, strlen(text));
+}
+
+// re-reads the depfile only when it changed since the last look
+static void bh_graph_load_depfile(bh_graph_t *graph, bh_target_t *target)
+{
+  if (target->depfile == BH_STR_ID_NONE) return;
+
+  int64_t mtime = bh_graph_mtime(graph, target->depfile);
+  if (mtime == target->depfile_mtime) return;
+
+  bh_darray_reset(&target->implicit);
+  target->depfile_mtime = mtime;
+  if (mtime < 0) return;
+
+  bh_files_t deps = { 0 };
+  if (bh_depfile_read(bh_intern_str(&graph->paths, target->depfile), &deps)) {
+    for (size_t i = 0; i < bh_darray_len(&deps); ++i)
+      bh_darray_push(&target->implicit, bh_intern(&graph->paths, deps.items[i]));
+  }
+
+  bh_darray_free(&deps);
+  bh_graph_grow(graph);
+}
+
+// stats every path that isn't cached yet in one batch
+static void bh_graph_stat_pending(bh_graph_t *graph)
+{
+  bh_graph_grow(graph);
+
+  size_t count = 0;
+  for (size_t id = 0; id < graph->paths.count; ++id)
+    count += graph->mtimes[id] == -2;
+  if (!count) return;
+
+  const char **paths = (const char **)malloc(count * sizeof(char *));
+  bh_str_id *ids = (bh_str_id *)malloc(count * sizeof(bh_str_id));
+  int64_t *mtimes = (int64_t *)malloc(count * sizeof(int64_t));
+
+  for (size_t id = 0, n = 0; id < graph->paths.count; ++id) {
+    if (graph->mtimes[id] != -2) continue;
+    paths[n] = bh_intern_str(&graph->paths, id);
+    ids[n++] = id;
+  }
+
+  bh_stat_many(paths, count, mtimes);
+  for (size_t i = 0; i < count; ++i)
+    graph->mtimes[ids[i]] = mtimes[i];
+
+  free(paths);
+  free(ids);
+  free(mtimes);
+}
+
+// front loads the i/o of the staleness pass: every mtime, then every
+// depfile that changed, then the headers those depfiles brought in
+static void bh_graph_prefetch(bh_graph_t *graph)
+{
+  bh_graph_stat_pending(graph);
+
+  size_t count = 0;
+  for (size_t i = 0; i < bh_darray_len(&graph->targets); ++i) {
+    bh_target_t *target = bh_graph_target(graph, i);
+    count += target->depfile != BH_STR_ID_NONE && graph->mtimes[target->depfile] >= 0 &&
+      graph->mtimes[target->depfile] != target->depfile_mtime;
+  }
+  if (!count) return;
+
+  const char **paths = (const char **)malloc(count * sizeof(char *));
+  size_t *targets = (size_t *)malloc(count * sizeof(size_t));
+  char **data = (char **)malloc(count * sizeof(char *));
+  size_t *lens = (size_t *)malloc(count * sizeof(size_t));
+
+  for (size_t i = 0, n = 0; i < bh_darray_len(&graph->targets); ++i) {
+    bh_target_t *target = bh_graph_target(graph, i);
+    if (target->depfile == BH_STR_ID_NONE || graph->mtimes[target->depfile] < 0 ||
+        graph->mtimes[target->depfile] == target->depfile_mtime) continue;
+    paths[n] = bh_intern_str(&graph->paths, target->depfile);
+    targets[n++] = i;
+  }
+
+  bh_read_many(paths, count, data, lens);
+
+  // unreadable ones are left to bh_graph_load_depfile, which reports them
+  bh_files_t deps = { 0 };
+  for (size_t i = 0; i < count; ++i) {
+    if (!data[i]) continue;
+
+    bh_target_t *target = bh_graph_target(graph, targets[i]);
+    bh_darray_reset(&target->implicit);
+    target->depfile_mtime = graph->mtimes[target->depfile];
+
+    bh_darray_reset(&deps);
+    bh_depfile_parse(data[i], &deps);
+    for (size_t d = 0; d < bh_darray_len(&deps); ++d)
+      bh_darray_push(&target->implicit, bh_intern(&graph->paths, deps.items[d]));
+    free(data[i]);
+  }
+
+  bh_darray_free(&deps);
+  free(paths);
+  free(targets);
+  free(data);
+  free(lens);
+
+  bh_graph_stat_pending(graph);
+}
+
+static bh_stale_t bh_graph_staleness(bh_graph_t *graph, bh_target_t *target, bh_str_id *culprit)
+{
+  *culprit = BH_STR_ID_NONE;
+
+  int64_t output = bh_graph_mtime(graph, target->output);
+  if (output < 0) return BH_STALE_MISSING_OUTPUT;
+
+  // without a trace the inputs are unknown
+  if (target->traced && bh_graph_mtime(graph, target->depfile) < 0) {
+    *culprit = target->depfile;
+    return BH_STALE_MISSING_INPUT;
+  }
+
+  // a restored mtime can be older than the inputs it was built from
+  bh_command_entry_t *entry = bh_graph_restat_entry(graph, target);
+  if (entry && entry->horizon > output) output = entry->horizon;
+
+  // a missing input is stale too, let the command report it
+  bh_str_ids_t *lists[] = { &target->inputs, &target->implicit };
+  for (size_t l = 0; l < 2; ++l) {
+    for (size_t i = 0; i < bh_darray_len(lists[l]); ++i) {
+      bh_str_id id = lists[l]->items[i];
+      *culprit = id;
+
+      // on a dry run nothing was rebuilt, so ask the producer instead
+      size_t producer = graph->producers[id];
+      if (producer && bh_graph_target(graph, producer - 1) != target &&
+          bh_graph_target(graph, producer - 1)->stale != BH_FRESH)
+        return BH_STALE_DEPENDENCY;
+
+      int64_t input = bh_graph_input_mtime(graph, id);
+      if (input < 0) return BH_STALE_MISSING_INPUT;
+      if (input > output) return BH_STALE_NEWER_INPUT;
+    }
+  }
+
+  *culprit = BH_STR_ID_NONE;
+  if (bh_command_changed(bh_intern_str(&graph->paths, target->output), bh_intern_str(&graph->commands, target->command)))
+    return BH_STALE_COMMAND_CHANGED;
+
+  return BH_FRESH;
+}
+
+enum { BH_MARK_NONE = 0, BH_MARK_VISITING, BH_MARK_DONE, BH_MARK_FAILED };
+
+// records a finished restat target. `digest` and `logical` describe the
+// output before the command ran, digest 0 if there was none.
+static void bh_graph_restat(bh_graph_t *graph, bh_target_t *target, uint64_t digest, int64_t logical, int64_t duration)
+{
+  const char *output = bh_intern_str(&graph->paths, target->output);
+  int64_t mtime = bh_graph_mtime(graph, target->output);
+  uint64_t now = bh_file_digest(output);
+
+  int64_t horizon = -1;
+  bh_str_ids_t *lists[] = { &target->inputs, &target->implicit };
+  for (size_t l = 0; l < 2; ++l) {
+    for (size_t i = 0; i < bh_darray_len(lists[l]); ++i) {
+      int64_t input = bh_graph_input_mtime(graph, lists[l]->items[i]);
+      if (input > horizon) horizon = input;
+    }
+  }
+
+  if (now && now == digest) {
+    bh_logf(BH_LOG_DEBUG, "`%s` didn't change, its dependents are up to date.\n", output);
+    if (target->restat == BH_RESTAT_MTIME && bh_set_mtime_ns(output, logical))
+      mtime = graph->mtimes[target->output] = logical;
+  } else {
+    logical = mtime;
+  }
+
+  bh_command_log_load();
+  bh_str_id id = bh_command_log_id(output, strlen(output));
+  build_commands.entries[id] = (bh_command_entry_t){
+    .hash = bh_command_hash(bh_intern_str(&graph->commands, target->command)),
+    .duration = duration,
+    .digest = now,
+    .mtime = mtime,
+    .logical = logical,
+    .horizon = horizon,
+  };
+  bh_command_log_append(id);
+}
+
+static bool bh_graph_visit(bh_graph_t *graph, size_t index)
+{
+  bh_target_t *target = bh_graph_target(graph, index);
+
+  switch (target->mark) {
+    case BH_MARK_DONE: return true;
+    case BH_MARK_FAILED: return false;
+    case BH_MARK_VISITING:
+      bh_logf(BH_LOG_ERROR, "dependency cycle through `%s`.\n", bh_intern_str(&graph->paths, target->output));
+      return false;
+  }
+
+  target->mark = BH_MARK_VISITING;
+  bh_graph_load_depfile(graph, target);
+
+  bool ok = true;
+  bh_str_ids_t *lists[] = { &target->inputs, &target->implicit };
+  for (size_t l = 0; l < 2 && ok; ++l) {
+    for (size_t i = 0; i < bh_darray_len(lists[l]) && ok; ++i) {
+      size_t producer = graph->producers[lists[l]->items[i]];
+      if (producer && producer - 1 != index)
+        ok = bh_graph_visit(graph, producer - 1);
+    }
+  }
+
+  bh_str_id culprit = BH_STR_ID_NONE;
+  target->stale = ok ? bh_graph_staleness(graph, target, &culprit) : BH_FRESH;
+
+  if (ok && target->stale != BH_FRESH && build_options.explain) {
+    bh_explain(bh_intern_str(&graph->paths, target->output), target->stale,
+               culprit == BH_STR_ID_NONE ? NULL : bh_intern_str(&graph->paths, culprit));
+  } else if (ok && target->stale != BH_FRESH) {
+    target->stale = BH_FRESH;
+    const char *output = bh_intern_str(&graph->paths, target->output);
+
+    // what the output was before, for the early cutoff
+    uint64_t digest = 0;
+    int64_t logical = -1;
+    if (target->restat) {
+      bh_command_entry_t *entry = bh_graph_restat_entry(graph, target);
+      logical = entry ? entry->logical : bh_graph_mtime(graph, target->output);
+      digest = entry ? entry->digest : logical >= 0 ? bh_file_digest(output) : 0;
+    }
+
+    int64_t start = bh_now_ms();
+    ok = target->traced ? bh_graph_run_traced(graph, target) : bh_execute(bh_intern_str(&graph->commands, target->command));
+    int64_t duration = bh_now_ms() - start;
+    if (!ok) bh_logf(BH_LOG_ERROR, "failed to build `%s`.\n", output);
+
+    // the command rewrote these
+    graph->mtimes[target->output] = -2;
+    if (target->depfile != BH_STR_ID_NONE) {
+      graph->mtimes[target->depfile] = -2;
+      bh_graph_load_depfile(graph, target);
+    }
+
+    if (ok && target->restat)
+      bh_graph_restat(graph, target, digest, logical, duration);
+    else if (ok)
+      bh_command_record(output, bh_intern_str(&graph->commands, target->command), duration);
+  }
+
+  target->mark = ok ? BH_MARK_DONE : BH_MARK_FAILED;
+  return ok;
+}
+
+// `cc ... -c src.c`, the first input being the source
+static bool bh_graph_is_compile(bh_graph_t *graph, bh_target_t *target)
+{
+  if (!bh_darray_len(&target->inputs)) return false;
+
+  bh_sv_t source = bh_sv_from_cstr(bh_intern_str(&graph->paths, target->inputs.items[0]));
+  const char *exts[] = { ".c", ".cc", ".cpp", ".cxx", ".m", ".mm" };
+  bool is_source = false;
+  for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]) && !is_source; ++i)
+    is_source = bh_sv_ends_with(source, bh_sv_from_cstr(exts[i]));
+  if (!is_source) return false;
+
+  bh_sv_t command = bh_sv_from_cstr(bh_intern_str(&graph->commands, target->command));
+  while (command.len) {
+    if (bh_sv_eq(bh_sv_chop_word(&command), bh_sv_from_cstr("-c"))) return true;
+  }
+  return false;
+}
+
+bool bh_graph_build(bh_graph_t *graph)
+{
+  bh_graph_grow(graph);
+
+  // compile targets go to the compilation database, which is only rewritten
+  // when one of their commands changed
+  if (!build_options.explain) {
+    for (size_t i = 0; i < bh_darray_len(&graph->targets); ++i) {
+      bh_target_t *target = bh_graph_target(graph, i);
+      if (bh_graph_is_compile(graph, target))
+        bh_compdb_add(bh_intern_str(&graph->paths, target->inputs.items[0]),
+          bh_intern_str(&graph->paths, target->output), bh_intern_str(&graph->commands, target->command));
+    }
+    bh_compdb_flush();
+  }
+  // the listings the plan walked, once per build
+  bh_dircache_flush();
+
+  for (size_t i = 0; i < bh_darray_len(&graph->targets); ++i) {
+    bh_graph_target(graph, i)->mark = BH_MARK_NONE;
+    bh_graph_target(graph, i)->stale = BH_FRESH;
+  }
+
+  bh_graph_prefetch(graph);
+
+  // independent targets still build with -k, dependents of a failure don't
+  bool ok = true;
+  for (size_t i = 0; i < bh_darray_len(&graph->targets) && (ok || build_options.keep_going); ++i)
+    ok &= bh_graph_visit(graph, i);
+  if (!ok) return false;
+
+  if (build_options.explain) {
+    size_t stale = 0;
+    for (size_t i = 0; i < bh_darray_len(&graph->targets); ++i)
+      stale += bh_graph_target(graph, i)->stale != BH_FRESH;
+    bh_logf(BH_LOG_INFO, "explain: %zu of %zu targets out of date\n", stale, bh_darray_len(&graph->targets));
+  }
+
+  return true;
+}
+
+void bh_graph_invalidate(bh_graph_t *graph, const char *path)
+{
+  bh_str_id id = bh_intern_find(&graph->paths, path, strlen(path));
+  if (id != BH_STR_ID_NONE && id < graph->mtimes_size)
+    graph->mtimes[id] = -2;
+}
+
+// drops the targets but keeps interned paths and the stat cache
+void bh_graph_reset(bh_graph_t *graph)
+{
+  for (size_t i = 0; i < bh_darray_len(&graph->targets); ++i) {
+    bh_darray_free(&graph->targets.items[i].inputs);
+    bh_darray_free(&graph->targets.items[i].implicit);
+  }
+
+  bh_darray_reset(&graph->targets);
+  if (graph->producers)
+    memset(graph->producers, 0, graph->producers_size * sizeof(size_t));
+}
+
+void bh_graph_free(bh_graph_t *graph)
+{
+  bh_graph_reset(graph);
+  bh_darray_free(&graph->targets);
+  bh_intern_free(&graph->paths);
+  bh_intern_free(&graph->commands);
+  free(graph->mtimes);
+  free(graph->producers);
+  memset(graph, 0, sizeof(*graph));
+}
+
+// ninja escapes `$`, spaces and colons in paths with a `$`
+static void bh_ninja_path(bh_sb_t *sb, const char *path)
+{
+  for (const char *c = path; *c; ++c) {
+    if (*c == '$' || *c == ' ' || *c == ':') bh_sb_append_char(sb, '$');
+    bh_sb_append_char(sb, *c);
+  }
+}
+
+bool bh_graph_write_ninja(bh_graph_t *graph, const char *path)
+{
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+
+  bh_sb_append(&sb,
+    "# generated by build.h\n"
+    "ninja_required_version = 1.3\n\n"
+    "rule run\n  command = $cmd\n  description = $out\n\n"
+    "rule run_deps\n  command = $cmd\n  description = $out\n  depfile = $depfile\n  deps = gcc\n\n");
+
+  for (size_t i = 0; i < bh_darray_len(&graph->targets); ++i) {
+    bh_target_t *target = bh_graph_target(graph, i);
+    const char *command = bh_intern_str(&graph->commands, target->command);
+
+    if (strchr(command, '\n')) {
+      bh_logf(BH_LOG_ERROR, "can't export `%s` to ninja, its command spans lines.\n", bh_intern_str(&graph->paths, target->output));
+      return false;
+    }
+
+    bh_sb_append(&sb, "build ");
+    bh_ninja_path(&sb, bh_intern_str(&graph->paths, target->output));
+    bh_sb_append(&sb, target->depfile == BH_STR_ID_NONE ? ": run" : ": run_deps");
+
+    for (size_t j = 0; j < bh_darray_len(&target->inputs); ++j) {
+      bh_sb_append_char(&sb, ' ');
+      bh_ninja_path(&sb, bh_intern_str(&graph->paths, target->inputs.items[j]));
+    }
+
+    bh_sb_append(&sb, "\n  cmd = ");
+    for (const char *c = command; *c; ++c) {
+      if (*c == '$') bh_sb_append_char(&sb, '$');
+      bh_sb_append_char(&sb, *c);
+    }
+
+    if (target->depfile != BH_STR_ID_NONE) {
+      bh_sb_append(&sb, "\n  depfile = ");
+      bh_ninja_path(&sb, bh_intern_str(&graph->paths, target->depfile));
+    }
+
+    // ninja's restat is the closest thing, it cuts off when the mtime didn't change
+    if (target->restat) bh_sb_append(&sb, "\n  restat = 1");
+
+    bh_sb_append(&sb, "\n\n");
+  }
+
+  return bh_file_write(path, sb.data, sb.len);
+}
+
+// the hash ninja keeps in .ninja_log (v5 and v6)
+static uint64_t bh_ninja_hash(const char *command)
+{
+  const uint64_t m = 0xc6a4a7935bd1e995ull;
+  const int r = 47;
+  size_t len = strlen(command);
+  const unsigned char *data = (const unsigned char *)command;
+  uint64_t h = 0xDECAFBADDECAFBADull ^ (len * m);
+
+  for (; len >= 8; data += 8, len -= 8) {
+    uint64_t k;
+    memcpy(&k, data, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  if (len) {
+    for (size_t i = len; i-- > 0;)
+      h ^= (uint64_t)data[i] << (8 * i);
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// .ninja_log: "<start ms>\t<end ms>\t<mtime>\t<output>\t<command hash>"
+static void bh_ninja_import_log(bh_graph_t *graph, const char *path)
+{
+  size_t len;
+  char *buffer = bh_read_all(path, &len);
+  if (!buffer) return;
+
+  bh_sv_t sv = bh_sv_from_parts(buffer, len);
+  bh_sv_t header = bh_sv_chop_by(&sv, '\n');
+  int version = 0;
+  sscanf(header.data, "# ninja log v%d", &version);
+
+  // v7 switched to a hash we don't implement, keep the durations only
+  bool hashes = version == 5 || version == 6;
+  size_t durations = 0, commands = 0;
+
+  while (sv.len) {
+    bh_sv_t line = bh_sv_chop_by(&sv, '\n');
+    bh_sv_t fields[5];
+    size_t count = 0;
+    while (line.len && count < 5)
+      fields[count++] = bh_sv_chop_by(&line, '\t');
+    if (count < 5) continue;
+
+    bh_str_id output = bh_intern_find(&graph->paths, fields[3].data, fields[3].len);
+    if (output == BH_STR_ID_NONE || output >= graph->producers_size || !graph->producers[output]) continue;
+
+    bh_target_t *target = bh_graph_target(graph, graph->producers[output] - 1);
+    if (target->output != output) continue;
+
+    int64_t duration = strtoll(fields[1].data, NULL, 10) - strtoll(fields[0].data, NULL, 10);
+    const char *command = bh_intern_str(&graph->commands, target->command);
+    const char *name = bh_intern_str(&graph->paths, output);
+
+    // ninja ran this exact command, so it doesn't count as changed here
+    if (hashes && strtoull(fields[4].data, NULL, 16) == bh_ninja_hash(command)) {
+      bh_command_record(name, command, duration);
+      commands++;
+    } else if (!bh_command_changed(name, command)) {
+      bh_command_record(name, command, duration);
+    }
+    durations++;
+  }
+
+  free(buffer);
+  bh_logf(BH_LOG_INFO, "imported %zu durations and %zu commands from `%s`.\n", durations, commands, path);
+}
+
+// .ninja_deps v4: "# ninjadeps\n", version, then records that are either a
+// path (id is its index, followed by a ~id checksum) or the deps of an output
+static void bh_ninja_import_deps(bh_graph_t *graph, const char *path)
+{
+  size_t len;
+  char *buffer = bh_read_all(path, &len);
+  if (!buffer) return;
+
+  const char *magic = "# ninjadeps\n";
+  size_t pos = strlen(magic);
+  uint32_t version = 0;
+  if (len < pos + 4 || memcmp(buffer, magic, pos) || (memcpy(&version, buffer + pos, 4), version != 4)) {
+    bh_logf(BH_LOG_WARN, "`%s` isn't a version 4 ninja deps log.\n", path);
+    free(buffer);
+    return;
+  }
+  pos += 4;
+
+  bh_str_ids_t ids = { 0 };
+  size_t seeded = 0;
+
+  while (pos + 4 <= len) {
+    uint32_t size;
+    memcpy(&size, buffer + pos, 4);
+    pos += 4;
+
+    bool is_deps = size >> 31;
+    size &= 0x7fffffff;
+    if (pos + size > len || size % 4) break;
+
+    const char *record = buffer + pos;
+    pos += size;
+
+    if (!is_deps) {
+      if (size < 4) break;
+      size_t path_len = size - 4;
+      while (path_len && record[path_len - 1] == '\0') path_len--;
+      bh_darray_push(&ids, bh_intern_n(&graph->paths, record, path_len));
+      continue;
+    }
+
+    if (size < 12) break;
+    int32_t out;
+    memcpy(&out, record, 4);
+    if (out < 0 || (size_t)out >= bh_darray_len(&ids)) continue;
+
+    bh_str_id output = ids.items[out];
+    bh_graph_grow(graph);
+    if (!graph->producers[output]) continue;
+
+    bh_target_t *target = bh_graph_target(graph, graph->producers[output] - 1);
+    if (target->output != output) continue;
+
+    // later records replace earlier ones, like in ninja
+    bh_darray_reset(&target->implicit);
+    for (size_t off = 12; off + 4 <= size; off += 4) {
+      int32_t dep;
+      memcpy(&dep, record + off, 4);
+      if (dep >= 0 && (size_t)dep < bh_darray_len(&ids))
+        bh_darray_push(&target->implicit, ids.items[dep]);
+    }
+
+    // ninja deletes depfiles it has read, don't let the missing file wipe these
+    if (target->depfile != BH_STR_ID_NONE)
+      target->depfile_mtime = bh_graph_mtime(graph, target->depfile);
+    seeded++;
+  }
+
+  bh_darray_free(&ids);
+  bh_graph_grow(graph);
+  free(buffer);
+  bh_logf(BH_LOG_INFO, "imported dependencies of %zu targets from `%s`.\n", seeded, path);
+}
+
+// call after the targets are added, either path may be NULL
+void bh_graph_import_ninja(bh_graph_t *graph, const char *log_path, const char *deps_path)
+{
+  bh_graph_grow(graph);
+  if (deps_path) bh_ninja_import_deps(graph, deps_path);
+  if (log_path) bh_ninja_import_log(graph, log_path);
+}
+
+#if __linux__
+#define BH_WATCH_MASK (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+typedef struct {
+  int fd;
+  bh_files_t wds;       // watched directory per watch descriptor
+  bh_files_t created;
+  bh_files_t removed;
+} bh_watcher_t;
+
+static void bh_watch_path(char *buffer, size_t size, const char *dir, const char *name)
+{
+  size_t len = strlen(dir);
+  snprintf(buffer, size, (len && dir[len - 1] == '/') ? "%s%s" : "%s/%s", dir, name);
+}
+
+// watches `dir` and every directory below it that isn't hidden
+static void bh_watch_add(bh_watcher_t *watcher, bh_graph_t *graph, const char *dir)
+{
+  int wd = inotify_add_watch(watcher->fd, dir, BH_WATCH_MASK);
+  if (wd < 0) {
+    bh_logf(BH_LOG_WARN, "failed to watch `%s`: %s\n", dir, strerror(errno));
+    return;
+  }
+
+  while (bh_darray_len(&watcher->wds) <= (size_t)wd)
+    bh_darray_push(&watcher->wds, NULL);
+  watcher->wds.items[wd] = (char *)bh_intern_str(&graph->paths, bh_intern(&graph->paths, dir));
+
+  DIR *d = opendir(dir);
+  if (!d) return;
+
+  struct dirent *data;
+  while ((data = readdir(d)) != NULL) {
+    if (data->d_type != DT_DIR || data->d_name[0] == '.') continue;
+
+    char path[PATH_MAX];
+    bh_watch_path(path, sizeof(path), dir, data->d_name);
+    bh_watch_add(watcher, graph, path);
+  }
+
+  closedir(d);
+}
+
+static bool bh_watcher_init(bh_watcher_t *watcher, bh_graph_t *graph, bh_files_t *dirs)
+{
+  memset(watcher, 0, sizeof(*watcher));
+
+  watcher->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (watcher->fd < 0) {
+    bh_logf(BH_LOG_ERROR, "failed to initialize inotify: %s\n", strerror(errno));
+    return false;
+  }
+
+  for (size_t i = 0; i < bh_darray_len(dirs); ++i)
+    bh_watch_add(watcher, graph, dirs->items[i]);
+
+  return true;
+}
+
+static void bh_watcher_free(bh_watcher_t *watcher)
+{
+  close(watcher->fd);
+  bh_darray_free(&watcher->wds);
+  bh_darray_free(&watcher->created);
+  bh_darray_free(&watcher->removed);
+}
+
+// waits up to `timeout` ms (-1 forever) for events, then keeps draining until
+// none arrive for `debounce` ms. changed paths are dropped from the stat
+// cache, `changed` tells whether an input moved and `listing` whether files
+// appeared or disappeared.
+static bool bh_watcher_poll(bh_watcher_t *watcher, bh_graph_t *graph, int timeout, int debounce, bool *changed, bool *listing)
+{
+  char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  // nothing logged so far should wait for the next change
+  if (timeout) bh_log_flush();
+
+  for (;;) {
+    struct pollfd pfd = { .fd = watcher->fd, .events = POLLIN };
+    int ready = poll(&pfd, 1, timeout);
+
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready < 0) {
+      bh_logf(BH_LOG_ERROR, "failed to wait for changes: %s\n", strerror(errno));
+      return false;
+    }
+    if (ready == 0) break;
+
+    ssize_t len = read(watcher->fd, buffer, sizeof(buffer));
+    if (len <= 0) continue;
+
+    for (char *p = buffer; p < buffer + len; ) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        for (size_t i = 0; i < graph->mtimes_size; ++i) graph->mtimes[i] = -2;
+        *changed = *listing = true;
+        continue;
+      }
+
+      if (event->wd < 0 || (size_t)event->wd >= bh_darray_len(&watcher->wds) ||
+          !watcher->wds.items[event->wd] || !event->len)
+        continue;
+
+      char path[PATH_MAX];
+      bh_watch_path(path, sizeof(path), watcher->wds.items[event->wd], event->name);
+
+      if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+          bh_watch_add(watcher, graph, path);
+        *listing = true;
+        continue;
+      }
+
+      bh_str_id id = bh_intern_find(&graph->paths, path, strlen(path));
+
+      if (id == BH_STR_ID_NONE) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+          bh_darray_push(&watcher->created, bh_fmt("%s", path));
+        continue;
+      }
+
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        bh_darray_push(&watcher->removed, (char *)bh_intern_str(&graph->paths, id));
+
+      // our own builds rewrite outputs, those only need a re-stat
+      if (id < graph->mtimes_size) graph->mtimes[id] = -2;
+      if (id >= graph->producers_size || !graph->producers[id])
+        *changed = true;
+    }
+
+    timeout = debounce;
+  }
+
+  // editors save through temporary files, only count what is still (or no
+  // longer) there once things settled
+  for (size_t i = 0; i < bh_darray_len(&watcher->created); ++i)
+    if (bh_path_exist(watcher->created.items[i]) == is_file) *listing = true;
+  for (size_t i = 0; i < bh_darray_len(&watcher->removed); ++i)
+    if (bh_path_exist(watcher->removed.items[i]) == is_none) *changed = *listing = true;
+
+  bh_darray_reset(&watcher->created);
+  bh_darray_reset(&watcher->removed);
+
+  return true;
+}
+#endif
+
+// builds, then rebuilds whenever a file under `dirs` changes. paths in the
+// graph should be spelled the way the walk produces them (`dir/name`).
+// `replan` runs when files appear or disappear so the driver can re-add
+// its targets after bh_graph_reset. only returns on error.
+bool bh_graph_watch(bh_graph_t *graph, bh_files_t *dirs, void (*replan)(bh_graph_t *graph))
+{
+#if __linux__
+  bh_watcher_t watcher;
+  if (!bh_watcher_init(&watcher, graph, dirs)) return false;
+
+  // everything allocated during a round is dropped before the next one
+  size_t mark = build_arena->offset;
 
-  return true;
+  bh_graph_build(graph);
+  bh_log(BH_LOG_INFO, "watching for changes...\n");
 
-}
+  for (;;) {
+    bool changed = false;
+    bool listing = false;
 
-char *bh_file_read(const char *path)
-{
-	FILE *fp;
-	long len;
+    if (!bh_watcher_poll(&watcher, graph, -1, BUILD_WATCH_DEBOUNCE_MS, &changed, &listing)) {
+      bh_watcher_free(&watcher);
+      return false;
+    }
 
-	fp = fopen(path, "rb");
-	if (fp == NULL) {
-    bh_log(3, bh_fmt("failed to open files, `%s`.\n", path));
-		return NULL;
-	}
+    if (listing && replan) {
+      bh_c_scan_reset();
+      replan(graph);
+      changed = true;
+    }
 
-	fseek(fp, 0L, SEEK_END);
-	len = ftell(fp);
-	fseek(fp, 0L, SEEK_SET);
+    if (changed) {
+      bh_graph_build(graph);
+      bh_log(BH_LOG_INFO, "watching for changes...\n");
+    }
 
-	char *buffer = (char*)bh_arena_alloc(build_arena, len + 1);
-	if (buffer == NULL) {
-    bh_log(3, bh_fmt("failed to allocate memory.\n"));
-    return NULL;
+    build_arena->offset = mark;
   }
+#else
+  bh_log(BH_LOG_ERROR, "watch mode needs inotify (linux).\n");
+  return false;
+#endif
+}
 
-	fread(buffer, 1, len, fp);
-	buffer[len] = 0;
-	fclose(fp);
+#if __linux__
+#define BH_DAEMON_MAGIC 0x62686430u   // "bhd0"
+#define BH_DAEMON_RESTART (-2)
 
-	return buffer;
-}
+typedef struct {
+  uint32_t magic;
+  uint32_t argc;
+  uint32_t args_size;
+  int64_t binary_mtime;
+} bh_daemon_request_t;
 
-bool bh_file_write(const char *path, const char *buffer, size_t size)
+static int64_t bh_daemon_binary_mtime(void)
 {
-	FILE *fp;
+  return bh_stat_mtime_ns("/proc/self/exe");
+}
 
-  bh_try {
-    fp = fopen(path, "wb");
-    bh_uthrow(fp, bh_FileNotFoundError);
-  } bh_catch(bh_FileNotFoundError) {
-    bh_log(3, bh_fmt("failed to open files, `%s`.\n", path));
-		return false;
-  }
+// forwards the command line and our stdout/stderr to a running daemon, which
+// builds with its warm state and answers with the exit status. returns
+// false when no daemon is listening (or it asked to be replaced).
+static bool bh_daemon_client(int argc, char *argv[], int *status)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
 
-	size_t total_size_written = fwrite(buffer, sizeof(char), size, fp);
-  if (total_size_written != size) {
-    bh_log(3, bh_fmt("Failed to write complete file `%s`.\n", path));
-    fclose(fp);
-    return false;
-  }
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy(addr.sun_path, BUILD_DAEMON_SOCKET, sizeof(addr.sun_path) - 1);
 
-  if (fflush(fp) != 0) {
-    bh_log(3, bh_fmt("failed to flush data to file `%s`.\n", path));
-    fclose(fp);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    // nobody is listening on a leftover socket
+    if (errno == ECONNREFUSED) unlink(BUILD_DAEMON_SOCKET);
+    close(fd);
     return false;
   }
 
-  if (fclose(fp) != 0) {
-    bh_log(3, bh_fmt("failed to properly close file `%s`.\n", path));
-    return false;
+  bh_sb_t args;
+  bh_sb_init(&args, build_arena);
+  for (int i = 0; i < argc; ++i) {
+    bh_sb_append(&args, argv[i]);
+    bh_sb_append_char(&args, '\0');
   }
 
-	return true;
+  bh_daemon_request_t request = {
+    .magic = BH_DAEMON_MAGIC,
+    .argc = (uint32_t)argc,
+    .args_size = (uint32_t)args.len,
+    .binary_mtime = bh_daemon_binary_mtime(),
+  };
+
+  // the daemon writes straight to our terminal through these
+  int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+  char control[CMSG_SPACE(sizeof(fds))] = { 0 };
+  struct iovec iov = { .iov_base = &request, .iov_len = sizeof(request) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  bh_log_flush();
+
+  int32_t answer = BH_DAEMON_RESTART;
+  bool ok = sendmsg(fd, &msg, 0) == (ssize_t)sizeof(request) &&
+    bh_io_all(fd, args.data, args.len, true) &&
+    bh_io_all(fd, &answer, sizeof(answer), false);
+
+  close(fd);
+
+  if (!ok || answer == BH_DAEMON_RESTART) return false;
+
+  *status = answer;
+  return true;
 }
 
-time_t bh_file_get_time(const char *path)
+// serves builds over BUILD_DAEMON_SOCKET, keeping the graph, interned paths
+// and stat cache warm. inotify drops changed paths from the cache between
+// requests so a no-op build doesn't touch the file system at all.
+static int bh_daemon_serve(bh_graph_t *graph, bh_files_t *dirs, void (*plan)(bh_graph_t *graph))
 {
-	struct stat file_stat;
-	if (stat(path, &file_stat) == -1) {
-		perror(bh_fmt("Failed to get file status: %s, ", path));
-		return (time_t)(-1);  // Return -1 on error
-	}
+  unlink(BUILD_DAEMON_SOCKET);
 
-	return file_stat.st_mtime;
-}
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy(addr.sun_path, BUILD_DAEMON_SOCKET, sizeof(addr.sun_path) - 1);
 
-char *bh_string_join(const char *f, const char *s)
-{
-  size_t size = strlen(f) + strlen(s) + 1;
-  char *new_string = (char *)bh_arena_alloc(build_arena, size);
+  if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) || listen(listener, 16)) {
+    bh_logf(BH_LOG_ERROR, "failed to listen on `%s`: %s\n", BUILD_DAEMON_SOCKET, strerror(errno));
+    return 1;
+  }
 
-  new_string = strcpy(new_string, f);
-  new_string = strcat(new_string, s);
-  new_string[size - 1] = '\0';
+  bh_watcher_t watcher;
+  if (!bh_watcher_init(&watcher, graph, dirs)) return 1;
 
-  return new_string;
-}
+  // builds write to the client's stdout, which can be a closed pipe
+  // (`./build | head`) or a client that went away
+  signal(SIGPIPE, SIG_IGN);
 
-char *bh_string_chop(const char *s, size_t from, size_t to)
-{
-	if (from >= to) return NULL;
+  plan(graph);
+  bh_dircache_flush();
 
-	char *sub = (char *)bh_arena_alloc(build_arena, (to - from) + 1);
-	for (size_t i = 0; i < to - from; ++i)
-		sub[i] = s[from + i];
+  int64_t binary_mtime = bh_daemon_binary_mtime();
+  size_t mark = build_arena->offset;
+  bool listing = false;
 
-	sub[(to - from)] = '\0';
-	
-	return sub;
-}
+  for (;;) {
+    struct pollfd pfds[2] = {
+      { .fd = listener, .events = POLLIN },
+      { .fd = watcher.fd, .events = POLLIN },
+    };
 
-char *bh_string_replace_char(char *s, char from, char to)
-{
-  if (!s) return NULL;
+    bh_log_flush();
+    if (poll(pfds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
 
-  size_t s_size = strlen(s);
+    bool changed = false;
+    if (pfds[1].revents & POLLIN)
+      bh_watcher_poll(&watcher, graph, 0, 0, &changed, &listing);
+
+    if (!(pfds[0].revents & POLLIN)) continue;
+
+    int client = accept(listener, NULL, NULL);
+    if (client < 0) continue;
+    fcntl(client, F_SETFD, FD_CLOEXEC);
+
+    bh_daemon_request_t request = { 0 };
+    int fds[2] = { -1, -1 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = &request, .iov_len = sizeof(request) };
+    struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control,
+      .msg_controllen = sizeof(control),
+    };
+
+    ssize_t got = recvmsg(client, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    char *args = NULL;
+    bool valid = got == (ssize_t)sizeof(request) && request.magic == BH_DAEMON_MAGIC &&
+      fds[0] >= 0 && fds[1] >= 0 && request.args_size < (1u << 20);
+
+    if (valid) {
+      args = (char *)bh_arena_alloc(build_arena, request.args_size + 1);
+      args[request.args_size] = '\0';
+      valid = bh_io_all(client, args, request.args_size, false);
+    }
 
-  size_t index = 0;
-  char *copy = malloc(s_size + 1);
-  memset(copy, 0, s_size + 1);
+    // a rebuilt driver has to start a fresh daemon
+    bool stop = !valid || request.binary_mtime != binary_mtime;
+    int32_t status = BH_DAEMON_RESTART;
+
+    if (valid && !stop) {
+      bh_files_t argv = { 0 };
+      for (char *p = args; p < args + request.args_size; p += strlen(p) + 1)
+        bh_darray_push(&argv, p);
+
+      build_options = (bh_options_t){ 0 };
+      bh_parse_options((int)bh_darray_len(&argv), argv.items);
+      bh_darray_free(&argv);
+
+      if (build_options.daemon_stop) {
+        stop = true;
+        status = 0;
+      } else {
+        // pick up everything the client did right before asking
+        bh_watcher_poll(&watcher, graph, 0, 0, &changed, &listing);
+        if (listing) {
+          bh_c_scan_reset();
+          plan(graph);
+        }
+        listing = false;
+
+        bh_log_flush();
+        int saved_out = dup(STDOUT_FILENO), saved_err = dup(STDERR_FILENO);
+        dup2(fds[0], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
 
-  for (size_t i = 0; i < s_size; ++i) {
-    if (s[i] == from) {
-      if (to) copy[index++] = to;
+        status = bh_graph_build(graph) ? 0 : 1;
+
+        bh_log_flush();
+        dup2(saved_out, STDOUT_FILENO);
+        dup2(saved_err, STDERR_FILENO);
+        close(saved_out);
+        close(saved_err);
+      }
     }
-    else copy[index++] = s[i];
+
+    bh_io_all(client, &status, sizeof(status), true);
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    close(client);
+
+    build_arena->offset = mark;
+    if (stop && valid) break;
   }
 
-  copy[index] = 0;
+  bh_watcher_free(&watcher);
+  close(listener);
+  unlink(BUILD_DAEMON_SOCKET);
 
-  return copy;
+  return 0;
 }
 
-bool bh_string_to_array(bh_strings_t *strings, const char *string, const unsigned char seperator)
+// detaches a daemon for this directory and waits until it accepts requests
+static bool bh_daemon_spawn(bh_graph_t *graph, bh_files_t *dirs, void (*plan)(bh_graph_t *graph))
 {
-  if (!string) return false;
+  if (!bh_mkdir(".build_cache")) return false;
 
-  size_t index = 0;
-  for (size_t i = 0; i < strlen(string); ++i) {
-    if (string[i] == seperator) {
-      char *sub = bh_string_chop(string, index, i);
-      if (sub) {
-        sub[i - index] = 0;
-        bh_darray_push(strings, sub);
-      }
+  bh_log_flush();
+
+  pid_t pid = fork();
+  if (pid < 0) return false;
+
+  if (pid == 0) {
+    setsid();
 
-      index = i + 1;
+    int null = open("/dev/null", O_RDONLY);
+    int log = open(".build_cache/daemon.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (null >= 0) dup2(null, STDIN_FILENO);
+    if (log >= 0) {
+      dup2(log, STDOUT_FILENO);
+      dup2(log, STDERR_FILENO);
     }
+
+    exit(bh_daemon_serve(graph, dirs, plan));
   }
 
-  char *sub = bh_string_chop(string, index, strlen(string));
-  bh_darray_push(strings, sub);
+  for (int i = 0; i < 200; ++i) {
+    if (!access(BUILD_DAEMON_SOCKET, F_OK)) return true;
+    usleep(5 * 1000);
+  }
 
-  return true;
+  return false;
 }
+#endif
 
-bool bh_execute(const char *command)
+// entry point for graph based drivers. `plan` adds the targets (after
+// bh_graph_reset) and only runs when this process actually builds, so with
+// a daemon running the driver is a thin client.
+//
+//   -n, --explain  print why each target is out of date, run nothing
+//   -v, -q         show debug messages / only warnings and errors
+//   --log-json     log one JSON object per message
+//   --watch        rebuild on every change
+//   --daemon       start a background daemon for this directory
+//   --daemon-stop  stop it
+//   --no-daemon    build in this process even if a daemon is running
+int bh_graph_main(int argc, char *argv[], bh_files_t *dirs, void (*plan)(bh_graph_t *graph))
 {
-	if (command == NULL) return false;
-#ifdef BUILD_EXECUTE_LOG
-	bh_log(1, bh_fmt("$ %s\n", command));
+  static bh_graph_t graph = { 0 };
+
+#if __linux__
+  if (!build_options.no_daemon && !build_options.watch) {
+    if (build_options.daemon && access(BUILD_DAEMON_SOCKET, F_OK))
+      bh_daemon_spawn(&graph, dirs, plan);
+
+    int status = 0;
+    if (bh_daemon_client(argc, argv, &status)) return status;
+    if (build_options.daemon_stop) return 0;
+  }
 #endif
-	return !system(command);
+
+  plan(&graph);
+
+  if (build_options.watch)
+    return bh_graph_watch(&graph, dirs, plan) ? 0 : 1;
+
+  return bh_graph_build(&graph) ? 0 : 1;
 }
 
-bool bh_is_binary_old(const char *bin_path, bh_files_t *files)
+void bh_parse_options(int argc, char *argv[])
 {
-	time_t binary_timestamp = bh_file_get_time(bin_path);
-	if (binary_timestamp == (time_t)(-1))
-		return true;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--explain")) build_options.explain = true;
+    else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) build_options.verbosity = 1;
+    else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quiet")) build_options.verbosity = -1;
+    else if (!strcmp(argv[i], "--log-json")) build_options.log_json = true;
+    else if (!strcmp(argv[i], "--watch")) build_options.watch = true;
+    else if (!strcmp(argv[i], "--daemon")) build_options.daemon = true;
+    else if (!strcmp(argv[i], "--daemon-stop")) build_options.daemon_stop = true;
+    else if (!strcmp(argv[i], "--no-daemon")) build_options.no_daemon = true;
+    else if (!strcmp(argv[i], "--no-progress")) build_options.no_progress = true;
+    else if (!strcmp(argv[i], "-k") || !strcmp(argv[i], "--keep-going")) build_options.keep_going = true;
+    else if (!strcmp(argv[i], "--io-uring")) bh_io_uring_use(true);
+    else if (!strcmp(argv[i], "--job-timeout") && i + 1 < argc) build_options.job_timeout = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--shard") && i + 1 < argc) {
+      int index, count;
+      if (sscanf(argv[++i], "%d/%d", &index, &count) == 2 && count > 0 && index >= 1 && index <= count) {
+        build_options.shard_index = index;
+        build_options.shard_count = count;
+      } else {
+        bh_logf(BH_LOG_ERROR, "--shard takes K/N with 1 <= K <= N, not `%s`.\n", argv[i]);
+      }
+    }
+#if __UNIX__
+    else if (!strcmp(argv[i], "--remote") && i + 1 < argc) {
+      char *hosts = bh_fmt("%s", argv[++i]);
+      for (char *host = strtok(hosts, ","); host; host = strtok(NULL, ","))
+        bh_remote_add(host);
+    }
+#endif
+  }
+}
 
-	for (size_t i = 0; i < bh_darray_len(files); ++i) {
-		time_t source_timestamp = bh_file_get_time(files->items[i]);
-		if (source_timestamp == (time_t)(-1)) {
-      bh_log(3,
-        bh_fmt("Failed to get modification time for source file: %s\n",
-        files->items[i]
-      ));
+// include scanner: lexes `#include` lines instead of running the
+// preprocessor. every file is lexed once until bh_c_scan_reset, and every
+// (search paths, directory, name) lookup is resolved once. #if is ignored,
+// so a header behind a false condition is still a dependency, which costs
+// a rebuild at worst. headers found through -isystem, and names that don't
+// resolve at all (the toolchain's own headers), are left out like -MM does.
+typedef struct {
+  uint32_t first;         // directives in build_scanner.includes
+  uint32_t count;
+  uint32_t visited;       // generation of the last walk that reached it
+  uint32_t children;      // resolved includes in build_scanner.children
+  uint32_t children_paths; // search path set they were resolved with, + 1
+  uint8_t state;          // 0 unknown, 1 exists, 2 missing
+  bool lexed;
+  bool computed;          // has an `#include MACRO`
+  bool system;
+} bh_scan_file_t;
 
-			continue;
-		}
+typedef struct {
+  bh_str_id name;
+  bool angle;
+} bh_scan_include_t;
 
-		if (source_timestamp > binary_timestamp)
-			return true;
-	}
+bh_define_darray(bh_scan_include_t) bh_scan_includes_t;
 
-	return false;
+typedef struct {
+  bh_intern_t files;
+  bh_scan_file_t *info;
+  size_t info_size;
+  bh_scan_includes_t includes;
+  bh_str_ids_t children;  // per file and search paths, BH_STR_ID_NONE ends a list
+  bh_intern_t names;
+  bh_intern_t lookups;    // "paths id, directory, kind, name"
+  uint32_t *resolved;     // per lookup: file id + 1, UINT32_MAX when not found
+  size_t resolved_size;
+  bh_intern_t search;     // argument strings, for the paths id
+  uint32_t generation;
+} bh_scanner_t;
+
+// per thread, so workers can scan without locks
+static _Thread_local bh_scanner_t build_scanner;
+
+void bh_c_scan_reset(void)
+{
+  bh_scanner_t *scanner = &build_scanner;
+  bh_intern_free(&scanner->files);
+  bh_intern_free(&scanner->names);
+  bh_intern_free(&scanner->lookups);
+  bh_intern_free(&scanner->search);
+  bh_darray_free(&scanner->includes);
+  bh_darray_free(&scanner->children);
+  free(scanner->info);
+  free(scanner->resolved);
+  *scanner = (bh_scanner_t){ 0 };
 }
 
-bool bh_on_binary_old_execute(const char *bin_path, bh_files_t *files, const char *command)
+static bh_scan_file_t *bh_scan_file(bh_str_id id)
 {
-  if (bh_is_binary_old(bin_path, files))
-    return bh_execute(command);
+  bh_scanner_t *scanner = &build_scanner;
+  if (id >= scanner->info_size) {
+    size_t size = scanner->info_size ? scanner->info_size : 256;
+    while (size <= id) size *= 2;
+
+    scanner->info = (bh_scan_file_t *)realloc(scanner->info, size * sizeof(bh_scan_file_t));
+    memset(scanner->info + scanner->info_size, 0, (size - scanner->info_size) * sizeof(bh_scan_file_t));
+    scanner->info_size = size;
+  }
 
-  return false;
+  return &scanner->info[id];
 }
 
-#if __UNIX__
-bool bh_push_async(bh_async_t *async, const char *command)
+static bool bh_scan_exists(bh_str_id id)
 {
-  pid_t pid = fork();
-
-  if (pid < 0) return false;
-  else if (pid == 0) {
-    execlp("sh", "sh", "-c", command, NULL);
-    bh_log(3, "Async failed");
-
-    return false;
+  bh_scan_file_t *file = bh_scan_file(id);
+  if (!file->state) {
+    struct stat st;
+    file->state = stat(bh_intern_str(&build_scanner.files, id), &st) == 0 && S_ISREG(st.st_mode) ? 1 : 2;
   }
-
-  bh_darray_push(async, ((bh_command_t){
-    .pid = pid,
-    .command = (char*)command
-  }));
-
-  return true;
+  return file->state == 1;
 }
-#elif __WIN32__
-bool bh_push_async(bh_async_t *async, const char *command)
+
+static bool bh_scan_space(char c)
 {
-    STARTUPINFO si = { sizeof(si) };
-    PROCESS_INFORMATION pi;
-    WINBOOL success;
-    char *cmdline;
+  return c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r';
+}
 
-    // Create a modifiable command line string
-    // Note: CreateProcess may modify the command line string
-    cmdline = _strdup(command);
-    if (!cmdline) {
-        return false;
+// records the directives of a file the first time it is reached
+static void bh_scan_lex(bh_str_id id)
+{
+  bh_scanner_t *scanner = &build_scanner;
+  bh_scan_file_t *file = bh_scan_file(id);
+  if (file->lexed) return;
+  file->lexed = true;
+  file->first = (uint32_t)bh_darray_len(&scanner->includes);
+
+  size_t len;
+  char *text = bh_read_all(bh_intern_str(&scanner->files, id), &len);
+  if (!text) return;
+
+  // comments aren't tracked: a commented out include is one more
+  // dependency, while a `/*` inside a string must not hide real ones
+  const char *p = text, *end = text + len;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol) eol = end;
+
+    const char *c = p;
+    p = eol + 1;
+
+    while (c < eol && bh_scan_space(*c)) ++c;
+    if (c >= eol || *c != '#') continue;
+
+    ++c;
+    while (c < eol && bh_scan_space(*c)) ++c;
+    size_t word = 0;
+    while (c + word < eol && (((c[word] | 0x20) >= 'a' && (c[word] | 0x20) <= 'z') || c[word] == '_')) ++word;
+    if (!((word == 7 && !memcmp(c, "include", 7)) || (word == 12 && !memcmp(c, "include_next", 12)) ||
+          (word == 6 && !memcmp(c, "import", 6)))) continue;
+
+    // #include_next goes on from the search path entry the includer was
+    // found in, which lookups shared across includers don't keep
+    if (word == 12) {
+      file = bh_scan_file(id);
+      file->computed = true;
+      continue;
     }
 
-    success = CreateProcess(
-        NULL,           // No application name (use command line)
-        cmdline,        // Command line (needs to be writable)
-        NULL,           // Process handle not inheritable
-        NULL,           // Thread handle not inheritable
-        FALSE,          // Set handle inheritance to FALSE
-        CREATE_NO_WINDOW, // Don't create a console window
-        NULL,           // Use parent's environment block
-        NULL,           // Use parent's starting directory 
-        &si,            // Pointer to STARTUPINFO structure
-        &pi             // Pointer to PROCESS_INFORMATION structure
-    );
-
-    free(cmdline);  // Free the duplicated command line
-
-    if (!success) {
-        bh_log(3, bh_fmt("Async failed (CreateProcess error: %lu)", GetLastError()));
-        return false;
+    c += word;
+    while (c < eol && bh_scan_space(*c)) ++c;
+    char close = c < eol && *c == '"' ? '"' : c < eol && *c == '<' ? '>' : 0;
+    const char *name = c + 1;
+    const char *stop = close ? (const char *)memchr(name, close, eol - name) : NULL;
+    if (!stop) {
+      file = bh_scan_file(id);
+      file->computed = true;
+      continue;
     }
 
-    // We don't need the thread handle
-    CloseHandle(pi.hThread);
+    bh_scan_include_t include = { bh_intern_n(&scanner->names, name, stop - name), close == '>' };
+    bh_darray_push(&scanner->includes, include);
+  }
 
-    // Push the process information to the async array
-    // Note: You'll need to change bh_command_t to store HANDLE instead of pid_t
-    bh_darray_push(async, ((bh_command_t){
-        .pid = pi.hProcess,  // Store the process handle
-        .command = _strdup(command)  // Duplicate the command string
-    }));
+  free(text);
+  file = bh_scan_file(id);
+  file->count = (uint32_t)bh_darray_len(&scanner->includes) - file->first;
+}
 
-    return true;
+typedef struct {
+  bh_str_id paths;        // id of the search path set
+  bh_files_t quote;       // -iquote, for "" only
+  bh_files_t user;        // -I
+  bh_files_t system;      // -isystem
+} bh_scan_paths_t;
+
+static void bh_scan_paths(const char *args, bh_scan_paths_t *paths)
+{
+  paths->paths = bh_intern(&build_scanner.search, args);
+
+  bh_sv_t rest = bh_sv_from_cstr(args);
+  while (rest.len) {
+    bh_sv_t word = bh_sv_chop_word(&rest);
+    bh_files_t *list = NULL;
+    size_t skip = 0;
+
+    if (bh_sv_starts_with(word, bh_sv_from_cstr("-isystem"))) list = &paths->system, skip = 8;
+    else if (bh_sv_starts_with(word, bh_sv_from_cstr("-iquote"))) list = &paths->quote, skip = 7;
+    else if (bh_sv_starts_with(word, bh_sv_from_cstr("-I"))) list = &paths->user, skip = 2;
+    if (!list) continue;
+
+    bh_sv_t dir = bh_sv_from_parts(word.data + skip, word.len - skip);
+    if (!dir.len) dir = bh_sv_chop_word(&rest);
+    if (dir.len) bh_darray_push(list, bh_sv_to_cstr(build_arena, dir));
+  }
 }
-#endif
 
-#if __UNIX__
-bool bh_await(bh_async_t *async)
+static bh_str_id bh_scan_candidate(const char *dir, size_t dir_len, const char *name)
 {
-  bool ret = false;
-  bh_foreach(async, command, {
-    if (command.command)
-      bh_log(1, bh_fmt("%s\n", command.command));
+  char buffer[PATH_MAX];
+  int len = dir_len ? snprintf(buffer, sizeof(buffer), "%.*s/%s", (int)dir_len, dir, name) :
+    snprintf(buffer, sizeof(buffer), "%s", name);
+  if (len <= 0 || (size_t)len >= sizeof(buffer)) return BH_STR_ID_NONE;
 
-    int status;
-    waitpid(command.pid, &status, 0);
+  bh_str_id id = bh_intern_n(&build_scanner.files, buffer, len);
+  return bh_scan_exists(id) ? id : BH_STR_ID_NONE;
+}
 
-    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
-      ret = true;
-  });
+// where `include`, seen in `from`, points to, BH_STR_ID_NONE when nowhere
+static bh_str_id bh_scan_resolve(bh_scan_paths_t *paths, bh_str_id from, bh_scan_include_t include)
+{
+  bh_scanner_t *scanner = &build_scanner;
+  const char *from_path = bh_intern_str(&scanner->files, from);
+  const char *slash = strrchr(from_path, '/');
+  size_t dir_len = slash ? (size_t)(slash - from_path) : 0;
+  const char *name = bh_intern_str(&scanner->names, include.name);
+
+  // only "" looks next to the includer, so <> lookups share one entry
+  char key[PATH_MAX + 64];
+  int key_len = snprintf(key, sizeof(key), "%u|%u|%.*s", (unsigned)paths->paths, (unsigned)include.name,
+    include.angle ? 1 : (int)dir_len + 1, include.angle ? "<" : slash ? from_path : ".");
+  if (key_len <= 0 || (size_t)key_len >= sizeof(key)) return BH_STR_ID_NONE;
+
+  bh_str_id lookup = bh_intern_n(&scanner->lookups, key, key_len);
+  if (lookup >= scanner->resolved_size) {
+    size_t size = scanner->resolved_size ? scanner->resolved_size : 256;
+    while (size <= lookup) size *= 2;
+
+    scanner->resolved = (uint32_t *)realloc(scanner->resolved, size * sizeof(uint32_t));
+    memset(scanner->resolved + scanner->resolved_size, 0, (size - scanner->resolved_size) * sizeof(uint32_t));
+    scanner->resolved_size = size;
+  }
+  if (scanner->resolved[lookup])
+    return scanner->resolved[lookup] == UINT32_MAX ? BH_STR_ID_NONE : scanner->resolved[lookup] - 1;
+
+  bh_str_id found = BH_STR_ID_NONE;
+  bool system = false;
+  if (name[0] == '/') {
+    found = bh_scan_candidate(NULL, 0, name);
+  } else {
+    if (!include.angle) {
+      found = bh_scan_candidate(from_path, dir_len, name);
+      for (size_t i = 0; found == BH_STR_ID_NONE && i < bh_darray_len(&paths->quote); ++i)
+        found = bh_scan_candidate(paths->quote.items[i], strlen(paths->quote.items[i]), name);
+    }
+    for (size_t i = 0; found == BH_STR_ID_NONE && i < bh_darray_len(&paths->user); ++i)
+      found = bh_scan_candidate(paths->user.items[i], strlen(paths->user.items[i]), name);
+    for (size_t i = 0; found == BH_STR_ID_NONE && i < bh_darray_len(&paths->system); ++i) {
+      found = bh_scan_candidate(paths->system.items[i], strlen(paths->system.items[i]), name);
+      system = found != BH_STR_ID_NONE;
+    }
+  }
 
-  return ret;
+  if (found != BH_STR_ID_NONE && system) bh_scan_file(found)->system = true;
+  scanner->resolved[lookup] = found == BH_STR_ID_NONE ? UINT32_MAX : found + 1;
+  return found;
 }
-#elif __WIN32__
-bool bh_await(bh_async_t *async)
+
+bool bh_c_scan_includes(bh_files_t *deps, const char *source, const char *args)
 {
-    bool ret = false;
-    bh_foreach(async, command, {
-        if (command.command)
-            bh_log(1, bh_fmt("%s\n", command.command));
+  bh_scanner_t *scanner = &build_scanner;
+  bh_str_id root = bh_intern(&scanner->files, source);
+  if (!bh_scan_exists(root)) return false;
+
+  bh_scan_paths_t paths = { 0 };
+  bh_scan_paths(args ? args : "", &paths);
+
+  uint32_t generation = ++scanner->generation;
+  bh_str_ids_t stack = { 0 };
+  bh_darray_push(&stack, root);
+  bh_scan_file(root)->visited = generation;
+  bool ok = true;
+
+  // the source comes first, like in the depfiles gcc writes
+  while (bh_darray_len(&stack) && ok) {
+    bh_str_id id = stack.items[--stack.count];
+    bh_scan_lex(id);
+
+    bh_scan_file_t *file = bh_scan_file(id);
+    if (file->computed) {
+      ok = false;
+      break;
+    }
 
-        // Wait for the process to complete
-        WaitForSingleObject(command.pid, INFINITE);
-        
-        // Get the exit code
-        DWORD exitCode;
-        GetExitCodeProcess(command.pid, &exitCode);
-        
-        // Clean up the process handle
-        CloseHandle(command.pid);
-        
-        // Check if the process failed
-        if (exitCode != EXIT_SUCCESS) {
-            ret = true;
-        }
-        
-        // Free the command string if it was allocated
-        if (command.command) {
-            free(command.command);
-        }
-    });
-    
-    // Clear the async array after waiting
-    bh_darray_reset(async);
-    
-    return ret;
+    const char *path = bh_intern_str(&scanner->files, id);
+    char *item = build_intern ?
+      (char *)bh_intern_str(build_intern, bh_intern(build_intern, path)) :
+      bh_sv_to_cstr(build_arena, bh_sv_from_cstr(path));
+    bh_darray_push(deps, item);
+
+    // a header reached again with the same search paths reuses its
+    // resolved includes, most sources of a project share one set
+    if (file->children_paths != paths.paths + 1) {
+      uint32_t first = file->first, count = file->count;
+      uint32_t children = (uint32_t)bh_darray_len(&scanner->children);
+      for (uint32_t i = 0; i < count; ++i) {
+        bh_str_id next = bh_scan_resolve(&paths, id, scanner->includes.items[first + i]);
+        if (next != BH_STR_ID_NONE && !bh_scan_file(next)->system)
+          bh_darray_push(&scanner->children, next);
+      }
+      bh_darray_push(&scanner->children, BH_STR_ID_NONE);
+
+      file = bh_scan_file(id);
+      file->children = children;
+      file->children_paths = paths.paths + 1;
+    }
+
+    // pushed in reverse so the first include is visited first
+    size_t end = file->children;
+    while (scanner->children.items[end] != BH_STR_ID_NONE) ++end;
+    for (size_t i = end; i-- > file->children;) {
+      bh_str_id next = scanner->children.items[i];
+      bh_scan_file_t *info = bh_scan_file(next);
+      if (info->visited == generation) continue;
+      info->visited = generation;
+      bh_darray_push(&stack, next);
+    }
+  }
+
+  bh_darray_free(&stack);
+  bh_darray_free(&paths.quote);
+  bh_darray_free(&paths.user);
+  bh_darray_free(&paths.system);
+  return ok;
 }
-#endif
 
 bool bh_c_source_get_include_paths(
   bh_files_t *include_paths,
@@ -943,6 +6803,13 @@ bool bh_c_source_get_include_paths(
 {
   if (!include_paths || !source || !args || !out_filename) return false;
 
+#if BUILD_INCLUDE_SCANNER
+  // computed includes need the real preprocessor
+  size_t count = bh_darray_len(include_paths);
+  if (bh_c_scan_includes(include_paths, source, args)) return true;
+  include_paths->count = count;
+#endif
+
   bh_mkdir(".build_cache");
 
   char *out = bh_fmt(".build_cache/_csource_includes_%s_.d", out_filename);
@@ -961,47 +6828,13 @@ bool bh_c_source_get_include_paths(
     );
   }
 
-  char *file = bh_file_read(
-    bh_fmt("%s", out));
-
-  bh_strings_t items = { 0 };
-
-  bool has_started = false;
-  size_t start = 0;
-  size_t size = strlen(file);
-
-  for (size_t i = 0; i < size; ++i) {
-    char ch = file[i];
-    if (ch == ' ') {
-      if (!has_started) {
-        start = i;
-        has_started = true;
-      } else {
-        char *item = bh_string_chop(file, start, i);
-        if (item) bh_darray_push(&items, item);
-        start = i;
-      }
-    }
-  }
-
-  char *item = bh_string_chop(file, start, size);
-  if (item) bh_darray_push(&items, item);
-
-  char *temp = bh_files_to_string(&items, 0);
-  temp = bh_string_replace_char(temp, '\r', 0);
-  temp = bh_string_replace_char(temp, '\n', 0);
-  temp = bh_string_replace_char(temp, '\\', 0);
-
-  bh_strings_t full_list = { 0 };
-  bh_string_to_array(&full_list, temp, ' ');
-
-  bh_darray_drop(&full_list, include_paths, 1);
-
-  return true;
+  return bh_depfile_read(out, include_paths);
 }
 
 void bh_init(int argc, char *argv[])
 {
+  bh_parse_options(argc, argv);
+
   bh_arena_t arena = { 0 };
   bh_init_arena(&arena, 1024);
   build_arena = &arena;
@@ -1024,12 +6857,12 @@ void bh_init(int argc, char *argv[])
 
 #if __WIN32__
     if (!MoveFileEx(bin, bh_fmt("%s.old", bin), MOVEFILE_REPLACE_EXISTING)) {
-      bh_log(3, bh_fmt("Could not rename `%s` to `%s.old`.\n", bin, bin));
+      bh_logf(BH_LOG_ERROR, "Could not rename `%s` to `%s.old`.\n", bin, bin);
     }
 
     if (!bh_execute(command)) {
       if (!MoveFileEx(bh_fmt("%s.old", bin), bin, MOVEFILE_REPLACE_EXISTING)) {
-        bh_log(3, bh_fmt("Could not rename `%s` to `%s.old`.\n", bin, bin));
+        bh_logf(BH_LOG_ERROR, "Could not rename `%s` to `%s.old`.\n", bin, bin);
       }
     }
 #else
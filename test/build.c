@@ -1,7 +1,7 @@
 #define BUILD_IMPLEMENTATION
 #include "../build.h"
+#include <pthread.h>
 
-extern bh_arena_t *build_arena;
 static bh_arena_t arena = { 0 };
 
 void test_dynamic_array() {
@@ -61,14 +61,312 @@ void test_string_operations() {
   bh_strings_t strings = {0};
   assert(bh_string_to_array(&strings, "one,two,three", ','));
   assert(bh_darray_len(&strings) == 3);
-  assert(strcmp(strings.buffer[0], "one") == 0);
-  assert(strcmp(strings.buffer[1], "two") == 0);
-  assert(strcmp(strings.buffer[2], "three") == 0);
+  assert(strcmp(strings.items[0], "one") == 0);
+  assert(strcmp(strings.items[1], "two") == 0);
+  assert(strcmp(strings.items[2], "three") == 0);
   
   bh_darray_free(&strings);
   printf("String operation tests passed!\n\n");
 }
 
+void test_string_views() {
+  printf("Testing string views...\n");
+
+  bh_sv_t sv = bh_sv_trim(bh_sv_from_cstr("  cc -c main.c \n"));
+  assert(bh_sv_eq(sv, bh_sv_from_cstr("cc -c main.c")));
+  assert(bh_sv_starts_with(sv, bh_sv_from_cstr("cc")));
+  assert(bh_sv_ends_with(sv, bh_sv_from_cstr(".c")));
+
+  size_t index = 0;
+  assert(bh_sv_find(sv, '-', &index) && index == 3);
+  assert(!bh_sv_find(sv, '@', NULL));
+
+  bh_sv_t word = bh_sv_chop_word(&sv);
+  assert(bh_sv_eq(word, bh_sv_from_cstr("cc")));
+  word = bh_sv_chop_word(&sv);
+  assert(bh_sv_eq(word, bh_sv_from_cstr("-c")));
+
+  bh_svs_t parts = {0};
+  assert(bh_sv_split(bh_sv_from_cstr("a,,b,c,"), ',', &parts));
+  assert(bh_darray_len(&parts) == 3);
+  assert(bh_sv_eq(parts.items[2], bh_sv_from_cstr("c")));
+
+  char buffer[16];
+  size_t len = bh_sv_join(buffer, sizeof(buffer), parts.items, parts.count, bh_sv_from_cstr(", "));
+  assert(len == 7 && strcmp(buffer, "a, b, c") == 0);
+  assert(bh_sv_join(buffer, 4, parts.items, parts.count, bh_sv_from_cstr(", ")) == 7);
+  assert(strcmp(buffer, "a, ") == 0);
+
+  bh_files_t files = {0};
+  bh_darray_push(&files, "a.o");
+  bh_darray_push(&files, "b.o");
+  assert(strcmp(bh_files_to_string_arena(build_arena, &files, ' '), "a.o b.o") == 0);
+
+  bh_darray_free(&files);
+  bh_darray_free(&parts);
+  printf("String view tests passed!\n\n");
+}
+
+void test_string_builder() {
+  printf("Testing string builder...\n");
+
+  bh_files_t files = {0};
+  bh_darray_push(&files, "a.o");
+  bh_darray_push(&files, "b.o");
+
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bh_sb_append(&sb, "cc -o app ");
+  bh_sb_append_files(&sb, &files, ' ');
+  bh_sb_appendf(&sb, " -O%d", 2);
+  bh_sb_append_char(&sb, ' ');
+
+  // an allocation in between moves the builder once
+  char *other = bh_fmt("%s", "other");
+  bh_sb_appendf(&sb, "%s", "-lm");
+
+  char *line = bh_sb_finish(&sb);
+  assert(strcmp(line, "cc -o app a.o b.o -O2 -lm") == 0);
+  assert(strcmp(other, "other") == 0);
+
+  // long lines are formatted in one go
+  bh_sb_init(&sb, build_arena);
+  for (int i = 0; i < 10000; i++) {
+    bh_sb_appendf(&sb, "obj/file_%d.o ", i);
+  }
+  line = bh_sb_finish(&sb);
+  assert(strncmp(line, "obj/file_0.o obj/file_1.o", 25) == 0);
+  assert(strlen(line) == (size_t)(sb.data - line) - 1);
+
+  char *formatted = bh_fmt("%s-%0100d", "wide", 7);
+  assert(strlen(formatted) == 105);
+
+  bh_darray_free(&files);
+  printf("String builder tests passed!\n\n");
+}
+
+void test_byte_kernels() {
+  printf("Testing byte kernels...\n");
+
+  char data[1031];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = "abc \\\n"[(i * 7 + i / 13) % 6];
+  }
+
+  bh_simd_t best = bh_simd_detect();
+  for (bh_simd_t level = BH_SIMD_SCALAR; level <= best; level++) {
+    assert(bh_simd_use(level) == level);
+
+    for (size_t from = 0; from < 64; from++) {
+      size_t len = sizeof(data) - from;
+      const char *p = data + from;
+
+      size_t expect = 0;
+      while (expect < len && p[expect] != '\\') expect++;
+      assert(bh_bytes_find(p, len, '\\') == expect);
+
+      expect = 0;
+      while (expect < len && (p[expect] == 'a' || p[expect] == 'b')) expect++;
+      assert(bh_bytes_skip_any(p, len, "ab") == expect);
+    }
+    assert(bh_bytes_find(data, sizeof(data), '#') == sizeof(data));
+
+    char copy[sizeof(data)];
+    memcpy(copy, data, sizeof(data));
+    size_t len = bh_bytes_delete(copy, sizeof(copy), "\\\n");
+
+    size_t expect = 0;
+    for (size_t i = 0; i < sizeof(data); i++) {
+      if (data[i] != '\\' && data[i] != '\n') assert(copy[expect++] == data[i]);
+    }
+    assert(len == expect);
+
+    memcpy(copy, data, sizeof(data));
+    bh_bytes_replace(copy, sizeof(copy), "ab", '_');
+    for (size_t i = 0; i < sizeof(data); i++) {
+      assert(copy[i] == ((data[i] == 'a' || data[i] == 'b') ? '_' : data[i]));
+    }
+  }
+  bh_simd_use(BH_SIMD_NONE);
+
+  char *in_place = bh_string_join("a\\b\\c", "");
+  assert(strcmp(bh_string_replace_char_inplace(in_place, '\\', 0), "abc") == 0);
+
+  printf("Byte kernel tests passed!\n\n");
+}
+
+void test_string_interning() {
+  printf("Testing string interning...\n");
+
+  bh_intern_t table = {0};
+  bh_intern_init(&table, 0);
+
+  bh_str_id a = bh_intern(&table, "src/main.c");
+  bh_str_id b = bh_intern(&table, "include/build.h");
+  assert(a != b);
+  assert(bh_intern(&table, bh_string_join("src/", "main.c")) == a);
+  assert(strcmp(bh_intern_str(&table, b), "include/build.h") == 0);
+  assert(bh_intern_find(&table, "missing.h", 9) == BH_STR_ID_NONE);
+
+  // force a few rehashes
+  for (int i = 0; i < 5000; i++) {
+    bh_intern(&table, bh_fmt("dir/file_%d.c", i));
+  }
+  assert(table.count == 5002);
+  assert(bh_intern(&table, "dir/file_4321.c") == bh_intern_find(&table, "dir/file_4321.c", 15));
+  assert(bh_intern(&table, "src/main.c") == a);
+
+  bh_files_t files = {0};
+  bh_str_ids_t ids = {0};
+  bh_darray_push(&files, "include/build.h");
+  bh_darray_push(&files, "src/main.c");
+  assert(bh_files_intern(&table, &files, &ids));
+  assert(ids.items[0] == b && ids.items[1] == a);
+  assert(files.items[1] == bh_intern_str(&table, a));
+
+  bh_darray_free(&files);
+  bh_darray_free(&ids);
+  bh_intern_free(&table);
+  printf("String interning tests passed!\n\n");
+}
+
+typedef struct {
+  int index;
+  bh_files_t names;
+  bh_arena_t *arena;
+} arena_job_t;
+
+static void *arena_worker(void *data) {
+  arena_job_t *job = (arena_job_t *)data;
+
+  bh_arena_thread_begin(64 * 1024);
+  job->arena = build_arena;
+  for (int i = 0; i < 1000; i++) {
+    char *name = bh_fmt("worker_%d/item_%d", job->index, i);
+    if (i % 100 == 0) bh_darray_push(&job->names, name);
+  }
+  bh_files_adopt(&arena, &job->names);
+  bh_arena_thread_end();
+
+  return NULL;
+}
+
+void test_thread_arenas() {
+  printf("Testing thread arenas...\n");
+
+  // each thread formats into its own arena, results move to the main one
+  pthread_t threads[4];
+  arena_job_t jobs[4] = {0};
+  for (int t = 0; t < 4; t++) {
+    jobs[t].index = t;
+    assert(pthread_create(&threads[t], NULL, arena_worker, &jobs[t]) == 0);
+  }
+
+  for (int t = 0; t < 4; t++) {
+    assert(pthread_join(threads[t], NULL) == 0);
+    assert(jobs[t].arena && jobs[t].arena != &arena);
+    assert(bh_darray_len(&jobs[t].names) == 10);
+    assert(strcmp(jobs[t].names.items[9], bh_fmt("worker_%d/item_900", t)) == 0);
+    bh_darray_free(&jobs[t].names);
+  }
+  assert(build_arena == &arena);
+
+  // released arenas are handed out again, big enough requests only
+  bh_arena_t *pooled = bh_arena_acquire(64 * 1024);
+  assert(pooled == jobs[0].arena || pooled == jobs[1].arena || pooled == jobs[2].arena || pooled == jobs[3].arena);
+  assert(pooled->offset == 0);
+  bh_arena_release(pooled);
+
+  bh_arena_t *big = bh_arena_acquire(1024 * 1024);
+  assert(big->size == 1024 * 1024);
+  bh_arena_release(big);
+
+  printf("Thread arena tests passed!\n\n");
+}
+
+bh_define_darray(int) ints_t;
+
+static void square(void *ctx, const void *in, void *out) {
+  (void)ctx;
+  *(int *)out = *(const int *)in * *(const int *)in;
+}
+
+static bool is_even(void *ctx, const void *item) {
+  (void)ctx;
+  return *(const int *)item % 2 == 0;
+}
+
+static void add_up(void *ctx, void *item) {
+  atomic_fetch_add((_Atomic long *)ctx, *(int *)item);
+}
+
+// slow enough that every worker gets a share, even on one CPU. `ctx`
+// collects the arenas that were used.
+static void object_path(void *ctx, const void *in, void *out) {
+  _Atomic(bh_arena_t *) *arenas = (_Atomic(bh_arena_t *) *)ctx;
+  for (int i = 0; i < 8; i++) {
+    bh_arena_t *empty = NULL;
+    if (arenas[i] == build_arena || atomic_compare_exchange_strong(&arenas[i], &empty, build_arena)) break;
+    if (empty == build_arena) break;
+  }
+  usleep(200);
+  *(char **)out = bh_fmt("build/%s.o", *(char *const *)in);
+}
+
+static void nested_sum(void *ctx, void *item) {
+  ints_t *ints = (ints_t *)ctx;
+  _Atomic long sum = 0;
+  bh_par_foreach(ints, add_up, &sum);
+  *(long *)item = sum;
+}
+
+void test_parallel() {
+  printf("Testing parallel map/filter/foreach...\n");
+
+  assert(bh_parallel_use(4) == 4);
+
+  ints_t ints = {0}, squares = {0}, evens = {0};
+  for (int i = 0; i < 100000; i++) bh_darray_push(&ints, i);
+
+  bh_par_map(&ints, &squares, square, NULL);
+  assert(bh_darray_len(&squares) == 100000);
+  for (int i = 0; i < 100000; i++) assert(squares.items[i] == i * i);
+
+  bh_par_filter(&ints, &evens, is_even, NULL);
+  assert(bh_darray_len(&evens) == 50000);
+  for (int i = 0; i < 50000; i++) assert(evens.items[i] == 2 * i);
+
+  _Atomic long sum = 0;
+  bh_par_foreach(&ints, add_up, &sum);
+  assert(sum == 100000L * 99999 / 2);
+
+  // callbacks format into their thread's arena
+  bh_files_t sources = {0}, objects = {0};
+  for (int i = 0; i < 500; i++) bh_darray_push(&sources, bh_fmt("src/file_%d", i));
+  _Atomic(bh_arena_t *) arenas[8] = {0};
+  bh_par_map(&sources, &objects, object_path, arenas);
+  for (int i = 0; i < 500; i++)
+    assert(strcmp(objects.items[i], bh_fmt("build/src/file_%d.o", i)) == 0);
+  assert(arenas[0] && arenas[1]);
+  bh_parallel_reset();
+
+  // a parallel call inside a callback runs on that thread
+  ints_t few = {0};
+  long sums[8] = {0};
+  for (int i = 0; i < 100; i++) bh_darray_push(&few, i);
+  struct { size_t size, count; long *items; } totals = { 8, 8, sums };
+  bh_par_foreach(&totals, nested_sum, &few);
+  for (int i = 0; i < 8; i++) assert(sums[i] == 4950);
+
+  bh_darray_free(&ints);
+  bh_darray_free(&squares);
+  bh_darray_free(&evens);
+  bh_darray_free(&sources);
+  bh_darray_free(&objects);
+  bh_darray_free(&few);
+  printf("Parallel map/filter/foreach tests passed!\n\n");
+}
+
 void test_file_operations() {
   printf("Testing file operations...\n");
   
@@ -111,6 +409,44 @@ void test_file_operations() {
   printf("File operation tests passed!\n\n");
 }
 
+void test_dir_cache() {
+  printf("Testing directory listing cache...\n");
+
+  assert(bh_execute("mkdir -p test_dircache/sub && touch test_dircache/a.c test_dircache/sub/b.c"));
+  assert(bh_execute("touch -d '2020-01-01' test_dircache test_dircache/sub"));
+
+  // listing only marks the cache dirty, it is written by a flush
+  assert(bh_dircache_flush());
+  remove(BUILD_DIR_CACHE);
+  bh_files_t files = {0};
+  assert(bh_recursive_files_get("test_dircache", &files));
+  assert(bh_darray_len(&files) == 2);
+  assert(bh_path_exist(BUILD_DIR_CACHE) == is_none);
+  assert(bh_dircache_flush());
+  assert(bh_path_exist(BUILD_DIR_CACHE) == is_file);
+
+  // same inode and mtime: served from the cache, even though it is wrong now
+  assert(bh_execute("touch test_dircache/sub/c.c && touch -d '2020-01-01' test_dircache/sub"));
+  bh_darray_reset(&files);
+  assert(bh_recursive_files_get("test_dircache", &files));
+  assert(bh_darray_len(&files) == 2);
+
+  // a new mtime rereads the directory
+  assert(bh_execute("touch test_dircache/sub"));
+  bh_darray_reset(&files);
+  assert(bh_recursive_files_get("test_dircache", &files));
+  assert(bh_darray_len(&files) == 3);
+
+  bh_darray_reset(&files);
+  assert(bh_files_get("test_dircache/sub", &files));
+  assert(bh_darray_len(&files) == 2);
+  assert(!bh_files_get("test_dircache/a.c", &files));
+
+  bh_darray_free(&files);
+  assert(bh_execute("rm -rf test_dircache"));
+  printf("Directory listing cache tests passed!\n\n");
+}
+
 void test_async_operations() {
   printf("Testing async operations...\n");
   
@@ -137,6 +473,127 @@ void test_async_operations() {
   printf("Async operation tests passed!\n\n");
 }
 
+static int64_t test_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void test_job_control() {
+  printf("Testing job cancellation and timeouts...\n");
+
+  assert(bh_execute("mkdir -p test_jobs"));
+  bh_async_t async = {0};
+
+  // fail fast: the sleeping job is stopped instead of awaited
+  int64_t start = test_now_ms();
+  assert(bh_push_async(&async, "sleep 10"));
+  assert(bh_push_async(&async, "false"));
+  assert(bh_await(&async));
+  assert(test_now_ms() - start < 3000);
+  assert(async.items[0].state == BH_JOB_DONE && async.items[0].failed);
+
+  // and nothing new starts once the batch has a failure
+  usleep(100 * 1000);
+  assert(!bh_push_async(&async, "touch test_jobs/late.txt"));
+  bh_darray_reset(&async);
+
+  // --keep-going lets the rest finish
+  build_options.keep_going = true;
+  assert(bh_push_async(&async, "false"));
+  usleep(100 * 1000);
+  assert(bh_push_async(&async, "sleep 0.2 && touch test_jobs/done.txt"));
+  assert(bh_await(&async));
+  assert(bh_path_exist("test_jobs/done.txt") == is_file);
+  assert(bh_path_exist("test_jobs/late.txt") == is_none);
+  build_options.keep_going = false;
+  bh_darray_reset(&async);
+
+  // a hung job is killed with everything it started
+  build_options.job_timeout = 1;
+  start = test_now_ms();
+  assert(bh_push_async(&async, "sleep 10 & sleep 10; wait"));
+  assert(bh_await(&async));
+  assert(test_now_ms() - start < 4000);
+  assert(!bh_execute("sleep 10"));
+  assert(bh_execute("true"));
+  build_options.job_timeout = 0;
+
+  // a ^C before bh_await still stops the jobs, which don't get the
+  // terminal's signal themselves
+  fflush(stdout);
+  pid_t driver = fork();
+  if (driver == 0) {
+    bh_async_t pending = {0};
+    bh_push_async(&pending, "trap 'touch test_jobs/stopped.txt; exit 1' TERM; touch test_jobs/started.txt; while :; do sleep 0.05; done");
+    while (bh_path_exist("test_jobs/started.txt") != is_file) usleep(10 * 1000);
+    raise(SIGINT);
+    _exit(0);
+  }
+  int status;
+  assert(waitpid(driver, &status, 0) == driver);
+  assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGINT);
+  for (int i = 0; i < 200 && bh_path_exist("test_jobs/stopped.txt") != is_file; i++) usleep(10 * 1000);
+  assert(bh_path_exist("test_jobs/stopped.txt") == is_file);
+
+  bh_darray_free(&async);
+  assert(bh_execute("rm -rf test_jobs"));
+  printf("Job cancellation and timeout tests passed!\n\n");
+}
+
+void test_progress() {
+  printf("Testing the progress line...\n");
+
+#if __UNIX__
+  assert(!strcmp(bh_command_output("cc -c a.c -o  build/a.o -O2"), "build/a.o"));
+  assert(!strcmp(bh_command_output("cc -c a.c -o build/a.o&& echo"), "build/a.o"));
+  assert(!bh_command_output("cp a b"));
+
+  // waiting never creates log entries, only a terminal retimes existing ones
+  assert(bh_execute("mkdir -p test_progress"));
+  bh_async_t async = {0};
+  assert(bh_push_async(&async, "true -o test_progress/b.o"));
+  assert(!bh_await(&async));
+  assert(bh_command_duration("test_progress/b.o") < 0);
+
+  // a retime keeps the hash and the restat fields
+  bh_command_retime("test_progress/n.o", "cc -o test_progress/n.o", 100);
+  assert(bh_command_duration("test_progress/n.o") < 0);
+  bh_command_record("test_progress/a.o", "cc -o test_progress/a.o", 50);
+  bh_command_entry("test_progress/a.o")->digest = 7;
+  bh_command_retime("test_progress/a.o", "cc -o test_progress/a.o", 250);
+  assert(bh_command_duration("test_progress/a.o") == 250);
+  assert(bh_command_entry("test_progress/a.o")->digest == 7);
+  assert(!bh_command_changed("test_progress/a.o", "cc -o test_progress/a.o"));
+  bh_command_retime("test_progress/a.o", "cc -O2 -o test_progress/a.o", 900);
+  assert(bh_command_duration("test_progress/a.o") == 250);
+
+  // one done, a.o a second into its 3s, b.o a second into an unknown, so
+  // the average of the known ones: 2s and 1s left over two running jobs
+  bh_command_record("test_progress/a.o", "a", 3000);
+  bh_command_record("test_progress/b.o", "b", -1);
+  bh_command_record("test_progress/d.o", "d", 1000);
+  int64_t now = test_now_ms();
+  bh_darray_reset(&async);
+  bh_darray_push(&async, ((bh_command_t){ .command = "x -o test_progress/a.o", .started = now - 1000 }));
+  bh_darray_push(&async, ((bh_command_t){ .command = "x -o test_progress/e.o", .started = now - 1000 }));
+  bh_darray_push(&async, ((bh_command_t){ .command = "x -o test_progress/d.o", .started = now - 2000, .state = BH_JOB_DONE }));
+
+  bh_progress_t progress;
+  bh_progress_begin(&progress, &async, now - 2000);
+  assert(progress.mean == 2000);
+  char line[256];
+  bh_progress_format(&progress, &async, now, line, sizeof(line));
+  assert(strstr(line, "[1/3 done, 2 running] 0.5 jobs/s, eta 2s, 1.0s: x -o test_progress/a.o"));
+  bh_progress_end(&progress);
+
+  bh_darray_free(&async);
+  assert(bh_execute("rm -rf test_progress"));
+#endif
+
+  printf("Progress line tests passed!\n\n");
+}
+
 void test_error_handling() {
   printf("Testing error handling...\n");
   
@@ -193,19 +650,987 @@ void test_build_system() {
   printf("Build system tests passed!\n\n");
 }
 
+static int64_t test_mtime_ns(const char *path) {
+  struct stat st;
+  assert(stat(path, &st) == 0);
+  return st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static int log_formatted = 0;
+
+static int count_formatting() {
+  return ++log_formatted;
+}
+
+void test_logging() {
+  printf("Testing logging...\n");
+
+  bh_log_flush();
+  int saved = dup(STDOUT_FILENO);
+  int fd = open("test_log.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0 && dup2(fd, STDOUT_FILENO) >= 0);
+
+  // filtered messages never format their arguments
+  bh_logf(BH_LOG_DEBUG, "%d\n", count_formatting());
+  assert(log_formatted == 0);
+  build_options.verbosity = -1;
+  bh_logf(BH_LOG_INFO, "%d\n", count_formatting());
+  assert(log_formatted == 0);
+  build_options.verbosity = 1;
+  bh_logf(BH_LOG_DEBUG, "debug %d\n", count_formatting());
+  assert(log_formatted == 1);
+  build_options.verbosity = 0;
+
+  // buffered until flushed
+  bh_logf(BH_LOG_INFO, "info %d\n", 2);
+  fflush(stdout);
+  assert(bh_path_exist("test_log.txt") == is_file);
+  assert(bh_file_read("test_log.txt")[0] == '\0');
+
+  build_options.log_json = true;
+  bh_log(BH_LOG_WARN, "a \"quoted\"\tmessage\n");
+  build_options.log_json = false;
+  bh_log_flush();
+
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  close(fd);
+
+  char *log = bh_file_read("test_log.txt");
+  assert(strncmp(log, "[DEBUG]: debug 1\n[INFO]: info 2\n{\"ts\":", strlen("[DEBUG]: debug 1\n[INFO]: info 2\n{\"ts\":")) == 0);
+  assert(strstr(log, "\"level\":\"warn\",\"msg\":\"a \\\"quoted\\\"\\u0009message\"}\n"));
+
+  assert(bh_execute("rm -f test_log.txt"));
+  printf("Logging tests passed!\n\n");
+}
+
+void test_io_batches() {
+  printf("Testing batched stat and read...\n");
+
+  assert(bh_execute("mkdir -p test_batch && echo one > test_batch/a.txt && printf '' > test_batch/empty.txt"));
+  const char *paths[] = { "test_batch/a.txt", "test_batch/missing.txt", "test_batch/empty.txt", "test_batch" };
+  size_t count = sizeof(paths) / sizeof(paths[0]);
+
+  // the ring and the synchronous fallback have to agree
+  bool rings[] = { true, false };
+  for (size_t r = 0; r < 2; ++r) {
+    bool uring = bh_io_uring_use(rings[r]);
+    printf("io_uring %s\n", uring ? "in use" : "not in use");
+
+    int64_t mtimes[4];
+    bh_stat_many(paths, count, mtimes);
+    assert(mtimes[0] == test_mtime_ns("test_batch/a.txt"));
+    assert(mtimes[1] == -1);
+    assert(mtimes[2] == test_mtime_ns("test_batch/empty.txt"));
+
+    char *data[3];
+    size_t lens[3];
+    bh_read_many(paths, 3, data, lens);
+    assert(data[0] && lens[0] == 4 && strcmp(data[0], "one\n") == 0);
+    assert(!data[1]);
+    assert(data[2] && lens[2] == 0 && data[2][0] == 0);
+    free(data[0]);
+    free(data[2]);
+  }
+
+  // a graph only stats paths, never its (here overlong) commands
+  bh_graph_t graph = {0};
+  bh_files_t inputs = {0};
+  bh_darray_push(&inputs, "test_batch/a.txt");
+  bh_sb_t command;
+  bh_sb_init(&command, build_arena);
+  bh_sb_append(&command, "cp test_batch/a.txt test_batch/copy.txt #");
+  for (int i = 0; i < 5000; i++) bh_sb_append_char(&command, 'x');
+  bh_graph_add(&graph, "test_batch/copy.txt", &inputs, bh_sb_finish(&command));
+  assert(bh_graph_build(&graph));
+  assert(bh_path_exist("test_batch/copy.txt") == is_file);
+  assert(graph.paths.count == 2);
+  bh_darray_free(&inputs);
+  bh_graph_free(&graph);
+
+  // later tests run on the default backend
+  bh_io_uring_use(false);
+
+  bh_files_t deps = {0};
+  bh_depfile_parse("out.o: a.c \\\n  b.h c.h\n", &deps);
+  assert(bh_darray_len(&deps) == 3 && strcmp(deps.items[2], "c.h") == 0);
+
+  bh_darray_free(&deps);
+  assert(bh_execute("rm -rf test_batch"));
+  printf("Batched stat and read tests passed!\n\n");
+}
+
+static bool test_has(bh_files_t *files, const char *path) {
+  for (size_t i = 0; i < bh_darray_len(files); ++i)
+    if (strcmp(files->items[i], path) == 0) return true;
+  return false;
+}
+
+void test_include_scanner() {
+  printf("Testing include scanner...\n");
+
+  assert(bh_execute("mkdir -p test_scan/src test_scan/inc/sub test_scan/sys"));
+  const char *main_c =
+    "#include \"a.h\"\n"
+    "  #  include <b.h>\n"
+    "#include <stdio.h>\n"
+    "#include <sys.h>\n"
+    "#if 0\n#include \"sub/c.h\"\n#endif\n"
+    "int main(void) { return 0; }\n";
+  assert(bh_file_write("test_scan/src/main.c", main_c, strlen(main_c)));
+  assert(bh_file_write("test_scan/src/a.h", "#include <b.h>\n", 15));
+  const char *b_h = "#pragma once\n#include \"sub/c.h\"\n#include \"b.h\"\n";
+  assert(bh_file_write("test_scan/inc/b.h", b_h, strlen(b_h)));
+  assert(bh_file_write("test_scan/inc/sub/c.h", "#pragma once\n", 13));
+  assert(bh_file_write("test_scan/sys/sys.h", "#include <b.h>\n", 15));
+
+  const char *args = "-Itest_scan/inc -isystem test_scan/sys";
+  bh_files_t deps = {0};
+  assert(bh_c_scan_includes(&deps, "test_scan/src/main.c", args));
+  assert(bh_darray_len(&deps) == 4);
+  assert(strcmp(deps.items[0], "test_scan/src/main.c") == 0);
+  assert(test_has(&deps, "test_scan/src/a.h"));
+  assert(test_has(&deps, "test_scan/inc/b.h"));
+  assert(test_has(&deps, "test_scan/inc/sub/c.h"));
+
+  // the cache answers the second time, and the answer doesn't change
+  bh_darray_reset(&deps);
+  assert(bh_c_scan_includes(&deps, "test_scan/src/main.c", args));
+  assert(bh_darray_len(&deps) == 4);
+
+  // a computed include falls back to the compiler
+  const char *computed = "#define HDR \"a.h\"\n#include HDR\n";
+  assert(bh_file_write("test_scan/src/computed.c", computed, strlen(computed)));
+  bh_darray_reset(&deps);
+  assert(!bh_c_scan_includes(&deps, "test_scan/src/computed.c", args));
+  bh_darray_reset(&deps);
+  assert(bh_c_source_get_include_paths(&deps, "test_scan/src/computed.c", args, "computed"));
+  assert(test_has(&deps, "test_scan/src/a.h") && test_has(&deps, "test_scan/inc/sub/c.h"));
+
+  // so does #include_next, which the cached lookups can't follow
+  assert(bh_file_write("test_scan/src/next.c", "#include <n.h>\n", 15));
+  assert(bh_file_write("test_scan/inc/n.h", "#include_next <n.h>\n", 20));
+  assert(bh_file_write("test_scan/sys/n.h", "#include <b.h>\n", 15));
+  bh_darray_reset(&deps);
+  assert(!bh_c_scan_includes(&deps, "test_scan/src/next.c", args));
+  bh_darray_reset(&deps);
+  assert(bh_c_source_get_include_paths(&deps, "test_scan/src/next.c", args, "next"));
+  assert(test_has(&deps, "test_scan/inc/n.h"));
+
+  bh_c_scan_reset();
+  bh_darray_free(&deps);
+  assert(bh_execute("rm -rf test_scan .build_cache/_csource_includes_computed_.d .build_cache/_csource_includes_next_.d"));
+  printf("Include scanner tests passed!\n\n");
+}
+
+void test_remote() {
+  printf("Testing remote compiles...\n");
+
+#if __UNIX__
+  assert(bh_execute("rm -rf test_remote && mkdir -p test_remote/inc"));
+  assert(bh_file_write("test_remote/inc/a.h", "#define BASE 40\n", 16));
+  const char *source = "#include \"a.h\"\nint main(void) { return BASE + VALUE; }\n";
+  assert(bh_file_write("test_remote/a.c", source, strlen(source)));
+  assert(bh_file_write("test_remote/bad.c", "int main(void) { return }\n", 26));
+
+  // only plain compiles are sent out
+  bh_remote_job_t job = {0};
+  assert(bh_remote_parse("cc -O2 -Iinc -MMD -c a.c -o a.o", &job) && !strcmp(job.source, "a.c") && !strcmp(job.output, "a.o"));
+  bh_darray_free(&job.args);
+  job = (bh_remote_job_t){0};
+  assert(!bh_remote_parse("cc a.o -o a", &job));
+  bh_darray_free(&job.args);
+  job = (bh_remote_job_t){0};
+  assert(!bh_remote_parse("cc -c a.c -o a.o && echo done", &job));
+  bh_darray_free(&job.args);
+  job = (bh_remote_job_t){0};
+  assert(!bh_remote_parse("cc -fplugin=x.so -c a.c -o a.o", &job));
+  bh_darray_free(&job.args);
+  job = (bh_remote_job_t){0};
+  assert(!bh_remote_parse("cc --specs=x -c a.c -o a.o", &job));
+  bh_darray_free(&job.args);
+
+  // the worker checks for itself, whatever a client sends
+  const char *refused[] = { "--specs=x", "--prefix=x", "-B", "-MF", "-Wp,-include", "-fprofile-use", "-O2/x", "x.c" };
+  for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    char *args = bh_fmt("cc%c%s", '\0', refused[i]);
+    size_t args_size = strlen(refused[i]) + 4;
+    bh_remote_header_t header = { .magic = htonl(BH_REMOTE_MAGIC), .args_size = htonl((uint32_t)args_size), .data_size = htonl(2) };
+    assert(bh_io_all(pair[0], &header, sizeof(header), true) && bh_io_all(pair[0], args, args_size, true));
+    assert(bh_io_all(pair[0], ";\n", 2, true));
+    bh_worker_handle(pair[1]);
+    bh_remote_header_t answer;
+    char text[128] = {0};
+    assert(bh_io_all(pair[0], &answer, sizeof(answer), false) && ntohl((uint32_t)answer.status) != 0);
+    size_t len = ntohl(answer.data_size);
+    assert(len < sizeof(text) && bh_io_all(pair[0], text, len, false) && strstr(text, "refused"));
+    close(pair[0]);
+    close(pair[1]);
+  }
+
+  // a loopback worker that leaves a mark for every request it takes
+  int port;
+  int listener = bh_worker_listen("127.0.0.1:0", &port);
+  assert(listener >= 0);
+  pid_t worker = fork();
+  if (worker == 0) {
+    for (int i = 0; i < 2; i++) {
+      int client = accept(listener, NULL, NULL);
+      bh_file_write(bh_fmt("test_remote/served_%d", i), "", 0);
+      bh_worker_handle(client);
+      close(client);
+    }
+    _exit(0);
+  }
+  close(listener);
+  assert(bh_remote_add(bh_fmt("127.0.0.1:%d", port)));
+  assert(!bh_remote_add("nohost"));
+
+  bh_async_t async = {0};
+  assert(bh_push_async(&async, "cc -Itest_remote/inc -DVALUE=2 -O2 -MMD -c test_remote/a.c -o test_remote/a.o"));
+  assert(!bh_await(&async));
+  bh_darray_reset(&async);
+  assert(bh_path_exist("test_remote/served_0") == is_file);
+  assert(bh_execute("cc test_remote/a.o -o test_remote/a && { ./test_remote/a; test $? = 42; }"));
+
+  // the depfile is written locally, for the object
+  bh_files_t deps = {0};
+  assert(bh_depfile_read("test_remote/a.d", &deps));
+  assert(test_has(&deps, "test_remote/inc/a.h"));
+  bh_darray_free(&deps);
+
+  // compile errors come back as failures, they don't rerun locally
+  assert(bh_push_async(&async, "cc -c test_remote/bad.c -o test_remote/bad.o"));
+  assert(bh_await(&async));
+  bh_darray_reset(&async);
+  assert(bh_path_exist("test_remote/served_1") == is_file);
+  assert(bh_path_exist("test_remote/bad.o") == is_none);
+  assert(waitpid(worker, NULL, 0) == worker);
+
+  // with the worker gone the job compiles here
+  assert(bh_push_async(&async, "cc -Itest_remote/inc -DVALUE=3 -c test_remote/a.c -o test_remote/a.o"));
+  assert(!bh_await(&async));
+  assert(bh_execute("cc test_remote/a.o -o test_remote/a && { ./test_remote/a; test $? = 43; }"));
+
+  // a worker hanging up mid request doesn't kill the job with SIGPIPE, it
+  // compiles here. the source is larger than the socket buffers, so the
+  // client is still writing when the connection goes
+  bh_sb_t big;
+  bh_sb_init(&big, build_arena);
+  bh_sb_append(&big, source);
+  for (int i = 0; i < 1 << 16; i++)
+    bh_sb_append(&big, ";;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;\n");
+  assert(bh_file_write("test_remote/big.c", big.data, big.len));
+
+  listener = bh_worker_listen("127.0.0.1:0", &port);
+  assert(listener >= 0);
+  worker = fork();
+  if (worker == 0) {
+    int client = accept(listener, NULL, NULL);
+    bh_remote_header_t header;
+    bh_io_all(client, &header, sizeof(header), false);
+    _exit(0);
+  }
+  close(listener);
+  bh_darray_reset(&bh_remote_hosts);
+  assert(bh_remote_add(bh_fmt("127.0.0.1:%d", port)));
+
+  bh_darray_reset(&async);
+  assert(bh_push_async(&async, "cc -Itest_remote/inc -DVALUE=4 -c test_remote/big.c -o test_remote/big.o"));
+  assert(!bh_await(&async));
+  assert(waitpid(worker, NULL, 0) == worker);
+  assert(bh_execute("cc test_remote/big.o -o test_remote/a && { ./test_remote/a; test $? = 44; }"));
+
+  bh_darray_free(&async);
+  bh_darray_reset(&bh_remote_hosts);
+  assert(bh_execute("rm -rf test_remote"));
+#endif
+
+  printf("Remote compile tests passed!\n\n");
+}
+
+static bh_test_t *find_test(bh_tests_t *tests, const char *name) {
+  for (size_t i = 0; i < bh_darray_len(tests); i++)
+    if (!strcmp(tests->items[i].name, name)) return &tests->items[i];
+  return NULL;
+}
+
+void test_test_runner() {
+  printf("Testing the test runner...\n");
+
+#if __UNIX__
+  assert(bh_execute("rm -f test_runner_flag"));
+  bh_tests_t tests = {0};
+  bh_test_add(&tests, "writes", "echo hi > out.txt && test -f out.txt");
+  bh_test_add(&tests, "isolated", "test ! -e out.txt && test \"$TMPDIR\" = \"$PWD\" && test \"$BH_TEST_NAME\" = isolated");
+  bh_test_add(&tests, "root", "test -f \"$BH_TEST_ROOT/.build_cache/commands.log\"");
+  bh_test_add(&tests, "broken", "echo broken output; exit 3");
+  bh_test_add(&tests, "flaky", "test -f \"$BH_TEST_ROOT/test_runner_flag\" || { touch \"$BH_TEST_ROOT/test_runner_flag\"; exit 1; }");
+
+  assert(!bh_test_run(&tests, 2));
+  assert(find_test(&tests, "writes")->passed && find_test(&tests, "writes")->attempts == 1);
+  assert(find_test(&tests, "isolated")->passed);
+  assert(find_test(&tests, "root")->passed);
+  assert(!find_test(&tests, "broken")->passed && find_test(&tests, "broken")->attempts == 1 + BUILD_TEST_RERUNS);
+  assert(find_test(&tests, "flaky")->passed && find_test(&tests, "flaky")->flaky);
+
+  // output is kept for failures only
+  char *output = bh_file_read(bh_fmt("%s/output.log", bh_test_dir("broken")));
+  assert(output && strstr(output, "broken output"));
+  assert(bh_path_exist(bh_test_dir("writes")) == is_none);
+  bh_darray_reset(&tests);
+
+  // parallel tests take the time of the longest one
+  const char *sleeps[] = { "sleep 0.5", "sleep 0.3", "sleep 0.15", "sleep 0.05" };
+  for (int i = 0; i < 4; i++)
+    bh_test_add(&tests, bh_fmt("sleep_%d", i), sleeps[i]);
+  int64_t start = test_now_ms();
+  assert(bh_test_run(&tests, 4));
+  assert(test_now_ms() - start < 1000);
+
+  // shards split by the recorded durations: 500 alone, 300+150+50 together.
+  // shard 1 then runs much faster than recorded, which must not move tests
+  // between the shards of this run
+  const int64_t recorded[] = { 500, 300, 150, 50 };
+  for (int i = 0; i < 4; i++) {
+    bh_command_record(bh_fmt("test:sleep_%d", i), tests.items[i].command, recorded[i]);
+    tests.items[i].command = "true";
+  }
+  build_options.shard_count = 2;
+  int runs[4] = {0};
+  for (int shard = 1; shard <= 2; shard++) {
+    build_options.shard_index = shard;
+    assert(bh_test_run(&tests, 4));
+    for (int i = 0; i < 4; i++) {
+      runs[i] += tests.items[i].attempts;
+      bool ran = tests.items[i].attempts > 0;
+      assert(ran == (shard == 1 ? i == 0 : i != 0));
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    assert(runs[i] == 1);
+    assert(bh_command_duration(bh_fmt("test:sleep_%d", i)) == recorded[i]);
+  }
+  build_options.shard_count = build_options.shard_index = 0;
+
+  bh_darray_free(&tests);
+  assert(bh_execute("rm -f test_runner_flag"));
+#endif
+
+  printf("Test runner tests passed!\n\n");
+}
+
+void test_build_graph() {
+  printf("Testing build graph...\n");
+
+  assert(bh_execute("mkdir -p test_graph"));
+  const char *header = "int lib(void);\n";
+  const char *lib = "#include \"lib.h\"\nint lib(void) { return 0; }\n";
+  const char *app = "#include \"lib.h\"\nint main() { return lib(); }\n";
+  const char *other = "int main() { return 0; }\n";
+  assert(bh_file_write("test_graph/lib.h", header, strlen(header)));
+  assert(bh_file_write("test_graph/lib.c", lib, strlen(lib)));
+  assert(bh_file_write("test_graph/main.c", app, strlen(app)));
+  assert(bh_file_write("test_graph/other.c", other, strlen(other)));
+
+  bh_graph_t graph = {0};
+  bh_files_t inputs = {0};
+  const char *sources[] = { "lib", "main", "other" };
+
+  for (int i = 0; i < 3; i++) {
+    bh_darray_reset(&inputs);
+    bh_darray_push(&inputs, bh_fmt("test_graph/%s.c", sources[i]));
+    size_t target = bh_graph_add(&graph, bh_fmt("test_graph/%s.o", sources[i]), &inputs,
+      bh_fmt("cc -c test_graph/%s.c -o test_graph/%s.o -MMD -MF test_graph/%s.d", sources[i], sources[i], sources[i]));
+    bh_graph_set_depfile(&graph, target, bh_fmt("test_graph/%s.d", sources[i]));
+  }
+
+  // declared before its objects on purpose
+  bh_darray_reset(&inputs);
+  bh_darray_push(&inputs, "test_graph/main.o");
+  bh_darray_push(&inputs, "test_graph/lib.o");
+  bh_graph_add(&graph, "test_graph/app", &inputs, "cc -o test_graph/app test_graph/main.o test_graph/lib.o");
+
+  assert(bh_graph_build(&graph));
+  assert(bh_path_exist("test_graph/app") == is_file);
+
+  int64_t app_time = test_mtime_ns("test_graph/app");
+  int64_t other_time = test_mtime_ns("test_graph/other.o");
+
+  // nothing changed
+  assert(bh_graph_build(&graph));
+  assert(test_mtime_ns("test_graph/app") == app_time);
+
+  // the header only reaches lib.o, main.o and app through the depfiles
+  usleep(20 * 1000);
+  assert(bh_execute("touch test_graph/lib.h"));
+  bh_graph_invalidate(&graph, "test_graph/lib.h");
+  assert(bh_graph_build(&graph));
+  assert(test_mtime_ns("test_graph/app") > app_time);
+  assert(test_mtime_ns("test_graph/other.o") == other_time);
+
+  // a failing command fails the build
+  bh_darray_reset(&inputs);
+  bh_darray_push(&inputs, "test_graph/missing.c");
+  bh_graph_add(&graph, "test_graph/missing.o", &inputs, "cc -c test_graph/missing.c -o test_graph/missing.o 2>/dev/null");
+  assert(!bh_graph_build(&graph));
+
+  bh_darray_free(&inputs);
+  bh_graph_free(&graph);
+  assert(bh_execute("rm -rf test_graph"));
+  printf("Build graph tests passed!\n\n");
+}
+
+// every .txt in test_watch/src is copied to test_watch/out
+static void watch_plan(bh_graph_t *graph) {
+  bh_graph_reset(graph);
+
+  bh_files_t sources = {0}, inputs = {0};
+  bh_files_get("test_watch/src", &sources);
+  for (size_t i = 0; i < bh_darray_len(&sources); i++) {
+    const char *name = strrchr(sources.items[i], '/') + 1;
+    bh_darray_reset(&inputs);
+    bh_darray_push(&inputs, sources.items[i]);
+    bh_graph_add(graph, bh_fmt("test_watch/out/%s", name), &inputs,
+      bh_fmt("cp %s test_watch/out/%s", sources.items[i], name));
+  }
+  bh_darray_free(&inputs);
+  bh_darray_free(&sources);
+}
+
+static bool watch_wait(const char *path, const char *content) {
+  for (int i = 0; i < 500; i++) {
+    size_t len;
+    char *text = bh_read_all(path, &len);
+    bool same = text && !strcmp(text, content);
+    free(text);
+    if (same) return true;
+    usleep(10 * 1000);
+  }
+  return false;
+}
+
+void test_graph_watch() {
+  printf("Testing watch mode...\n");
+
+#if __linux__
+  assert(bh_execute("rm -rf test_watch && mkdir -p test_watch/src test_watch/out && echo one > test_watch/src/a.txt"));
+  bh_files_t dirs = {0};
+  bh_darray_push(&dirs, "test_watch/src");
+
+  fflush(stdout);
+  pid_t watcher = fork();
+  if (watcher == 0) {
+    bh_graph_t graph = {0};
+    watch_plan(&graph);
+    bh_graph_watch(&graph, &dirs, watch_plan);
+    _exit(1);
+  }
+  assert(watch_wait("test_watch/out/a.txt", "one\n"));
+
+  // an edit rebuilds what depends on it
+  usleep(20 * 1000);
+  assert(bh_execute("echo two > test_watch/src/a.txt"));
+  assert(watch_wait("test_watch/out/a.txt", "two\n"));
+
+  // a new file changes the listing, which replans
+  assert(bh_execute("echo three > test_watch/src/b.txt"));
+  assert(watch_wait("test_watch/out/b.txt", "three\n"));
+
+  kill(watcher, SIGKILL);
+  assert(waitpid(watcher, NULL, 0) == watcher);
+  bh_darray_free(&dirs);
+  assert(bh_execute("rm -rf test_watch"));
+#endif
+
+  printf("Watch mode tests passed!\n\n");
+}
+
+void test_explain() {
+  printf("Testing explain mode...\n");
+
+  assert(bh_execute("mkdir -p test_explain"));
+  assert(bh_file_write("test_explain/a.txt", "a", 1));
+  assert(bh_execute("cp test_explain/a.txt test_explain/b.txt && cp test_explain/b.txt test_explain/c.txt"));
+
+  bh_files_t inputs = {0};
+  const char *culprit = NULL;
+  bh_darray_push(&inputs, "test_explain/a.txt");
+  assert(bh_binary_staleness("test_explain/b.txt", &inputs, &culprit) == BH_FRESH);
+  assert(bh_binary_staleness("test_explain/none.txt", &inputs, &culprit) == BH_STALE_MISSING_OUTPUT);
+
+  // a missing input is stale instead of silently skipped
+  bh_darray_push(&inputs, "test_explain/gone.txt");
+  assert(bh_binary_staleness("test_explain/b.txt", &inputs, &culprit) == BH_STALE_MISSING_INPUT);
+  assert(strcmp(culprit, "test_explain/gone.txt") == 0);
+  assert(bh_is_binary_old("test_explain/b.txt", &inputs));
+
+  bh_graph_t graph = {0};
+  bh_darray_reset(&inputs);
+  bh_darray_push(&inputs, "test_explain/a.txt");
+  size_t b = bh_graph_add(&graph, "test_explain/b.txt", &inputs, "cp test_explain/a.txt test_explain/b.txt");
+  bh_darray_reset(&inputs);
+  bh_darray_push(&inputs, "test_explain/b.txt");
+  size_t c = bh_graph_add(&graph, "test_explain/c.txt", &inputs, "cp test_explain/b.txt test_explain/c.txt");
+
+  usleep(20 * 1000);
+  assert(bh_execute("touch test_explain/a.txt"));
+  int64_t c_time = test_mtime_ns("test_explain/c.txt");
+
+  // c.txt is only stale because b.txt would be rebuilt, and nothing runs
+  build_options.explain = true;
+  assert(bh_graph_build(&graph));
+  assert(bh_graph_target(&graph, b)->stale == BH_STALE_NEWER_INPUT);
+  assert(bh_graph_target(&graph, c)->stale == BH_STALE_DEPENDENCY);
+  assert(test_mtime_ns("test_explain/c.txt") == c_time);
+  bh_darray_reset(&inputs);
+  bh_darray_push(&inputs, "test_explain/a.txt");
+  assert(!bh_on_binary_old_execute("test_explain/b.txt", &inputs, "false"));
+  build_options.explain = false;
+
+  assert(bh_graph_build(&graph));
+  assert(test_mtime_ns("test_explain/c.txt") > c_time);
+
+  bh_darray_free(&inputs);
+  bh_graph_free(&graph);
+  assert(bh_execute("rm -rf test_explain"));
+  printf("Explain mode tests passed!\n\n");
+}
+
+void test_command_changes() {
+  printf("Testing command line tracking...\n");
+
+  assert(bh_execute("mkdir -p test_commands && echo x > test_commands/in.txt"));
+
+  bh_files_t inputs = {0};
+  bh_darray_push(&inputs, "test_commands/in.txt");
+
+  // the first run records the command, the second has nothing to do
+  assert(bh_on_binary_old_execute("test_commands/a.txt", &inputs, "cp test_commands/in.txt test_commands/a.txt"));
+  assert(!bh_command_changed("test_commands/a.txt", "cp test_commands/in.txt test_commands/a.txt"));
+  assert(!bh_on_binary_old_execute("test_commands/a.txt", &inputs, "cp test_commands/in.txt test_commands/a.txt"));
+
+  // same timestamps, different flags
+  assert(bh_command_changed("test_commands/a.txt", "cp -p test_commands/in.txt test_commands/a.txt"));
+  assert(bh_on_binary_old_execute("test_commands/a.txt", &inputs, "cp -p test_commands/in.txt test_commands/a.txt"));
+  assert(!bh_command_changed("test_commands/a.txt", "cp -p test_commands/in.txt test_commands/a.txt"));
+
+  bh_graph_t graph = {0};
+  size_t b = bh_graph_add(&graph, "test_commands/b.txt", &inputs, "cp test_commands/in.txt test_commands/b.txt");
+  bh_graph_add(&graph, "test_commands/c.txt", &inputs, "cp test_commands/in.txt test_commands/c.txt");
+  assert(bh_graph_build(&graph));
+
+  int64_t b_time = test_mtime_ns("test_commands/b.txt");
+  int64_t c_time = test_mtime_ns("test_commands/c.txt");
+
+  // only the target whose command changed reruns
+  usleep(20 * 1000);
+  bh_graph_reset(&graph);
+  bh_graph_add(&graph, "test_commands/b.txt", &inputs, "cat test_commands/in.txt > test_commands/b.txt");
+  bh_graph_add(&graph, "test_commands/c.txt", &inputs, "cp test_commands/in.txt test_commands/c.txt");
+  assert(bh_graph_build(&graph));
+  assert(bh_graph_target(&graph, b)->stale == BH_FRESH);
+  assert(test_mtime_ns("test_commands/b.txt") > b_time);
+  assert(test_mtime_ns("test_commands/c.txt") == c_time);
+
+  bh_darray_free(&inputs);
+  bh_graph_free(&graph);
+  assert(bh_execute("rm -rf test_commands"));
+  printf("Command line tracking tests passed!\n\n");
+}
+
+void test_restat() {
+  printf("Testing early cutoff...\n");
+
+  bh_restat_t modes[] = { BH_RESTAT_DIGEST, BH_RESTAT_MTIME };
+  for (size_t m = 0; m < 2; ++m) {
+    assert(bh_execute("rm -rf test_restat && mkdir -p test_restat && echo ab > test_restat/in.txt"));
+
+    // mid.txt only depends on the first byte of in.txt
+    bh_graph_t graph = {0};
+    bh_files_t inputs = {0};
+    bh_darray_push(&inputs, "test_restat/in.txt");
+    size_t mid = bh_graph_add(&graph, "test_restat/mid.txt", &inputs, "cut -c1 test_restat/in.txt > test_restat/mid.txt");
+    bh_graph_set_restat(&graph, mid, modes[m]);
+    bh_darray_reset(&inputs);
+    bh_darray_push(&inputs, "test_restat/mid.txt");
+    size_t out = bh_graph_add(&graph, "test_restat/out.txt", &inputs, "cp test_restat/mid.txt test_restat/out.txt");
+    assert(bh_graph_build(&graph));
+
+    int64_t mid_time = test_mtime_ns("test_restat/mid.txt");
+    int64_t out_time = test_mtime_ns("test_restat/out.txt");
+
+    // mid.txt is rebuilt with the same content, out.txt isn't
+    usleep(20 * 1000);
+    assert(bh_execute("echo ac > test_restat/in.txt"));
+    bh_graph_invalidate(&graph, "test_restat/in.txt");
+    assert(bh_graph_build(&graph));
+    assert(test_mtime_ns("test_restat/out.txt") == out_time);
+    if (modes[m] == BH_RESTAT_MTIME) assert(test_mtime_ns("test_restat/mid.txt") == mid_time);
+
+    // and both stay up to date for a fresh graph
+    bh_graph_reset(&graph);
+    bh_darray_reset(&inputs);
+    bh_darray_push(&inputs, "test_restat/in.txt");
+    mid = bh_graph_add(&graph, "test_restat/mid.txt", &inputs, "cut -c1 test_restat/in.txt > test_restat/mid.txt");
+    bh_graph_set_restat(&graph, mid, modes[m]);
+    bh_darray_reset(&inputs);
+    bh_darray_push(&inputs, "test_restat/mid.txt");
+    out = bh_graph_add(&graph, "test_restat/out.txt", &inputs, "cp test_restat/mid.txt test_restat/out.txt");
+    int64_t in_time = test_mtime_ns("test_restat/in.txt");
+    assert(bh_graph_build(&graph));
+    assert(bh_graph_target(&graph, mid)->stale == BH_FRESH);
+    assert(test_mtime_ns("test_restat/out.txt") == out_time);
+    assert(test_mtime_ns("test_restat/in.txt") == in_time);
+
+    // a real change still goes through
+    usleep(20 * 1000);
+    assert(bh_execute("echo bc > test_restat/in.txt"));
+    bh_graph_invalidate(&graph, "test_restat/in.txt");
+    assert(bh_graph_build(&graph));
+    assert(test_mtime_ns("test_restat/out.txt") > out_time);
+    assert(bh_graph_target(&graph, out)->stale == BH_FRESH);
+
+    bh_darray_free(&inputs);
+    bh_graph_free(&graph);
+  }
+
+  assert(bh_execute("rm -rf test_restat"));
+  printf("Early cutoff tests passed!\n\n");
+}
+
+void test_trace() {
+  printf("Testing traced dependencies...\n");
+
+#if defined(__linux__)
+  assert(bh_execute("rm -rf test_trace && mkdir -p test_trace && echo a > test_trace/in.txt && echo b > test_trace/other.txt"));
+
+  bh_trace_t modes[] = { BH_TRACE_PRELOAD, BH_TRACE_PTRACE };
+  for (size_t m = 0; m < 2; ++m) {
+#if !defined(__x86_64__)
+    if (modes[m] == BH_TRACE_PTRACE) continue;
+#endif
+    bh_trace_use(modes[m]);
+    bh_files_t inputs = {0}, outputs = {0};
+    assert(bh_execute_traced("cat test_trace/in.txt > test_trace/out.txt", &inputs, &outputs));
+    assert(test_has(&inputs, "test_trace/in.txt"));
+    assert(!test_has(&inputs, "test_trace/other.txt"));
+    assert(!test_has(&inputs, "test_trace/out.txt"));
+    assert(test_has(&outputs, "test_trace/out.txt"));
+    bh_darray_free(&inputs);
+    bh_darray_free(&outputs);
+
+    // a failing command still fails
+    assert(!bh_execute_traced("cat test_trace/missing.txt > /dev/null 2>&1", NULL, NULL));
+  }
+  bh_trace_use(BH_TRACE_AUTO);
+
+  // the graph learns in.txt from the trace alone
+  assert(bh_execute("rm -f test_trace/out.txt"));
+  bh_graph_t graph = {0};
+  bh_files_t none = {0};
+  size_t out = bh_graph_add(&graph, "test_trace/out.txt", &none, "cat test_trace/in.txt > test_trace/out.txt");
+  bh_graph_set_traced(&graph, out);
+  assert(bh_graph_build(&graph));
+  assert(bh_graph_build(&graph));
+  assert(bh_graph_target(&graph, out)->stale == BH_FRESH);
+
+  int64_t out_time = test_mtime_ns("test_trace/out.txt");
+  usleep(20 * 1000);
+  assert(bh_execute("echo c > test_trace/in.txt"));
+  bh_graph_invalidate(&graph, "test_trace/in.txt");
+  assert(bh_graph_build(&graph));
+  assert(test_mtime_ns("test_trace/out.txt") > out_time);
+
+  // touching a file it never read doesn't
+  out_time = test_mtime_ns("test_trace/out.txt");
+  usleep(20 * 1000);
+  assert(bh_execute("echo d > test_trace/other.txt"));
+  bh_graph_invalidate(&graph, "test_trace/other.txt");
+  assert(bh_graph_build(&graph));
+  assert(test_mtime_ns("test_trace/out.txt") == out_time);
+
+  bh_graph_free(&graph);
+  assert(bh_execute("rm -rf test_trace"));
+#endif
+
+  printf("Traced dependency tests passed!\n\n");
+}
+
+static void ninja_deps_path(bh_sb_t *sb, const char *path, int32_t id) {
+  uint32_t size = (strlen(path) + 3) / 4 * 4 + 4, checksum = ~(uint32_t)id;
+  bh_sb_append_sv(sb, bh_sv_from_parts((const char *)&size, 4));
+  bh_sb_append_sv(sb, bh_sv_from_parts(path, strlen(path)));
+  for (size_t i = strlen(path); i % 4; ++i) bh_sb_append_char(sb, '\0');
+  bh_sb_append_sv(sb, bh_sv_from_parts((const char *)&checksum, 4));
+}
+
+void test_ninja() {
+  printf("Testing ninja export and import...\n");
+
+  assert(bh_execute("mkdir -p test_ninja && echo 'int x;' > test_ninja/a.h && echo 'int y;' > test_ninja/b.c"));
+
+  bh_graph_t graph = {0};
+  bh_files_t inputs = {0};
+  bh_darray_push(&inputs, "test_ninja/b.c");
+  size_t obj = bh_graph_add(&graph, "test_ninja/b.o", &inputs, "cp test_ninja/b.c test_ninja/b.o && echo $$ >/dev/null");
+  bh_graph_set_depfile(&graph, obj, "test_ninja/b.o.d");
+
+  assert(bh_graph_write_ninja(&graph, "test_ninja/build.ninja"));
+  char *ninja = bh_file_read("test_ninja/build.ninja");
+  assert(strstr(ninja, "build test_ninja/b.o: run_deps test_ninja/b.c\n"));
+  assert(strstr(ninja, "  cmd = cp test_ninja/b.c test_ninja/b.o && echo $$$$ >/dev/null\n"));
+  assert(strstr(ninja, "  depfile = test_ninja/b.o.d\n"));
+
+  // what ninja leaves behind: a log entry and deps, but no depfile
+  assert(bh_execute("cp test_ninja/b.c test_ninja/b.o"));
+  const char *command = "cp test_ninja/b.c test_ninja/b.o && echo $$ >/dev/null";
+  char *log = bh_fmt("# ninja log v5\n10\t1510\t0\ttest_ninja/b.o\t%llx\n", (unsigned long long)bh_ninja_hash(command));
+  assert(bh_file_write("test_ninja/.ninja_log", log, strlen(log)));
+
+  bh_sb_t deps;
+  bh_sb_init(&deps, build_arena);
+  uint32_t version = 4;
+  bh_sb_append(&deps, "# ninjadeps\n");
+  bh_sb_append_sv(&deps, bh_sv_from_parts((const char *)&version, 4));
+  ninja_deps_path(&deps, "test_ninja/b.o", 0);
+  ninja_deps_path(&deps, "test_ninja/a.h", 1);
+  uint32_t record[] = { 0x80000000u | 16, 0, 0, 0, 1 };
+  bh_sb_append_sv(&deps, bh_sv_from_parts((const char *)record, sizeof(record)));
+  assert(bh_file_write("test_ninja/.ninja_deps", deps.data, deps.len));
+
+  bh_graph_import_ninja(&graph, "test_ninja/.ninja_log", "test_ninja/.ninja_deps");
+  assert(bh_darray_len(&bh_graph_target(&graph, obj)->implicit) == 1);
+  assert(bh_command_duration("test_ninja/b.o") == 1500);
+  assert(!bh_command_changed("test_ninja/b.o", command));
+
+  // up to date after the import, and the header from .ninja_deps counts
+  int64_t obj_time = test_mtime_ns("test_ninja/b.o");
+  assert(bh_graph_build(&graph));
+  assert(test_mtime_ns("test_ninja/b.o") == obj_time);
+
+  usleep(20 * 1000);
+  assert(bh_execute("touch test_ninja/a.h"));
+  bh_graph_invalidate(&graph, "test_ninja/a.h");
+  assert(bh_graph_build(&graph));
+  assert(test_mtime_ns("test_ninja/b.o") > obj_time);
+
+  bh_darray_free(&inputs);
+  bh_graph_free(&graph);
+  assert(bh_execute("rm -rf test_ninja"));
+  printf("Ninja export and import tests passed!\n\n");
+}
+
+void test_compdb() {
+  printf("Testing compilation database...\n");
+
+  // a foreign entry with `arguments` and escapes survives the merge as is
+  const char *foreign = "[\n  {\"directory\": \"/elsewhere\", \"arguments\": [\"cc\", \"-c\", \"x \\\"y\\\".c\"], \"file\": \"x.c\", \"n\": 1}\n]\n";
+  assert(bh_file_write(BUILD_COMPDB, foreign, strlen(foreign)));
+  build_compdb = (bh_compdb_t){ 0 };
+
+  bh_compdb_add("src/a.c", "out/a.o", "cc -c src/a.c -o out/a.o -DNAME=\"a\"");
+  assert(bh_compdb_flush());
+
+  char *json = bh_file_read(BUILD_COMPDB);
+  assert(strstr(json, "{\"directory\": \"/elsewhere\", \"arguments\": [\"cc\", \"-c\", \"x \\\"y\\\".c\"], \"file\": \"x.c\", \"n\": 1}"));
+  assert(strstr(json, "\"file\": \"src/a.c\""));
+  assert(strstr(json, "\"command\": \"cc -c src/a.c -o out/a.o -DNAME=\\\"a\\\"\""));
+
+  // the same command again doesn't touch the file
+  int64_t written = test_mtime_ns(BUILD_COMPDB);
+  usleep(20 * 1000);
+  build_compdb = (bh_compdb_t){ 0 };
+  bh_compdb_add("src/a.c", "out/a.o", "cc -c src/a.c -o out/a.o -DNAME=\"a\"");
+  assert(bh_compdb_flush());
+  assert(test_mtime_ns(BUILD_COMPDB) == written);
+
+  // a changed command replaces just its entry
+  bh_compdb_add("src/a.c", "out/a.o", "cc -O2 -c src/a.c -o out/a.o");
+  assert(bh_compdb_flush());
+  json = bh_file_read(BUILD_COMPDB);
+  assert(strstr(json, "\"command\": \"cc -O2 -c src/a.c -o out/a.o\""));
+  assert(!strstr(json, "-DNAME"));
+  assert(strstr(json, "\"file\": \"x.c\""));
+
+  // an entry without a directory, spelled with \u escapes, is the same file as ours
+  const char *relative = "[\n  {\"file\": \"src/\\u00e9\\u4e2d\\ud83d\\ude00.c\", \"command\": \"cc -c stale.c\"}\n]\n";
+  assert(bh_file_write(BUILD_COMPDB, relative, strlen(relative)));
+  build_compdb = (bh_compdb_t){ 0 };
+  bh_compdb_add("src/\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80.c", "out/u.o", "cc -c fresh.c");
+  assert(bh_compdb_flush());
+  json = bh_file_read(BUILD_COMPDB);
+  assert(strstr(json, "cc -c fresh.c"));
+  assert(!strstr(json, "stale.c"));
+
+  // graph targets that compile a source are added on build
+  assert(bh_execute("mkdir -p test_compdb && echo 'int x;' > test_compdb/x.c"));
+  bh_graph_t graph = {0};
+  bh_files_t inputs = {0};
+  bh_darray_push(&inputs, "test_compdb/x.c");
+  bh_graph_add(&graph, "test_compdb/x.o", &inputs, "cc -c test_compdb/x.c -o test_compdb/x.o");
+  bh_graph_add(&graph, "test_compdb/x.txt", &inputs, "cp test_compdb/x.c test_compdb/x.txt");
+  assert(bh_graph_build(&graph));
+
+  json = bh_file_read(BUILD_COMPDB);
+  assert(strstr(json, "\"output\": \"test_compdb/x.o\""));
+  assert(!strstr(json, "test_compdb/x.txt"));
+
+  bh_darray_free(&inputs);
+  bh_graph_free(&graph);
+  assert(bh_execute("rm -rf test_compdb " BUILD_COMPDB));
+  build_compdb = (bh_compdb_t){ 0 };
+  printf("Compilation database tests passed!\n\n");
+}
+
+// plans made by the test itself mean the client fell back to a local build
+static pid_t daemon_test_pid;
+static int daemon_local_plans;
+
+static void daemon_plan(bh_graph_t *graph) {
+  if (getpid() == daemon_test_pid) daemon_local_plans++;
+  bh_graph_reset(graph);
+
+  bh_files_t inputs = {0};
+  bh_darray_push(&inputs, "test_daemon/input.txt");
+  bh_graph_add(graph, "test_daemon/output.txt", &inputs, "cp test_daemon/input.txt test_daemon/output.txt");
+  bh_darray_free(&inputs);
+}
+
+void test_build_daemon(char *argv[]) {
+  printf("Testing build daemon...\n");
+
+  assert(bh_execute("mkdir -p test_daemon && echo one > test_daemon/input.txt"));
+  bh_files_t dirs = {0};
+  bh_darray_push(&dirs, "test_daemon");
+  daemon_test_pid = getpid();
+  daemon_local_plans = 0;
+
+  // starts the daemon, which does the first build
+  char *start[] = { argv[0], "--daemon" };
+  bh_parse_options(2, start);
+  assert(bh_graph_main(2, start, &dirs, daemon_plan) == 0);
+  assert(access(BUILD_DAEMON_SOCKET, F_OK) == 0);
+  assert(strcmp(bh_file_read("test_daemon/output.txt"), "one\n") == 0);
+
+  // the daemon notices the edit through inotify
+  usleep(20 * 1000);
+  assert(bh_execute("echo two > test_daemon/input.txt"));
+  build_options = (bh_options_t){ 0 };
+  assert(bh_graph_main(1, argv, &dirs, daemon_plan) == 0);
+  assert(strcmp(bh_file_read("test_daemon/output.txt"), "two\n") == 0);
+
+  // a client whose stdout is a closed pipe doesn't take the daemon down,
+  // though explain mode reports there
+  int pipe_fds[2];
+  assert(pipe(pipe_fds) == 0);
+  close(pipe_fds[0]);
+  int saved_out = dup(STDOUT_FILENO);
+  fflush(stdout);
+  dup2(pipe_fds[1], STDOUT_FILENO);
+  close(pipe_fds[1]);
+  signal(SIGPIPE, SIG_IGN);
+  build_options = (bh_options_t){ 0 };
+  char *explain[] = { argv[0], "--explain" };
+  bh_parse_options(2, explain);
+  bh_graph_main(2, explain, &dirs, daemon_plan);
+  dup2(saved_out, STDOUT_FILENO);
+  close(saved_out);
+  signal(SIGPIPE, SIG_DFL);
+  assert(daemon_local_plans == 0);
+
+  char *stop[] = { argv[0], "--daemon-stop" };
+  build_options = (bh_options_t){ 0 };
+  bh_parse_options(2, stop);
+  assert(bh_graph_main(2, stop, &dirs, daemon_plan) == 0);
+  build_options = (bh_options_t){ 0 };
+
+  usleep(50 * 1000);
+  assert(access(BUILD_DAEMON_SOCKET, F_OK) != 0);
+  assert(daemon_local_plans == 0);
+
+  bh_darray_free(&dirs);
+  assert(bh_execute("rm -rf test_daemon"));
+  printf("Build daemon tests passed!\n\n");
+}
+
+void test_response_files() {
+  printf("Testing response files...\n");
+
+  const char *src_content = "int main() { return sizeof(GREETING) != 4; }\n";
+  assert(bh_file_write("test_rsp.c", src_content, strlen(src_content)));
+  assert(bh_execute("mkdir -p test_rsp_dir && ar rcs test_rsp_dir/empty.a"));
+
+  // a link line far longer than `sh -c` accepts in a single argument
+  bh_sb_t sb;
+  bh_sb_init(&sb, build_arena);
+  bh_sb_append(&sb, "cc -o test_rsp test_rsp.c -DGREETING='\"a b\"'");
+  for (int i = 0; i < 4000; i++) {
+    bh_sb_appendf(&sb, " test_rsp_dir/../test_rsp_dir/../test_rsp_dir/empty.a");
+  }
+  char *command = bh_sb_finish(&sb);
+  assert(strlen(command) > BUILD_RSP_THRESHOLD);
+
+  char *rsp = bh_command_rsp(command);
+  assert(strncmp(rsp, "cc @.build_cache/rsp/", 21) == 0);
+  assert(strcmp(bh_command_rsp(command), rsp) == 0);
+  assert(strcmp(bh_command_rsp("cc -c a.c"), "cc -c a.c") == 0);
+
+  assert(bh_execute(command));
+  assert(bh_execute("./test_rsp"));
+
+  bh_files_t files = {0};
+  assert(bh_files_get(".build_cache/rsp", &files));
+  size_t rsp_files = 0;
+  for (size_t i = 0; i < files.count; i++) {
+    if (strstr(files.items[i], ".rsp")) rsp_files++;
+  }
+  assert(rsp_files == 1);
+
+  bh_darray_free(&files);
+  assert(bh_execute("rm -rf test_rsp test_rsp.c test_rsp_dir .build_cache/rsp"));
+  printf("Response file tests passed!\n\n");
+}
+
 int main(int argc, char *argv[])
 {
   bh_init(argc, argv);
 
-  bh_init_arena(&arena, 1024 * 1024);
+  bh_init_arena(&arena, 16 * 1024 * 1024);
   build_arena = &arena;
 
   test_dynamic_array();
   test_string_operations();
+  test_string_views();
+  test_string_builder();
+  test_byte_kernels();
+  test_string_interning();
+  test_thread_arenas();
+  test_parallel();
   test_file_operations();
+  test_dir_cache();
   test_async_operations();
+  test_job_control();
+  test_remote();
+  test_progress();
+  test_test_runner();
   test_error_handling();
   test_build_system();
+  test_logging();
+  test_io_batches();
+  test_include_scanner();
+  test_build_graph();
+  test_graph_watch();
+  test_explain();
+  test_command_changes();
+  test_restat();
+  test_trace();
+  test_ninja();
+  test_compdb();
+  test_build_daemon(argv);
+  test_response_files();
 
   printf("All tests passed successfully!\n");
 